@@ -1,5 +1,6 @@
 #include "ipc.h"
 #include "logger.h"
+#include "options.h"
 #include "shm_core.h"
 #include "scheduler.h"
 
@@ -10,40 +11,69 @@
 #include <unistd.h>
 
 std::atomic<bool> g_app_running(true);
+// 主线程在其上休眠, 退出或交接时置 1 并唤醒
+std::atomic<uint32_t> g_app_wake(0);
+
+static void wakeMain() {
+    g_app_running = false;
+    g_app_wake.store(1);
+    ks_futex_wake(&g_app_wake);
+}
 
 void signalHandler(int signum) {
     std::cout << "\n[Main] Received signal " << signum << ", shutting down..." << std::endl;
-    g_app_running = false;
+    wakeMain();
 }
 
-int main() {
+int main(int argc, char** argv) {
+    ServerOptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        return 1;
+    }
+
+    LogManager::instance().configure(opts.log);
+
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
-    // 初始化核心调度器
-    Scheduler scheduler;
+    // 初始化 IPC 服务 (使用共享内存实现); --takeover 时在此等待旧进程交出,
+    // 之后才创建调度器, 统计页等按名字共享的段不会与旧进程的同时存在
+    ShmServer ipcServer(opts.wait, opts.hugePages, opts.takeover);
 
-    // 初始化 IPC 服务 (使用共享内存实现)
-    ShmServer ipcServer;
-    
     std::cout << "[Main] Initializing IPC..." << std::endl;
     if (!ipcServer.init()) {
         std::cerr << "[Main] Failed to init IPC" << std::endl;
         return 1;
     }
 
+    // 初始化核心调度器 (策略由 --policy 选择)
+    std::unique_ptr<IScheduler> scheduler = createScheduler(opts);
+    std::cout << "[Main] Scheduling policy: " << opts.policy.name << std::endl;
+
+    ipcServer.setHandoverHandler(wakeMain);
+
     ipcServer.start([&scheduler](std::unique_ptr<IChannel> channel) {
-        scheduler.onNewClient(std::move(channel));
+        scheduler->onNewClient(std::move(channel));
     });
 
     std::cout << "[Main] System running. Press Ctrl+C to exit." << std::endl;
     while (g_app_running) {
-        sleep(1000);
+        ks_futex_wait(&g_app_wake, 0, 0);
+    }
+
+    if (ipcServer.handoverRequested()) {
+        // 先停止发现新客户端, 再停止 worker, 最后通知新进程接管
+        std::cout << "[Main] Handing over to the new scheduler..." << std::endl;
+        ipcServer.stop();
+        scheduler->handOver();
+        ipcServer.handOver();
+        std::cout << "[Main] Bye." << std::endl;
+        return 0;
     }
 
     std::cout << "[Main] Stopping services..." << std::endl;
     ipcServer.stop();
-    scheduler.stop();
+    scheduler->stop();
 
     std::cout << "[Main] Bye." << std::endl;
     return 0;
@@ -0,0 +1,430 @@
+// ks_bench: 共享内存通道往返延迟的微基准
+// fork N 个合成客户端 (真实的 registry / ClientChannelStruct 握手), 测量请求 -> 裁决的往返时间,
+// 在客户端数、突发大小、消息大小上扫描, 结果写为 JSON
+
+#include "config.h"
+#include "flexmps_client.h"
+#include "policy.h"
+#include "segment.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+struct BenchOptions {
+    std::vector<unsigned> clients{1, 2, 4, 8};
+    std::vector<unsigned> bursts{1, 8, 32};
+    std::vector<unsigned> sizes{32, 128, 255};   // 请求消息字节数, 含二进制头
+    unsigned requests = 2000;                    // 每个客户端测量的请求数
+    unsigned warmup = 200;                       // 每个客户端预热的请求数 (不计入结果)
+    uint32_t ringBytes = SPSC_RING_BYTES;        // 客户端通道每个方向的环大小
+    bool hugePages = false;                      // 客户端通道段放在 hugetlbfs 上
+    unsigned completionNs = 0;                   // >0 时每次突发之后为每条请求上报一条该耗时的完成记录
+    bool lease = false;                          // 先消费服务端发放的租约, 额度用完才发送请求
+    std::string json = "bench.json";
+    std::string server;                          // 非空时由基准自行启动该服务端
+    std::string serverArgs;
+    std::string serverLog = "bench_server.log";
+};
+
+struct BenchCase {
+    unsigned clients;
+    unsigned burst;
+    unsigned size;
+};
+
+struct BenchResult {
+    BenchCase c;
+    uint64_t samples;
+    uint64_t p50, p99, p999, max;
+    double msgsPerSec;
+    uint64_t leased;                             // 在租约内发射、没有发送请求的 kernel 数 (含预热)
+};
+
+// 父子进程共享的控制区
+struct BenchShared {
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> failed;
+    std::atomic<uint64_t> startNs;
+    std::atomic<uint64_t> leased;
+};
+
+static void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --clients <list>     客户端进程数, 例如 1,2,4,8\n"
+              << "  --bursts <list>      每次连续发送的请求数, 例如 1,8,32\n"
+              << "  --sizes <list>       请求消息字节数 (" << KS_KERNEL_REQUEST_FIXED << " ~ " << KS_KERNEL_REQUEST_FIXED + KS_MAX_KERNEL_NAME
+              << "), 例如 32,128,255\n"
+              << "  --requests <n>       每个客户端测量的请求数 (默认 2000)\n"
+              << "  --warmup <n>         每个客户端预热的请求数 (默认 200)\n"
+              << "  --ring-bytes <n>     客户端通道每个方向的环字节数, 2 的幂 (默认 " << SPSC_RING_BYTES << ")\n"
+              << "  --hugepages          客户端通道段使用 hugetlbfs 大页\n"
+              << "  --completion-ns <n>  每次突发的裁决取回后, 为每条请求上报耗时 n 纳秒的完成记录 (默认 0, 不上报)\n"
+              << "  --lease              接受服务端的租约 (服务端须以 --lease 启动), 额度内的 kernel 不发送请求, 延迟记为 0\n"
+              << "  --json <file>        结果文件 (默认 bench.json)\n"
+              << "  --server <path>      由基准启动服务端, 结束时停止; 默认连接已在运行的服务端\n"
+              << "  --server-args <str>  传给服务端的参数\n"
+              << "  -h, --help           显示帮助\n";
+}
+
+static bool parseList(const char* s, std::vector<unsigned>& out) {
+    out.clear();
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        char* end = nullptr;
+        unsigned long v = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end || v == 0) return false;
+        out.push_back(static_cast<unsigned>(v));
+    }
+    return !out.empty();
+}
+
+static bool parseBenchOptions(int argc, char** argv, BenchOptions& opts) {
+    enum {
+        OPT_CLIENTS = 256, OPT_BURSTS, OPT_SIZES, OPT_REQUESTS, OPT_WARMUP, OPT_JSON, OPT_SERVER, OPT_SERVER_ARGS,
+        OPT_RING_BYTES, OPT_HUGEPAGES, OPT_COMPLETION_NS, OPT_LEASE,
+    };
+    static const struct option longOpts[] = {
+        {"clients",     required_argument, nullptr, OPT_CLIENTS},
+        {"bursts",      required_argument, nullptr, OPT_BURSTS},
+        {"sizes",       required_argument, nullptr, OPT_SIZES},
+        {"requests",    required_argument, nullptr, OPT_REQUESTS},
+        {"warmup",      required_argument, nullptr, OPT_WARMUP},
+        {"json",        required_argument, nullptr, OPT_JSON},
+        {"server",      required_argument, nullptr, OPT_SERVER},
+        {"server-args", required_argument, nullptr, OPT_SERVER_ARGS},
+        {"ring-bytes",  required_argument, nullptr, OPT_RING_BYTES},
+        {"hugepages",   no_argument,       nullptr, OPT_HUGEPAGES},
+        {"completion-ns", required_argument, nullptr, OPT_COMPLETION_NS},
+        {"lease",       no_argument,       nullptr, OPT_LEASE},
+        {"help",        no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOpts, nullptr)) != -1) {
+        bool ok = true;
+        std::vector<unsigned> one;
+        switch (c) {
+        case OPT_CLIENTS:
+            ok = parseList(optarg, opts.clients);
+            for (unsigned n : opts.clients) ok = ok && n <= MAX_REGISTERED_CLIENTS;
+            break;
+        case OPT_BURSTS:
+            ok = parseList(optarg, opts.bursts);
+            break;
+        case OPT_SIZES:
+            ok = parseList(optarg, opts.sizes);
+            for (unsigned n : opts.sizes) ok = ok && n >= KS_KERNEL_REQUEST_FIXED && n <= KS_KERNEL_REQUEST_FIXED + KS_MAX_KERNEL_NAME;
+            break;
+        case OPT_REQUESTS:
+            ok = parseList(optarg, one) && one.size() == 1;
+            if (ok) opts.requests = one[0];
+            break;
+        case OPT_WARMUP: {
+            char* end = nullptr;
+            opts.warmup = strtoul(optarg, &end, 10);
+            ok = optarg[0] && !*end;
+            break;
+        }
+        case OPT_JSON:
+            opts.json = optarg;
+            break;
+        case OPT_SERVER:
+            opts.server = optarg;
+            break;
+        case OPT_SERVER_ARGS:
+            opts.serverArgs = optarg;
+            break;
+        case OPT_RING_BYTES:
+            ok = parseList(optarg, one) && one.size() == 1 && spsc_ring_bytes_valid(one[0]);
+            if (ok) opts.ringBytes = one[0];
+            break;
+        case OPT_HUGEPAGES:
+            opts.hugePages = true;
+            break;
+        case OPT_COMPLETION_NS:
+            ok = parseList(optarg, one) && one.size() == 1;
+            if (ok) opts.completionNs = one[0];
+            break;
+        case OPT_LEASE:
+            opts.lease = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return false;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            std::cerr << "[Bench] Invalid argument for option " << argv[optind - 1] << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    // 一次突发必须能整个放进请求环
+    for (unsigned n : opts.bursts) {
+        if (n > spsc_ring_min_msgs(opts.ringBytes)) {
+            std::cerr << "[Bench] Burst " << n << " exceeds the " << opts.ringBytes << "-byte ring ("
+                      << spsc_ring_min_msgs(opts.ringBytes) << " messages)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool schedulerReady() {
+    std::string name = flexmps_registry_name();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0666);
+    if (fd < 0) fd = ks_segment_open(name, true, O_RDONLY, 0666);
+    if (fd < 0) return false;
+    size_t bytes = ks_round_up(sizeof(ClientRegistry), ks_segment_page_size(fd));
+    void* p = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    bool ready = static_cast<ClientRegistry*>(p)->scheduler_ready.load(std::memory_order_acquire);
+    munmap(p, bytes);
+    return ready;
+}
+
+static pid_t startServer(const BenchOptions& opts) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open(opts.serverLog.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        std::vector<std::string> args{opts.server};
+        std::stringstream ss(opts.serverArgs);
+        std::string a;
+        while (ss >> a) args.push_back(a);
+        std::vector<char*> argv;
+        for (auto& s : args) argv.push_back(&s[0]);
+        argv.push_back(nullptr);
+        execv(opts.server.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// 子进程: 注册, 等待统一开始, 以 burst 为单位发送请求并等待全部裁决
+static int runClient(const BenchOptions& opts, const BenchCase& bc, unsigned index,
+                     BenchShared* shared, uint64_t* latencies) {
+    FlexClientOptions clientOpts;
+    clientOpts.clientType = "bench";
+    clientOpts.uniqueId = "bench" + std::to_string(index);
+    clientOpts.clientId = index;
+    clientOpts.requestRingBytes = opts.ringBytes;
+    clientOpts.responseRingBytes = opts.ringBytes;
+    clientOpts.hugePages = opts.hugePages;
+    clientOpts.lease = opts.lease;
+    FlexClient client;
+    if (!client.connect(clientOpts)) return 1;
+
+    // 按目标长度构造名称, 同一客户端反复发送同一个 kernel
+    size_t nameLen = bc.size - KS_KERNEL_REQUEST_FIXED;
+    std::string name(nameLen, 'k');
+    if (nameLen >= 8) snprintf(&name[0], 8, "bench%02u", bc.size % 100);
+    uint64_t hash = ks_kernel_hash(name.data(), name.size());
+
+    shared->ready.fetch_add(1);
+    while (shared->startNs.load(std::memory_order_acquire) == 0) usleep(100);
+
+    std::vector<FlexRequest> batch(bc.burst);
+    std::vector<FlexCompletion> done(bc.burst);
+    FlexDecision decisions[SPSC_MAX_BATCH];
+    const unsigned total = opts.warmup + opts.requests;
+    unsigned sent = 0;
+    while (sent < total) {
+        unsigned n = std::min(bc.burst, total - sent);
+        uint64_t t0 = nowNs();
+        // 租约内的 kernel 直接 "发射", 其余的照常请求
+        unsigned pending = 0;
+        for (unsigned j = 0; j < n; j++) {
+            unsigned seq = sent + j;
+            if (opts.lease && client.tryLease()) {
+                if (seq >= opts.warmup) latencies[seq - opts.warmup] = nowNs() - t0;
+                continue;
+            }
+            batch[pending++] = FlexRequest{seq, hash, name.data(), nameLen};
+        }
+        size_t submitted = 0;
+        while (submitted < pending) submitted += client.submitBatch(batch.data() + submitted, pending - submitted);
+
+        unsigned got = 0;
+        while (got < pending) {
+            size_t k = client.poll(decisions, SPSC_MAX_BATCH);
+            if (k == 0) {
+                client.waitDecision(1000000);
+                continue;
+            }
+            uint64_t now = nowNs();
+            for (size_t j = 0; j < k; j++) {
+                unsigned seq = static_cast<unsigned>(decisions[j].reqId);
+                if (seq >= opts.warmup && seq < total) latencies[seq - opts.warmup] = now - t0;
+            }
+            got += k;
+        }
+        if (opts.completionNs) {
+            for (unsigned j = 0; j < n; j++) done[j] = FlexCompletion{sent + j, hash, opts.completionNs};
+            size_t reported = 0;
+            while (reported < n) reported += client.reportCompletions(done.data() + reported, n - reported);
+        }
+        sent += n;
+    }
+    shared->leased.fetch_add(client.leased());
+    client.close();
+    return 0;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& v, double p) {
+    return v.empty() ? 0 : v[static_cast<size_t>(p * (v.size() - 1))];
+}
+
+static bool runCase(const BenchOptions& opts, const BenchCase& bc, BenchResult& result) {
+    size_t samples = static_cast<size_t>(bc.clients) * opts.requests;
+    size_t sharedSize = sizeof(BenchShared) + samples * sizeof(uint64_t);
+    void* mem = mmap(nullptr, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    BenchShared* shared = new (mem) BenchShared();
+    uint64_t* latencies = reinterpret_cast<uint64_t*>(shared + 1);
+
+    std::vector<pid_t> children;
+    for (unsigned i = 0; i < bc.clients; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int rc = runClient(opts, bc, i, shared, latencies + static_cast<size_t>(i) * opts.requests);
+            if (rc != 0) shared->failed.fetch_add(1);
+            _exit(rc);
+        }
+        if (pid > 0) children.push_back(pid);
+    }
+
+    uint64_t deadline = nowNs() + 10000000000ULL;
+    while (shared->ready.load() + shared->failed.load() < children.size() && nowNs() < deadline) usleep(1000);
+    bool ok = shared->failed.load() == 0 && shared->ready.load() == children.size();
+    uint64_t start = nowNs();
+    shared->startNs.store(start, std::memory_order_release);
+    if (!ok) {
+        std::cerr << "[Bench] Clients were not accepted by the scheduler" << std::endl;
+        for (pid_t pid : children) kill(pid, SIGKILL);
+    }
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    if (ok) {
+        std::vector<uint64_t> v(latencies, latencies + samples);
+        std::sort(v.begin(), v.end());
+        result.c = bc;
+        result.samples = samples;
+        result.p50 = percentile(v, 0.50);
+        result.p99 = percentile(v, 0.99);
+        result.p999 = percentile(v, 0.999);
+        result.max = v.empty() ? 0 : v.back();
+        // 吞吐按包含预热在内的全部消息计算
+        result.msgsPerSec = elapsed ? (static_cast<double>(bc.clients) * (opts.requests + opts.warmup)) * 1e9 / elapsed : 0;
+        result.leased = shared->leased.load();
+    }
+    munmap(mem, sharedSize);
+    return ok;
+}
+
+static bool writeJson(const BenchOptions& opts, const std::vector<BenchResult>& results) {
+    std::ofstream out(opts.json);
+    if (!out) return false;
+    struct utsname uts;
+    uname(&uts);
+    out << "{\n"
+        << "  \"host\": {\"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN)
+        << ", \"kernel\": \"" << uts.release << "\", \"machine\": \"" << uts.machine << "\"},\n"
+        << "  \"requests_per_client\": " << opts.requests << ",\n"
+        << "  \"warmup_per_client\": " << opts.warmup << ",\n"
+        << "  \"server_args\": \"" << opts.serverArgs << "\",\n"
+        << "  \"ring_bytes\": " << opts.ringBytes << ",\n"
+        << "  \"hugepages\": " << (opts.hugePages ? "true" : "false") << ",\n"
+        << "  \"completion_ns\": " << opts.completionNs << ",\n"
+        << "  \"lease\": " << (opts.lease ? "true" : "false") << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"clients\": " << r.c.clients << ", \"burst\": " << r.c.burst << ", \"msg_size\": " << r.c.size
+            << ", \"samples\": " << r.samples << ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99
+            << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.max
+            << ", \"msgs_per_sec\": " << static_cast<uint64_t>(r.msgsPerSec) << ", \"leased\": " << r.leased << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    if (!parseBenchOptions(argc, argv, opts)) return 1;
+
+    pid_t server = -1;
+    if (!opts.server.empty()) {
+        server = startServer(opts);
+        uint64_t deadline = nowNs() + 5000000000ULL;
+        while (!schedulerReady() && nowNs() < deadline) usleep(10000);
+    }
+    if (!schedulerReady()) {
+        std::cerr << "[Bench] Scheduler is not running" << std::endl;
+        if (server > 0) kill(server, SIGKILL);
+        return 1;
+    }
+
+    printf("%8s %6s %6s %12s %12s %12s %12s %14s %10s\n",
+           "clients", "burst", "size", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)", "msgs/s", "leased");
+    std::vector<BenchResult> results;
+    int failures = 0;
+    for (unsigned clients : opts.clients) {
+        for (unsigned burst : opts.bursts) {
+            for (unsigned size : opts.sizes) {
+                BenchCase bc{clients, burst, size};
+                BenchResult r;
+                if (!runCase(opts, bc, r)) {
+                    failures++;
+                    continue;
+                }
+                results.push_back(r);
+                printf("%8u %6u %6u %12llu %12llu %12llu %12llu %14.0f %10llu\n", clients, burst, size,
+                       (unsigned long long)r.p50, (unsigned long long)r.p99, (unsigned long long)r.p999,
+                       (unsigned long long)r.max, r.msgsPerSec, (unsigned long long)r.leased);
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (server > 0) {
+        kill(server, SIGINT);
+        waitpid(server, nullptr, 0);
+    }
+    if (!writeJson(opts, results)) {
+        std::cerr << "[Bench] Cannot write " << opts.json << std::endl;
+        return 1;
+    }
+    std::cout << "[Bench] " << results.size() << " cases written to " << opts.json;
+    if (failures) std::cout << ", " << failures << " failed";
+    std::cout << std::endl;
+    return failures ? 1 : 0;
+}
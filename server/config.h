@@ -4,6 +4,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <cstddef>
 #include <chrono>
 
 // ============================================================
@@ -13,11 +14,17 @@
 #define SCHEDULER_PORT 9999
 #define LOCALHOST "127.0.0.1"
 
-constexpr size_t SPSC_QUEUE_SIZE = 1024;
-constexpr size_t SPSC_MSG_SIZE = 256;
+constexpr size_t SPSC_RING_BYTES = 16384;  // 每个方向环形缓冲区的默认字节数, 客户端可在登记时另行指定
+constexpr size_t SPSC_RING_MIN_BYTES = 4096;
+constexpr size_t SPSC_RING_MAX_BYTES = 64 << 20;
+constexpr size_t SPSC_MSG_SIZE = 256;      // 单条消息的最大长度
 constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t SPSC_MAX_BATCH = 32;     // 单次批量收发的最大消息数
+
+static_assert((SPSC_RING_BYTES & (SPSC_RING_BYTES - 1)) == 0, "SPSC_RING_BYTES must be a power of two");
 
 #define SHM_NAME_SCHEDULER "/kernel_scheduler_registry"
+#define SHM_NAME_STATS     "/kernel_scheduler_stats"
 #define SHM_NAME_PREFIX_PYTORCH "/ks_pytorch_"
 #define SHM_NAME_PREFIX_SGLANG  "/ks_sglang_"
 #define SHM_NAME_PYTORCH "/kernel_scheduler_pytorch"
@@ -25,30 +32,315 @@ constexpr size_t CACHE_LINE_SIZE = 64;
 
 constexpr size_t MAX_REGISTERED_CLIENTS = 64;
 
+// ============================================================
+//  二进制消息协议 (定长, 紧凑布局, 直接在 SPSC 槽位内解析)
+// ============================================================
+//
+// 旧文本协议: "kernel|reqId|client_id|unique_id", 响应 "reqId|1|OK\n"
+// 二进制消息首字节固定为 0xF5 (合法 UTF-8 文本中不会出现),
+// 服务端据此区分两种格式; 文本协议仅作为旧版拦截层的兼容路径保留,
+// 这些客户端同样须按当前的通道布局 (ClientChannelStruct) 重新编译
+
+constexpr uint16_t KS_WIRE_MAGIC   = 0x4BF5;   // 小端字节序: F5 4B
+constexpr uint8_t  KS_WIRE_VERSION = 1;
+
+enum KsMsgType : uint8_t {
+    KS_MSG_KERNEL_REQUEST = 1,
+    KS_MSG_DECISION       = 2,
+    KS_MSG_COMPLETION     = 3,   // 客户端 -> 服务端, 可选: 已完成 kernel 的实测耗时, 无响应
+};
+
+// 请求标志位
+constexpr uint32_t KS_REQ_FLAG_HAS_NAME = 1u << 0;   // 请求尾部附带 kernel 名称
+
+struct __attribute__((packed)) KsWireHeader {
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint32_t flags;
+};
+
+struct __attribute__((packed)) KsKernelRequest {
+    KsWireHeader hdr;
+    uint64_t kernel_hash;   // ks_kernel_hash(kernel_name)
+    uint64_t req_id;
+    uint32_t client_id;
+    uint16_t name_len;      // 仅在 KS_REQ_FLAG_HAS_NAME 时有效
+    uint16_t reserved;
+    char     kernel_name[1];
+};
+
+constexpr size_t KS_KERNEL_REQUEST_FIXED = offsetof(KsKernelRequest, kernel_name);
+constexpr size_t KS_MAX_KERNEL_NAME = SPSC_MSG_SIZE - KS_KERNEL_REQUEST_FIXED - 1;
+
+struct __attribute__((packed)) KsDecision {
+    KsWireHeader hdr;
+    uint64_t req_id;
+    uint32_t allow;         // 1 = 放行, 0 = 拒绝
+    uint32_t reason;        // KsReason
+};
+
+// 一条完成记录: 放行之后 kernel 在 GPU 上实际执行的时间 (如 cudaEvent 计时)
+struct __attribute__((packed)) KsCompletionEntry {
+    uint64_t kernel_hash;
+    uint64_t req_id;        // 对应请求的 req_id, 0 表示未知
+    uint32_t duration_ns;   // 超过 uint32 的耗时按上限截断
+    uint32_t reserved;
+};
+
+// 完成消息: 一条消息携带 count 条记录, 走请求环, 与请求保持相对顺序
+struct __attribute__((packed)) KsCompletion {
+    KsWireHeader hdr;
+    uint16_t count;
+    uint16_t reserved[3];
+    KsCompletionEntry entries[1];
+};
+
+constexpr size_t KS_COMPLETION_FIXED = offsetof(KsCompletion, entries);
+constexpr size_t KS_MAX_COMPLETIONS = (SPSC_MSG_SIZE - KS_COMPLETION_FIXED) / sizeof(KsCompletionEntry);
+
+enum KsReason : uint32_t {
+    KS_REASON_OK       = 0,
+    KS_REASON_THROTTLE = 1,
+    KS_REASON_PROTOCOL = 2,   // 请求无法解析 (版本不符、长度不合法等), 服务端直接拒绝
+};
+
+// 客户端 QoS 类别 (ClientRegistryEntry::qos_class)
+enum KsQosClass : uint32_t {
+    KS_QOS_DEFAULT = 0,   // 未声明: 不参与 prefill/decode 仲裁, 总是放行
+    KS_QOS_DECODE  = 1,   // 延迟敏感的 decode 实例
+    KS_QOS_PREFILL = 2,   // 吞吐型的 prefill 实例
+};
+
+static_assert(sizeof(KsWireHeader) == 8, "wire header layout changed");
+static_assert(sizeof(KsDecision) == 24, "decision layout changed");
+static_assert(sizeof(KsCompletionEntry) == 24, "completion layout changed");
+
+// FNV-1a 64, 客户端与服务端必须使用同一算法计算 kernel_hash
+inline uint64_t ks_kernel_hash(const char* name, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(name[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline bool ks_is_binary(const char* msg, size_t len) {
+    return len >= sizeof(KsWireHeader) && static_cast<unsigned char>(msg[0]) == 0xF5;
+}
+
+// 二进制消息的实际长度 (不合法时返回 0)
+inline size_t ks_binary_length(const char* msg, size_t avail) {
+    if (avail < sizeof(KsWireHeader)) return 0;
+    const KsWireHeader* h = reinterpret_cast<const KsWireHeader*>(msg);
+    if (h->magic != KS_WIRE_MAGIC || h->version != KS_WIRE_VERSION) return 0;
+    switch (h->type) {
+    case KS_MSG_KERNEL_REQUEST: {
+        if (avail < KS_KERNEL_REQUEST_FIXED) return 0;
+        const KsKernelRequest* r = reinterpret_cast<const KsKernelRequest*>(msg);
+        size_t n = KS_KERNEL_REQUEST_FIXED;
+        if (r->hdr.flags & KS_REQ_FLAG_HAS_NAME) n += r->name_len;
+        return n <= avail ? n : 0;
+    }
+    case KS_MSG_DECISION:
+        return avail >= sizeof(KsDecision) ? sizeof(KsDecision) : 0;
+    case KS_MSG_COMPLETION: {
+        if (avail < KS_COMPLETION_FIXED) return 0;
+        const KsCompletion* c = reinterpret_cast<const KsCompletion*>(msg);
+        if (c->count == 0 || c->count > KS_MAX_COMPLETIONS) return 0;
+        size_t n = KS_COMPLETION_FIXED + c->count * sizeof(KsCompletionEntry);
+        return n <= avail ? n : 0;
+    }
+    default:
+        return 0;
+    }
+}
+
 // ============================================================
 //  数据结构 (POD, 用于共享内存布局)
 // ============================================================
 
+// ------------------------------------------------------------
+//  变长记录环 (共享内存中的 SPSC 队列)
+// ------------------------------------------------------------
+//
+// 缓冲区是一段字节环, 每条消息为一条记录: 4 字节长度头 + 负载, 整体按 8 字节对齐,
+// 常见的 24 字节裁决只占 32 字节, 一个 cache line 可容纳两条.
+// head/tail 是单调递增的字节位置, 用掩码取环内偏移, 差值即已用字节数.
+// 记录不跨越环的末尾: 剩余空间不足时写入一条填充记录 (SPSC_RECORD_PAD), 消费者跳回环的起点.
+// 生产者与消费者各自在自己的 cache line 上缓存对端下标, 只有缓存判断为满/空时才读取对端的 cache line
+
+constexpr uint32_t SPSC_RECORD_HEADER = sizeof(uint32_t);
+constexpr size_t SPSC_RECORD_ALIGN = 8;
+constexpr uint32_t SPSC_RECORD_PAD = 0xFFFFFFFFu;
+
+constexpr size_t spsc_record_size(size_t len) {
+    return (SPSC_RECORD_HEADER + len + SPSC_RECORD_ALIGN - 1) & ~(SPSC_RECORD_ALIGN - 1);
+}
+
+// 最坏情况 (全部为最大长度消息, 且回绕浪费一条记录的空间) 下 bytes 字节的环仍能容纳的消息数
+constexpr size_t spsc_ring_min_msgs(size_t bytes) {
+    return (bytes - spsc_record_size(SPSC_MSG_SIZE)) / spsc_record_size(SPSC_MSG_SIZE);
+}
+constexpr size_t SPSC_RING_MIN_MSGS = spsc_ring_min_msgs(SPSC_RING_BYTES);
+
+// 环的大小必须是 2 的幂, 并且在 [SPSC_RING_MIN_BYTES, SPSC_RING_MAX_BYTES] 之内
+inline bool spsc_ring_bytes_valid(uint64_t bytes) {
+    return bytes >= SPSC_RING_MIN_BYTES && bytes <= SPSC_RING_MAX_BYTES && (bytes & (bytes - 1)) == 0;
+}
+
+// 队列的控制块, 位于通道段头部; 缓冲区在 ClientChannelStruct 之后 (见 ks_channel_request_ring)
 struct SPSCQueue {
+    // 消费者侧: head 及其缓存的 tail
     alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+    uint64_t cached_tail;
+    // 生产者侧: tail 及其缓存的 head
     alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;
-    alignas(CACHE_LINE_SIZE) char buffer[SPSC_QUEUE_SIZE][SPSC_MSG_SIZE];
+    uint64_t cached_head;
 };
 
+// 进程本地的环视图: 控制块 + 缓冲区 + 登记时确定的大小.
+// 大小只取自本地副本, 热路径上不会读取对端可以改写的几何字段
+struct SPSCRing {
+    SPSCQueue* q = nullptr;
+    char* buffer = nullptr;
+    uint64_t bytes = 0;
+
+    // 生产者: 在 pos 处预留一条 len 字节的记录, 返回负载地址并推进 pos; 空间不足时返回 nullptr.
+    // 连续多次 claim 后调用一次 publish, 即可批量发布
+    char* claim(uint64_t& pos, size_t len) {
+        uint64_t need = spsc_record_size(len);
+        uint64_t off = pos & (bytes - 1);
+        uint64_t skip = off + need > bytes ? bytes - off : 0;
+        if (pos + skip + need - q->cached_head > bytes) {
+            q->cached_head = q->head.load(std::memory_order_acquire);
+            if (pos + skip + need - q->cached_head > bytes) return nullptr;
+        }
+        if (skip) {
+            *reinterpret_cast<uint32_t*>(buffer + off) = SPSC_RECORD_PAD;
+            pos += skip;
+            off = 0;
+        }
+        *reinterpret_cast<uint32_t*>(buffer + off) = static_cast<uint32_t>(len);
+        pos += need;
+        return buffer + off + SPSC_RECORD_HEADER;
+    }
+
+    void publish(uint64_t pos) { q->tail.store(pos, std::memory_order_release); }
+
+    // 消费者: 读取 pos 处的记录 (原地, 不拷贝) 并推进 pos; 队列空时返回 nullptr.
+    // 长度头不合法 (对端写坏) 时返回一条空消息, 并跳过所有已发布的数据
+    const char* peek(uint64_t& pos, size_t& len) {
+        for (;;) {
+            if (pos == q->cached_tail) {
+                q->cached_tail = q->tail.load(std::memory_order_acquire);
+                if (pos == q->cached_tail) return nullptr;
+            }
+            uint64_t off = pos & (bytes - 1);
+            uint32_t n = *reinterpret_cast<const uint32_t*>(buffer + off);
+            if (n == SPSC_RECORD_PAD) {
+                pos += bytes - off;
+                continue;
+            }
+            if (n > SPSC_MSG_SIZE || off + spsc_record_size(n) > bytes) {
+                len = 0;
+                pos = q->cached_tail;
+                return buffer + off;
+            }
+            len = n;
+            pos += spsc_record_size(n);
+            return buffer + off + SPSC_RECORD_HEADER;
+        }
+    }
+
+    // 消费者: 归还 pos 之前的所有记录
+    void release(uint64_t pos) { q->head.store(pos, std::memory_order_release); }
+
+    // 消费者: 是否有未读取的记录
+    bool readable() const { return q->head.load(std::memory_order_relaxed) != q->tail.load(std::memory_order_acquire); }
+};
+
+// 客户端能力位 (ClientChannelStruct::client_caps)
+constexpr uint32_t KS_CAP_FUTEX_WAKE = 1u << 0;   // 客户端推送请求后会按 futex 协议唤醒服务端
+constexpr uint32_t KS_CAP_OUT_OF_ORDER = 1u << 1; // 客户端按 req_id 匹配裁决: 服务端可以挂起请求, 之后乱序答复
+constexpr uint32_t KS_CAP_LEASE = 1u << 2;        // 客户端先消费租约额度, 用完才发送请求 (见 ClientChannelStruct)
+
+// 通道段布局标识, 客户端在登记之前写入; 服务端拒绝布局不匹配的通道
+constexpr uint32_t KS_CHANNEL_MAGIC  = 0x4843534B;   // "KSCH"
+constexpr uint32_t KS_CHANNEL_LAYOUT = 4;            // 4: 增加租约字段 (lease_*)
+
+// 段的后备存储 (ClientRegistryEntry::channel_flags)
+constexpr uint32_t KS_SEGMENT_HUGETLB = 1u << 0;   // 段位于 hugetlbfs (ks_hugetlbfs_dir), 而不是 /dev/shm
+
+// 通道段布局: ClientChannelStruct | 请求环 (request_ring_bytes) | 响应环 (response_ring_bytes)
+// 段大小按后备存储的页大小向上取整. 客户端在登记之前写入几何字段, 服务端在接管时校验并保存副本
 struct ClientChannelStruct {
+    alignas(CACHE_LINE_SIZE) uint32_t layout_magic;
+    uint32_t layout_version;
+    uint32_t request_ring_bytes;
+    uint32_t response_ring_bytes;
     SPSCQueue request_queue;
     SPSCQueue response_queue;
     alignas(CACHE_LINE_SIZE) std::atomic<bool> client_connected;
     alignas(CACHE_LINE_SIZE) std::atomic<bool> scheduler_ready;
+
+    // futex 休眠/唤醒 (协议见 wait_strategy.h)
+    // request_futex: 客户端推送请求后递增; server_parked: 服务端在等待请求时置 1
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> request_futex;
+    std::atomic<uint32_t> server_parked;
+    // response_futex: 服务端推送响应后递增; client_parked: 客户端在等待响应时置 1
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> response_futex;
+    std::atomic<uint32_t> client_parked;
+    std::atomic<uint32_t> client_caps;
+
+    // 租约 (KS_CAP_LEASE): 服务端放行请求时可以附带一批预先放行的额度, 客户端在额度内直接发射 kernel, 不再逐个请求.
+    // 服务端先写 lease_expiry_ns (steady_clock) 再写 lease_credits; 客户端 CAS 递减 lease_credits (须未到期)
+    // 后发射, 并递增 lease_used. 服务端随时可以把 lease_credits 减小 (收缩/撤销), 按 lease_used 的增量为策略记账
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> lease_credits;
+    std::atomic<uint64_t> lease_expiry_ns;
+    std::atomic<uint64_t> lease_used;     // 累计在租约内发射的 kernel 数, 只由客户端写入
 };
 
+// 两个环之前的字节数 (即请求环在段内的偏移)
+constexpr size_t KS_CHANNEL_HEADER_BYTES = sizeof(ClientChannelStruct);
+
+inline size_t ks_channel_bytes(uint64_t requestRingBytes, uint64_t responseRingBytes) {
+    return KS_CHANNEL_HEADER_BYTES + requestRingBytes + responseRingBytes;
+}
+
+inline SPSCRing ks_channel_request_ring(ClientChannelStruct* ch, uint64_t requestRingBytes) {
+    SPSCRing r;
+    r.q = &ch->request_queue;
+    r.buffer = reinterpret_cast<char*>(ch) + KS_CHANNEL_HEADER_BYTES;
+    r.bytes = requestRingBytes;
+    return r;
+}
+
+inline SPSCRing ks_channel_response_ring(ClientChannelStruct* ch, uint64_t requestRingBytes, uint64_t responseRingBytes) {
+    SPSCRing r;
+    r.q = &ch->response_queue;
+    r.buffer = reinterpret_cast<char*>(ch) + KS_CHANNEL_HEADER_BYTES + requestRingBytes;
+    r.bytes = responseRingBytes;
+    return r;
+}
+
 struct ClientRegistryEntry {
     alignas(CACHE_LINE_SIZE) std::atomic<bool> active;
     char shm_name[64];
     char client_type[16];
     char unique_id[64];
     alignas(CACHE_LINE_SIZE) std::atomic<int64_t> client_pid;
+    // 顺序锁: 奇数表示条目正在填写或已注销, 服务端跳过; 客户端填写前置为奇数、写完后递增为偶数,
+    // 服务端据此区分同一槽位上的先后两次登记. 0 表示槽位从未使用, 注销时置奇数而不是清零
+    std::atomic<uint32_t> generation;
     alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> last_heartbeat;
+    // QoS 声明, 客户端在置 active 之前写入; weight 为 0 时使用服务端默认权重
+    std::atomic<uint32_t> qos_class;
+    std::atomic<uint32_t> weight;
+    std::atomic<uint32_t> channel_flags;   // KS_SEGMENT_*, 同样在置 active 之前写入
+    std::atomic<int32_t> numa_node;        // 客户端 (及其 GPU) 所在的 NUMA 节点, -1 表示未知
+    std::atomic<int32_t> device;           // 客户端使用的 GPU 序号, 决定其所属的调度域
     
     void init() {
         active.store(false, std::memory_order_relaxed);
@@ -56,20 +348,77 @@ struct ClientRegistryEntry {
         std::memset(client_type, 0, sizeof(client_type));
         std::memset(unique_id, 0, sizeof(unique_id));
         client_pid.store(0, std::memory_order_relaxed);
+        generation.store(0, std::memory_order_relaxed);
         last_heartbeat.store(0, std::memory_order_relaxed);
+        qos_class.store(KS_QOS_DEFAULT, std::memory_order_relaxed);
+        weight.store(0, std::memory_order_relaxed);
+        channel_flags.store(0, std::memory_order_relaxed);
+        numa_node.store(-1, std::memory_order_relaxed);
+        device.store(0, std::memory_order_relaxed);
     }
 };
 
+static_assert(MAX_REGISTERED_CLIENTS <= 64, "dirty_slots is a single 64-bit mask");
+
+// registry 布局标识, 服务端创建时写入; 客户端与接管的服务端拒绝布局不匹配的 registry
+constexpr uint32_t KS_REGISTRY_MAGIC  = 0x4752534B;   // "KSRG"
+constexpr uint32_t KS_REGISTRY_LAYOUT = 2;            // 1: 增加布局标识与热重启的交接字段
+                                                      // 2: 这些字段移到 entries[] 之后, 旧字段恢复原有偏移
+
+// 热重启的交接状态 (ClientRegistry::handover, 同时是 futex 字)
+enum KsHandoverState : uint32_t {
+    KS_HANDOVER_NONE      = 0,
+    KS_HANDOVER_REQUESTED = 1,   // 新进程已写入 takeover_pid, 等待旧进程交出
+    KS_HANDOVER_RELEASED  = 2,   // 旧进程已停止服务全部通道, 新进程可以接管
+};
+
+// 登记/注销流程 (客户端):
+//   1. CAS entries[i].active 占用槽位, generation 置为奇数, 写入各字段, 再递增 generation 为偶数
+//   2. dirty_slots 置位 i, 递增 version, 并在 version 上 futex 唤醒服务端
+// 注销时先把 generation 置为奇数再清 active, 之后同样执行第 2 步. 服务端在 version 上休眠, 被唤醒后只检查置位的槽位
+//
+// 热重启 (服务端 --takeover):
+//   1. 新进程附着到已有的 registry, 校验布局; CAS takeover_pid 为自己, handover 置 REQUESTED,
+//      递增 version 并唤醒旧进程的扫描线程
+//   2. 旧进程停止扫描与所有 worker (已取走、尚未答复的请求先答复), 关闭统计页,
+//      handover 置 RELEASED 并在其上唤醒; 退出时不删除 registry 与通道段
+//   3. 新进程写入 server_pid, 清交接字段, 接管所有 active 的槽位; 请求环中未取走的请求由新进程继续处理
+// 客户端不参与交接; 旧进程已退出 (崩溃) 时新进程直接接管
+// 没有布局标识的旧客户端只映射到 entries[] 为止, 因此这些字段保持原有偏移,
+// 布局标识与交接字段追加在 entries[] 之后
 struct ClientRegistry {
     alignas(CACHE_LINE_SIZE) std::atomic<bool> scheduler_ready;
     alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> version;
+    std::atomic<uint64_t> dirty_slots;
     ClientRegistryEntry entries[MAX_REGISTERED_CLIENTS];
+    alignas(CACHE_LINE_SIZE) uint32_t layout_magic;
+    uint32_t layout_version;
+    uint32_t layout_bytes;                // sizeof(ClientRegistry)
+    // 热重启的交接 (见上)
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> server_pid;   // 当前服务 registry 的进程
+    std::atomic<int64_t> takeover_pid;                          // 请求接管的进程, 0 表示没有
+    std::atomic<uint32_t> handover;                             // KsHandoverState
+
+    bool layoutValid() const {
+        return layout_magic == KS_REGISTRY_MAGIC && layout_version == KS_REGISTRY_LAYOUT &&
+               layout_bytes == sizeof(ClientRegistry);
+    }
 
     void init() {
+        layout_magic = KS_REGISTRY_MAGIC;
+        layout_version = KS_REGISTRY_LAYOUT;
+        layout_bytes = sizeof(ClientRegistry);
         scheduler_ready.store(false, std::memory_order_relaxed);
         version.store(0, std::memory_order_relaxed);
+        dirty_slots.store(0, std::memory_order_relaxed);
+        server_pid.store(0, std::memory_order_relaxed);
+        takeover_pid.store(0, std::memory_order_relaxed);
+        handover.store(KS_HANDOVER_NONE, std::memory_order_relaxed);
         for (size_t i = 0; i < MAX_REGISTERED_CLIENTS; i++) {
             entries[i].init();
         }
     }
-};
\ No newline at end of file
+};
+
+static_assert(offsetof(ClientRegistry, scheduler_ready) == 0 &&
+              offsetof(ClientRegistry, entries) == 2 * CACHE_LINE_SIZE, "registry prefix must match old clients");
\ No newline at end of file
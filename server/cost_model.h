@@ -0,0 +1,105 @@
+#pragma once
+
+#include "kernel_table.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// ============================================================
+//  在线 kernel 代价模型 (由客户端的完成消息 KS_MSG_COMPLETION 驱动)
+// ============================================================
+//
+// 两级估计:
+//   KernelCostModel  每个调度域、每种 kernel 一个 EWMA 与 log2 直方图, 域内的 worker 用 relaxed 原子操作更新
+//   ClientKernelCost 每个会话、每种 kernel 一个 EWMA, 只由会话所属的 worker 访问
+// 同名 kernel 在不同模型/批大小下耗时差别很大, 因此估计优先取本客户端的 EWMA, 样本不足时退回全域的 EWMA.
+// 多个 worker 同时更新同一 kernel 时 EWMA 可能丢失个别样本, 对估计没有实质影响
+
+constexpr uint32_t COST_EWMA_SHIFT = 3;         // 平滑系数 1/8
+constexpr uint32_t COST_MIN_SAMPLES = 4;        // 样本数达到后才参与估计
+constexpr uint32_t COST_HIST_BUCKETS = 32;      // 第 i 桶为 [2^(i-1), 2^i) ns
+constexpr size_t COST_REPORT_KERNELS = 10;      // 退出时每个设备报告的 kernel 数
+
+inline uint32_t cost_bucket(uint64_t ns) {
+    uint32_t b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return b < COST_HIST_BUCKETS ? b : COST_HIST_BUCKETS - 1;
+}
+
+inline uint64_t cost_ewma(uint64_t ewma, uint64_t samples, uint64_t sample) {
+    if (samples == 0) return sample;
+    int64_t delta = static_cast<int64_t>(sample) - static_cast<int64_t>(ewma);
+    return static_cast<uint64_t>(static_cast<int64_t>(ewma) + delta / (1 << COST_EWMA_SHIFT));
+}
+
+struct ClientKernelCost {
+    uint64_t ewmaNs = 0;
+    uint64_t samples = 0;
+
+    void observe(uint64_t ns) {
+        ewmaNs = cost_ewma(ewmaNs, samples, ns);
+        samples++;
+    }
+};
+
+/**
+ * @brief 一个调度域内按 kernel id (KernelTable) 索引的代价模型
+ */
+class KernelCostModel {
+public:
+    KernelCostModel() : entries_(new Entry[MAX_KERNEL_TYPES]) {}
+
+    void observe(uint32_t kid, uint64_t ns) {
+        if (kid >= MAX_KERNEL_TYPES) return;
+        Entry& e = entries_[kid];
+        uint64_t samples = e.samples.load(std::memory_order_relaxed);
+        e.ewmaNs.store(cost_ewma(e.ewmaNs.load(std::memory_order_relaxed), samples, ns), std::memory_order_relaxed);
+        e.samples.store(samples + 1, std::memory_order_relaxed);
+        e.hist[cost_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 估计的执行时间, 样本不足时返回 0
+    uint64_t estimate(uint32_t kid) const {
+        if (kid >= MAX_KERNEL_TYPES) return 0;
+        const Entry& e = entries_[kid];
+        if (e.samples.load(std::memory_order_relaxed) < COST_MIN_SAMPLES) return 0;
+        return e.ewmaNs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t samples(uint32_t kid) const {
+        return kid < MAX_KERNEL_TYPES ? entries_[kid].samples.load(std::memory_order_relaxed) : 0;
+    }
+
+    // 直方图上的分位数 (取桶的上界), 没有样本时返回 0
+    uint64_t quantile(uint32_t kid, double q) const {
+        if (kid >= MAX_KERNEL_TYPES) return 0;
+        const Entry& e = entries_[kid];
+        uint64_t counts[COST_HIST_BUCKETS];
+        uint64_t total = 0;
+        for (uint32_t b = 0; b < COST_HIST_BUCKETS; b++) {
+            counts[b] = e.hist[b].load(std::memory_order_relaxed);
+            total += counts[b];
+        }
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * (total - 1));
+        uint64_t seen = 0;
+        for (uint32_t b = 0; b < COST_HIST_BUCKETS; b++) {
+            seen += counts[b];
+            if (seen > rank) return b ? (1ULL << b) - 1 : 0;
+        }
+        return 0;
+    }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> ewmaNs{0};
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint32_t> hist[COST_HIST_BUCKETS];
+
+        Entry() {
+            for (auto& h : hist) h.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    std::unique_ptr<Entry[]> entries_;
+};
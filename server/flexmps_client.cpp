@@ -0,0 +1,368 @@
+#include "flexmps_client.h"
+#include "policy.h"
+#include "numa.h"
+#include "segment.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+std::string flexmps_registry_name() {
+    const char* u = std::getenv("USER");
+    return std::string(SHM_NAME_SCHEDULER) + ((u && *u) ? std::string("_") + u : "_nouser");
+}
+
+// 通知服务端 slot 的登记状态已改变 (协议见 config.h 中的 ClientRegistry)
+static void notifyRegistry(ClientRegistry* registry, size_t slot) {
+    registry->dirty_slots.fetch_or(1ull << slot, std::memory_order_release);
+    registry->version.fetch_add(1, std::memory_order_release);
+    ks_futex_wake(&registry->version);
+}
+
+FlexClient::~FlexClient() {
+    close();
+}
+
+// 创建并映射通道段, 写入布局标识与几何
+bool FlexClient::createChannel(const FlexClientOptions& options, bool hugetlb) {
+    int fd = ks_segment_open(shmName_, hugetlb, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        if (!hugetlb) perror("[FlexClient] shm_open channel");
+        return false;
+    }
+    size_t bytes = ks_round_up(ks_channel_bytes(options.requestRingBytes, options.responseRingBytes),
+                               ks_segment_page_size(fd));
+    void* ch = ftruncate(fd, bytes) == 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (ch == MAP_FAILED) {
+        // hugetlbfs 上大页不足时 mmap 返回 ENOMEM
+        if (!hugetlb) perror("[FlexClient] mmap channel");
+        ks_segment_unlink(shmName_, hugetlb);
+        return false;
+    }
+    // 在第一次访问之前设置内存策略, 通道的页 (包括之后服务端访问的页) 落在客户端的节点上
+    if (numaNode_ >= 0) ks_mbind_preferred(ch, bytes, numaNode_);
+    // 新建的段全部为零, 即空队列
+    channel_ = static_cast<ClientChannelStruct*>(ch);
+    channelBytes_ = bytes;
+    channelHugetlb_ = hugetlb;
+    channel_->layout_magic = KS_CHANNEL_MAGIC;
+    channel_->layout_version = KS_CHANNEL_LAYOUT;
+    channel_->request_ring_bytes = options.requestRingBytes;
+    channel_->response_ring_bytes = options.responseRingBytes;
+    requestRing_ = ks_channel_request_ring(channel_, options.requestRingBytes);
+    responseRing_ = ks_channel_response_ring(channel_, options.requestRingBytes, options.responseRingBytes);
+    return true;
+}
+
+bool FlexClient::connect(const FlexClientOptions& options) {
+    if (channel_) return true;
+    if (!spsc_ring_bytes_valid(options.requestRingBytes) || !spsc_ring_bytes_valid(options.responseRingBytes)) {
+        std::cerr << "[FlexClient] Ring sizes must be powers of two in [" << SPSC_RING_MIN_BYTES << ", "
+                  << SPSC_RING_MAX_BYTES << "]" << std::endl;
+        return false;
+    }
+    wait_ = options.wait;
+    clientId_ = options.clientId ? options.clientId : static_cast<uint32_t>(getpid());
+
+    // 服务端以 --hugepages 启动时 registry 位于 hugetlbfs
+    std::string regName = flexmps_registry_name();
+    int fd = shm_open(regName.c_str(), O_RDWR, 0666);
+    if (fd < 0) fd = ks_segment_open(regName, true, O_RDWR, 0666);
+    if (fd < 0) {
+        std::cerr << "[FlexClient] Registry " << regName << " not found (is the scheduler running?)" << std::endl;
+        return false;
+    }
+    // 布局不同的服务端创建的段可能比本结构小, 访问尾部会 SIGBUS
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ClientRegistry)) {
+        std::cerr << "[FlexClient] Registry " << regName << " has an unsupported layout (scheduler built against a different config.h?)" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    registryBytes_ = ks_round_up(sizeof(ClientRegistry), ks_segment_page_size(fd));
+    void* reg = mmap(nullptr, registryBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (reg == MAP_FAILED) {
+        perror("[FlexClient] mmap registry");
+        return false;
+    }
+    registry_ = static_cast<ClientRegistry*>(reg);
+    if (!registry_->layoutValid()) {
+        std::cerr << "[FlexClient] Registry " << regName << " has an unsupported layout (scheduler built against a different config.h?)" << std::endl;
+        close();
+        return false;
+    }
+    if (!registry_->scheduler_ready.load(std::memory_order_acquire)) {
+        std::cerr << "[FlexClient] Scheduler is not ready" << std::endl;
+        close();
+        return false;
+    }
+
+    numaNode_ = options.numaNode;
+    if (numaNode_ < 0) {
+        const char* env = std::getenv("KS_NUMA_NODE");
+        numaNode_ = (env && *env) ? atoi(env) : ks_current_numa_node();
+        if (numaNode_ < 0) numaNode_ = KS_NUMA_UNKNOWN;
+    }
+
+    shmName_ = "/ks_" + options.clientType + "_" + std::to_string(getpid()) + "_" +
+               std::to_string(reinterpret_cast<uintptr_t>(this) & 0xffff);
+    if (options.hugePages && !createChannel(options, true)) {
+        std::cerr << "[FlexClient] Cannot create channel on hugetlbfs " << ks_hugetlbfs_dir()
+                  << " (mounted? free huge pages?), falling back to /dev/shm" << std::endl;
+    }
+    if (!channel_ && !createChannel(options, false)) {
+        close();
+        return false;
+    }
+    channel_->client_caps.store(KS_CAP_FUTEX_WAKE | KS_CAP_OUT_OF_ORDER | (options.lease ? KS_CAP_LEASE : 0),
+                                std::memory_order_relaxed);
+    channel_->client_connected.store(true, std::memory_order_release);
+    submitted_ = completed_ = leased_ = 0;
+    stash_.clear();
+
+    for (size_t i = 0; i < MAX_REGISTERED_CLIENTS && !entry_; i++) {
+        bool expected = false;
+        if (registry_->entries[i].active.compare_exchange_strong(expected, true)) {
+            entry_ = &registry_->entries[i];
+            slot_ = i;
+        }
+    }
+    if (!entry_) {
+        std::cerr << "[FlexClient] Registry full (" << MAX_REGISTERED_CLIENTS << " clients)" << std::endl;
+        close();
+        return false;
+    }
+
+    // 槽位复用时 generation 仍是上一次登记的值; 先置为奇数, 服务端在写完之前不会读取条目
+    entry_->generation.fetch_or(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::string uniqueId = options.uniqueId;
+    if (uniqueId.empty()) {
+        const char* env = std::getenv("UNIQUE_ID");
+        uniqueId = (env && *env) ? env : std::to_string(getpid());
+    }
+    snprintf(entry_->shm_name, sizeof(entry_->shm_name), "%s", shmName_.c_str());
+    snprintf(entry_->client_type, sizeof(entry_->client_type), "%s", options.clientType.c_str());
+    snprintf(entry_->unique_id, sizeof(entry_->unique_id), "%s", uniqueId.c_str());
+    entry_->qos_class.store(options.qosClass, std::memory_order_relaxed);
+    entry_->weight.store(options.weight, std::memory_order_relaxed);
+    entry_->channel_flags.store(channelHugetlb_ ? KS_SEGMENT_HUGETLB : 0, std::memory_order_relaxed);
+    entry_->numa_node.store(numaNode_, std::memory_order_relaxed);
+    int device = options.device;
+    if (device < 0) {
+        const char* env = std::getenv("KS_DEVICE");
+        device = (env && *env) ? atoi(env) : 0;
+    }
+    entry_->device.store(device < 0 ? 0 : device, std::memory_order_relaxed);
+    entry_->client_pid.store(getpid(), std::memory_order_relaxed);
+    entry_->generation.fetch_add(1, std::memory_order_release);
+    notifyRegistry(registry_, slot_);
+
+    // 服务端接纳后在 response_futex 上唤醒
+    uint64_t deadline = nowNs() + static_cast<uint64_t>(options.connectTimeoutMs) * 1000000;
+    Backoff backoff(wait_);
+    auto accepted = [this] { return channel_->scheduler_ready.load(std::memory_order_acquire); };
+    while (!accepted()) {
+        if (nowNs() > deadline) {
+            std::cerr << "[FlexClient] Scheduler did not accept " << shmName_ << " within "
+                      << options.connectTimeoutMs << "ms" << std::endl;
+            close();
+            return false;
+        }
+        backoff.pause(channel_->response_futex, channel_->client_parked, accepted);
+    }
+    return true;
+}
+
+void FlexClient::close() {
+    if (channel_) {
+        channel_->client_connected.store(false, std::memory_order_release);
+    }
+    if (entry_) {
+        entry_->generation.fetch_or(1, std::memory_order_release);
+        entry_->active.store(false, std::memory_order_release);
+        entry_ = nullptr;
+        notifyRegistry(registry_, slot_);
+    }
+    if (channel_) {
+        munmap(channel_, channelBytes_);
+        channel_ = nullptr;
+        ks_segment_unlink(shmName_, channelHugetlb_);
+    }
+    if (registry_) {
+        munmap(registry_, registryBytes_);
+        registry_ = nullptr;
+    }
+}
+
+bool FlexClient::writeRequest(uint64_t& pos, uint64_t reqId, uint64_t kernelHash, const char* name, size_t nameLen) {
+    if (!name) nameLen = 0;
+    if (nameLen > KS_MAX_KERNEL_NAME) nameLen = KS_MAX_KERNEL_NAME;
+    char* slot = requestRing_.claim(pos, KS_KERNEL_REQUEST_FIXED + nameLen);
+    if (!slot) return false;
+    KsKernelRequest* m = reinterpret_cast<KsKernelRequest*>(slot);
+    m->hdr.magic = KS_WIRE_MAGIC;
+    m->hdr.version = KS_WIRE_VERSION;
+    m->hdr.type = KS_MSG_KERNEL_REQUEST;
+    m->hdr.flags = nameLen ? KS_REQ_FLAG_HAS_NAME : 0;
+    m->kernel_hash = kernelHash;
+    m->req_id = reqId;
+    m->client_id = clientId_;
+    m->name_len = static_cast<uint16_t>(nameLen);
+    m->reserved = 0;
+    if (nameLen) memcpy(m->kernel_name, name, nameLen);
+    return true;
+}
+
+bool FlexClient::trySubmit(uint64_t reqId, uint64_t kernelHash, const char* name, size_t nameLen) {
+    FlexRequest r{reqId, kernelHash, name, nameLen};
+    return submitBatch(&r, 1) == 1;
+}
+
+size_t FlexClient::submitBatch(const FlexRequest* reqs, size_t n) {
+    if (!channel_ || n == 0) return 0;
+    uint64_t pos = requestRing_.q->tail.load(std::memory_order_relaxed);
+    size_t done = 0;
+    while (done < n && writeRequest(pos, reqs[done].reqId, reqs[done].kernelHash, reqs[done].name, reqs[done].nameLen)) {
+        done++;
+    }
+    if (done) {
+        submitted_ += done;
+        requestRing_.publish(pos);
+        ks_notify_peer(channel_->request_futex, channel_->server_parked);
+    }
+    return done;
+}
+
+size_t FlexClient::reportCompletions(const FlexCompletion* completions, size_t n) {
+    if (!channel_ || n == 0) return 0;
+    uint64_t pos = requestRing_.q->tail.load(std::memory_order_relaxed);
+    size_t done = 0;
+    while (done < n) {
+        size_t count = std::min(n - done, KS_MAX_COMPLETIONS);
+        char* slot = requestRing_.claim(pos, KS_COMPLETION_FIXED + count * sizeof(KsCompletionEntry));
+        if (!slot) break;
+        KsCompletion* m = reinterpret_cast<KsCompletion*>(slot);
+        m->hdr.magic = KS_WIRE_MAGIC;
+        m->hdr.version = KS_WIRE_VERSION;
+        m->hdr.type = KS_MSG_COMPLETION;
+        m->hdr.flags = 0;
+        m->count = static_cast<uint16_t>(count);
+        memset(m->reserved, 0, sizeof(m->reserved));
+        for (size_t i = 0; i < count; i++) {
+            const FlexCompletion& c = completions[done + i];
+            KsCompletionEntry& e = m->entries[i];
+            e.kernel_hash = c.kernelHash;
+            e.req_id = c.reqId;
+            e.duration_ns = static_cast<uint32_t>(std::min<uint64_t>(c.durationNs, UINT32_MAX));
+            e.reserved = 0;
+        }
+        done += count;
+    }
+    // 完成消息不急于处理, 不唤醒服务端: 随下一条请求或服务端的定时醒来一起处理
+    if (done) requestRing_.publish(pos);
+    return done;
+}
+
+bool FlexClient::tryLease() {
+    if (!channel_) return false;
+    uint32_t credits = channel_->lease_credits.load(std::memory_order_acquire);
+    if (credits == 0 || nowNs() >= channel_->lease_expiry_ns.load(std::memory_order_relaxed)) return false;
+    // 服务端可能同时收缩额度
+    while (credits > 0 && !channel_->lease_credits.compare_exchange_weak(credits, credits - 1, std::memory_order_acq_rel)) {
+    }
+    if (credits == 0) return false;
+    leased_++;
+    channel_->lease_used.store(leased_, std::memory_order_release);
+    return true;
+}
+
+bool FlexClient::responseReady() const {
+    return responseRing_.readable();
+}
+
+size_t FlexClient::drainResponses(FlexDecision* out, size_t maxDecisions) {
+    SPSCRing& q = responseRing_;
+    uint64_t pos = q.q->head.load(std::memory_order_relaxed);
+    uint64_t consumed = pos;
+    size_t n = 0;
+    const char* msg;
+    size_t len;
+    while (n < maxDecisions && (msg = q.peek(pos, len)) != nullptr) {
+        consumed = pos;
+        if (ks_is_binary(msg, len) && ks_binary_length(msg, len) == sizeof(KsDecision)) {
+            const KsDecision* d = reinterpret_cast<const KsDecision*>(msg);
+            out[n].reqId = d->req_id;
+            out[n].allow = d->allow != 0;
+            out[n].reason = d->reason;
+            n++;
+        }
+    }
+    // 一次归还本批所有记录
+    if (consumed != q.q->head.load(std::memory_order_relaxed)) q.release(consumed);
+    completed_ += n;
+    return n;
+}
+
+size_t FlexClient::poll(FlexDecision* out, size_t maxDecisions) {
+    if (!channel_) return 0;
+    size_t n = 0;
+    while (n < maxDecisions && !stash_.empty()) {
+        out[n++] = stash_.front();
+        stash_.pop_front();
+    }
+    if (n < maxDecisions) n += drainResponses(out + n, maxDecisions - n);
+    return n;
+}
+
+bool FlexClient::waitDecision(uint32_t timeoutUs) {
+    if (!channel_) return false;
+    if (!stash_.empty() || responseReady()) return true;
+    if (timeoutUs == 0) return false;
+
+    uint64_t deadline = nowNs() + static_cast<uint64_t>(timeoutUs) * 1000;
+    Backoff backoff(wait_);
+    while (!responseReady()) {
+        if (nowNs() >= deadline) return false;
+        backoff.pause(channel_->response_futex, channel_->client_parked, [this] { return responseReady(); });
+    }
+    return true;
+}
+
+bool FlexClient::request(uint64_t reqId, uint64_t kernelHash, const char* name, size_t nameLen,
+                         FlexDecision& out, uint32_t timeoutUs) {
+    if (!channel_) return false;
+    uint64_t deadline = nowNs() + static_cast<uint64_t>(timeoutUs) * 1000;
+
+    Backoff backoff(wait_);
+    while (!trySubmit(reqId, kernelHash, name, nameLen)) {
+        if (nowNs() >= deadline) return false;
+        backoff.pauseNoFutex();
+    }
+
+    FlexDecision batch[SPSC_MAX_BATCH];
+    for (;;) {
+        size_t n = drainResponses(batch, SPSC_MAX_BATCH);
+        bool found = false;
+        for (size_t i = 0; i < n; i++) {
+            if (!found && batch[i].reqId == reqId) {
+                out = batch[i];
+                found = true;
+            } else {
+                stash_.push_back(batch[i]);
+            }
+        }
+        if (found) return true;
+
+        uint64_t now = nowNs();
+        if (now >= deadline) return false;
+        waitDecision(static_cast<uint32_t>(std::min<uint64_t>((deadline - now) / 1000 + 1, UINT32_MAX)));
+    }
+}
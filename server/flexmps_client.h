@@ -0,0 +1,147 @@
+#pragma once
+
+#include "config.h"
+#include "wait_strategy.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+// ============================================================
+//  libflexmps_client: 共享内存协议的客户端实现
+// ============================================================
+//
+// 负责创建 /ks_* 通道段、登记 ClientRegistryEntry、等待 scheduler_ready,
+// 并以二进制协议收发请求/裁决. 同一个 FlexClient 只能由一个线程使用 (SPSC 的生产者/消费者端)
+//
+// 典型用法:
+//   FlexClient client;
+//   FlexClientOptions opts;
+//   opts.clientType = "pytorch";
+//   if (!client.connect(opts)) ...
+//   FlexDecision d;
+//   client.request(reqId, ks_kernel_hash(name, len), name, len, d, 1000000);
+//
+// 流水线: trySubmit/submitBatch 连续提交多条请求, poll 取回已到达的裁决.
+// 客户端声明了 KS_CAP_OUT_OF_ORDER: 服务端可以挂起被限流的请求、稍后再答复,
+// 裁决不一定按提交顺序到达, 须按 reqId 匹配
+//
+// 租约 (服务端以 --lease 启动, 客户端设置 FlexClientOptions::lease): 放行请求时服务端可以附带一批额度,
+// 每次发射 kernel 前先调用 tryLease, 成功即可直接发射, 失败 (额度用完、到期或被服务端收缩) 时再走请求/裁决:
+//   if (!client.tryLease()) client.request(...);
+
+struct FlexClientOptions {
+    std::string clientType = "client";   // 最长 15 字节
+    std::string uniqueId;                // 为空时取环境变量 UNIQUE_ID, 再为空时取 pid
+    uint32_t clientId = 0;               // 写入每条请求的 client_id, 0 表示使用 pid
+    uint32_t qosClass = KS_QOS_DEFAULT;
+    uint32_t weight = 0;                 // 0 表示使用服务端默认权重
+    uint32_t connectTimeoutMs = 5000;    // 等待服务端接纳 (scheduler_ready) 的上限
+    // 通道几何: 每个方向环形缓冲区的字节数, 2 的幂, 范围 [SPSC_RING_MIN_BYTES, SPSC_RING_MAX_BYTES]
+    // 突发大的客户端 (如 prefill) 可以加大请求环; 最坏情况下可容纳的请求数见 spsc_ring_min_msgs
+    uint32_t requestRingBytes = SPSC_RING_BYTES;
+    uint32_t responseRingBytes = SPSC_RING_BYTES;
+    bool hugePages = false;              // 通道段放在 hugetlbfs 上 (segment.h), 失败时退回 /dev/shm
+    // 客户端 (及其 GPU) 所在的 NUMA 节点: -1 时取环境变量 KS_NUMA_NODE, 再取当前 CPU 亲和性所在的节点.
+    // 框架侧可用 ks_pci_numa_node(GPU 的 PCI 总线号) 得到; 通道段的页优先分配在该节点上, 服务端据此选择 worker
+    int numaNode = -1;
+    // 客户端使用的 GPU 序号 (拦截层可取 cudaGetDevice), 服务端按它把客户端分到该 GPU 的调度域;
+    // -1 时取环境变量 KS_DEVICE, 未设置时为 0
+    int device = -1;
+    bool lease = false;                  // 声明 KS_CAP_LEASE, 接受服务端发放的租约 (须使用 tryLease)
+    WaitStrategy wait;                   // 等待裁决时的退避
+};
+
+struct FlexRequest {
+    uint64_t reqId;
+    uint64_t kernelHash;
+    const char* name;                    // 可为空, 服务端日志中显示为 kernel#<hash>
+    size_t nameLen;
+};
+
+// 已完成 kernel 的实测 GPU 时间 (例如 cudaEvent 计时), 供服务端的代价模型使用
+struct FlexCompletion {
+    uint64_t reqId;
+    uint64_t kernelHash;
+    uint64_t durationNs;
+};
+
+struct FlexDecision {
+    uint64_t reqId;
+    bool allow;
+    uint32_t reason;                     // KsReason
+};
+
+class FlexClient {
+public:
+    FlexClient() = default;
+    ~FlexClient();
+    FlexClient(const FlexClient&) = delete;
+    FlexClient& operator=(const FlexClient&) = delete;
+
+    // 注册并等待服务端接纳; 失败时在 stderr 说明原因并返回 false
+    bool connect(const FlexClientOptions& options);
+    // 注销并删除通道段
+    void close();
+    bool connected() const { return channel_ != nullptr; }
+    const std::string& shmName() const { return shmName_; }
+    bool hugePages() const { return channelHugetlb_; }
+    int numaNode() const { return numaNode_; }
+
+    // 非阻塞提交一条请求; 请求队列满时返回 false
+    bool trySubmit(uint64_t reqId, uint64_t kernelHash, const char* name = nullptr, size_t nameLen = 0);
+    // 批量提交, 只发布一次 tail、最多唤醒一次服务端; 返回实际提交的条数 (队列满时可能少于 n)
+    size_t submitBatch(const FlexRequest* reqs, size_t n);
+
+    // 上报已完成 kernel 的耗时 (可选), 每 KS_MAX_COMPLETIONS 条打包为一条消息, 没有答复;
+    // 返回实际写入的条数 (请求队列满时可能少于 n)
+    size_t reportCompletions(const FlexCompletion* completions, size_t n);
+
+    // 非阻塞取回已到达的裁决, 返回条数
+    size_t poll(FlexDecision* out, size_t maxDecisions);
+    // 等待至少一条裁决可取 (或超时); timeoutUs 为 0 表示不等待
+    bool waitDecision(uint32_t timeoutUs);
+
+    // 提交一条请求并等待它的裁决; 期间到达的其他裁决保留给之后的 poll
+    // 超时返回 false, 该请求仍在途, 其裁决之后由 poll 取回
+    bool request(uint64_t reqId, uint64_t kernelHash, const char* name, size_t nameLen,
+                 FlexDecision& out, uint32_t timeoutUs);
+
+    // 消费一个租约额度: 成功时本次 kernel 已被预先放行, 不需要请求; 没有可用的额度时返回 false
+    bool tryLease();
+    // 在租约内发射的 kernel 数
+    uint64_t leased() const { return leased_; }
+
+    // 已提交但尚未取回裁决的请求数
+    size_t inFlight() const { return submitted_ - completed_; }
+
+private:
+    bool writeRequest(uint64_t& pos, uint64_t reqId, uint64_t kernelHash, const char* name, size_t nameLen);
+    size_t drainResponses(FlexDecision* out, size_t maxDecisions);
+    bool responseReady() const;
+
+    bool createChannel(const FlexClientOptions& options, bool hugetlb);
+
+    ClientRegistry* registry_ = nullptr;
+    size_t registryBytes_ = 0;
+    ClientRegistryEntry* entry_ = nullptr;
+    size_t slot_ = 0;
+    ClientChannelStruct* channel_ = nullptr;
+    size_t channelBytes_ = 0;
+    bool channelHugetlb_ = false;
+    int numaNode_ = -1;
+    SPSCRing requestRing_;
+    SPSCRing responseRing_;
+    std::string shmName_;
+    uint32_t clientId_ = 0;
+    WaitStrategy wait_;
+
+    uint64_t submitted_ = 0;
+    uint64_t completed_ = 0;
+    uint64_t leased_ = 0;
+    std::deque<FlexDecision> stash_;   // request() 等待期间先到的其他裁决
+};
+
+// 当前用户的 registry 共享内存名, 与服务端一致
+std::string flexmps_registry_name();
@@ -0,0 +1,324 @@
+// flexmps-top: 只读映射服务端的实时统计页 (stats.h), 周期性显示各客户端与各 kernel 的速率
+// 不与服务端做任何 IPC, 对调度热路径没有影响
+
+#include "stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct TopOptions {
+    unsigned intervalMs = 1000;
+    unsigned kernels = 10;      // 显示速率最高的 kernel 数
+    bool once = false;          // 只输出一帧 (不清屏), 便于脚本使用
+};
+
+struct ClientSnapshot {
+    uint64_t session;
+    uint32_t qosClass;
+    uint32_t weight;
+    int64_t pid;
+    std::string type;
+    std::string uniqueId;
+    int32_t device, numaNode, worker, workerNode;
+    uint64_t requests, grants, denies, defers;
+    uint64_t depth, depthMax, parked;
+    uint64_t latencySum, latencyMax;
+    uint64_t gpuNs;
+    uint64_t leased;
+    uint64_t malformed;
+    uint64_t hist[KS_STATS_LAT_BUCKETS];
+};
+
+struct Snapshot {
+    uint64_t takenNs;
+    std::vector<ClientSnapshot> clients;   // 按条目下标, session 为 0 表示空闲
+    std::vector<uint64_t> kernelRequests;
+    std::vector<uint64_t> kernelCompletions;
+    std::vector<uint64_t> kernelGpuNs;
+};
+
+static void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --interval <ms>    刷新周期 (默认 1000)\n"
+              << "  --kernels <n>      显示速率最高的前 n 个 kernel (默认 10)\n"
+              << "  --once             采样一个周期后输出一次并退出\n"
+              << "  -h, --help         显示帮助\n";
+}
+
+static bool parseOptions(int argc, char** argv, TopOptions& opts) {
+    enum { OPT_INTERVAL = 256, OPT_KERNELS, OPT_ONCE };
+    static const struct option longOpts[] = {
+        {"interval", required_argument, nullptr, OPT_INTERVAL},
+        {"kernels",  required_argument, nullptr, OPT_KERNELS},
+        {"once",     no_argument,       nullptr, OPT_ONCE},
+        {"help",     no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOpts, nullptr)) != -1) {
+        char* end = nullptr;
+        bool ok = true;
+        switch (c) {
+        case OPT_INTERVAL:
+            opts.intervalMs = strtoul(optarg, &end, 10);
+            ok = optarg[0] && !*end && opts.intervalMs > 0;
+            break;
+        case OPT_KERNELS:
+            opts.kernels = strtoul(optarg, &end, 10);
+            ok = optarg[0] && !*end;
+            break;
+        case OPT_ONCE:
+            opts.once = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return false;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            std::cerr << "[Top] Invalid argument for option " << argv[optind - 1] << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void take(void* base, Snapshot& snap) {
+    const KsStatsHeader* h = static_cast<const KsStatsHeader*>(base);
+    KsStatsClient* clients = ks_stats_clients(base);
+    KsStatsKernel* kernels = ks_stats_kernels(base);
+
+    snap.takenNs = steadyNs();
+    snap.clients.assign(h->client_capacity, ClientSnapshot());
+    for (uint32_t i = 0; i < h->client_capacity; i++) {
+        KsStatsClient& c = clients[i];
+        ClientSnapshot& s = snap.clients[i];
+        s.session = c.session.load(std::memory_order_acquire);
+        if (!s.session) continue;
+        s.qosClass = c.qos_class;
+        s.weight = c.weight;
+        s.pid = c.pid;
+        s.type.assign(c.client_type, strnlen(c.client_type, sizeof(c.client_type)));
+        s.uniqueId.assign(c.unique_id, strnlen(c.unique_id, sizeof(c.unique_id)));
+        s.device = c.device;
+        s.numaNode = c.numa_node;
+        s.worker = c.worker.load(std::memory_order_relaxed);
+        s.workerNode = c.worker_node.load(std::memory_order_relaxed);
+        s.requests = c.requests.load(std::memory_order_relaxed);
+        s.grants = c.grants.load(std::memory_order_relaxed);
+        s.denies = c.denies.load(std::memory_order_relaxed);
+        s.defers = c.defers.load(std::memory_order_relaxed);
+        s.depth = c.queue_depth.load(std::memory_order_relaxed);
+        s.depthMax = c.queue_depth_max.load(std::memory_order_relaxed);
+        s.parked = c.parked.load(std::memory_order_relaxed);
+        s.latencySum = c.latency_sum_ns.load(std::memory_order_relaxed);
+        s.latencyMax = c.latency_max_ns.load(std::memory_order_relaxed);
+        for (uint32_t b = 0; b < KS_STATS_LAT_BUCKETS; b++) s.hist[b] = c.latency_hist[b].load(std::memory_order_relaxed);
+        s.gpuNs = c.gpu_ns.load(std::memory_order_relaxed);
+        s.leased = c.leased.load(std::memory_order_relaxed);
+        s.malformed = c.malformed.load(std::memory_order_relaxed);
+        // 读取期间条目被换给了新会话, 视为空闲
+        if (c.session.load(std::memory_order_acquire) != s.session) s.session = 0;
+    }
+
+    uint32_t kernelCount = std::min(h->kernel_count.load(std::memory_order_acquire), h->kernel_capacity);
+    snap.kernelRequests.resize(kernelCount);
+    snap.kernelCompletions.resize(kernelCount);
+    snap.kernelGpuNs.resize(kernelCount);
+    for (uint32_t i = 0; i < kernelCount; i++) {
+        snap.kernelRequests[i] = kernels[i].requests.load(std::memory_order_relaxed);
+        snap.kernelCompletions[i] = kernels[i].completions.load(std::memory_order_relaxed);
+        snap.kernelGpuNs[i] = kernels[i].gpu_ns.load(std::memory_order_relaxed);
+    }
+}
+
+// 客户端节点/worker 节点, 未知为 '-'; 两者已知且不同时加 '*'
+static std::string formatPlacement(const ClientSnapshot& c) {
+    std::string s = c.numaNode >= 0 ? std::to_string(c.numaNode) : "-";
+    s += '/';
+    s += c.workerNode >= 0 ? std::to_string(c.workerNode) : "-";
+    if (c.numaNode >= 0 && c.workerNode >= 0 && c.numaNode != c.workerNode) s += '*';
+    return s;
+}
+
+static const char* qosName(uint32_t qos) {
+    switch (qos) {
+    case KS_QOS_DECODE: return "decode";
+    case KS_QOS_PREFILL: return "prefill";
+    default: return "-";
+    }
+}
+
+static std::string formatUs(double ns) {
+    char buf[32];
+    if (ns >= 1e6) snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    return buf;
+}
+
+// 直方图增量的分位数, 取所在桶的上界
+static uint64_t histPercentile(const uint64_t* cur, const uint64_t* prev, double p) {
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < KS_STATS_LAT_BUCKETS; b++) total += cur[b] - prev[b];
+    if (total == 0) return 0;
+    uint64_t target = static_cast<uint64_t>(p * total);
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < KS_STATS_LAT_BUCKETS; b++) {
+        seen += cur[b] - prev[b];
+        if (seen > target) return 1ULL << b;
+    }
+    return 1ULL << (KS_STATS_LAT_BUCKETS - 1);
+}
+
+// 各调度域的占用账本, 每个 QoS 类别一行; 账本只在 worker 运行时发布, 超过两个速率窗口未更新的域视为空闲, 不显示
+static void renderDevices(void* base) {
+    const KsStatsHeader* h = static_cast<const KsStatsHeader*>(base);
+    KsStatsDevice* devices = ks_stats_devices(base);
+    uint64_t now = steadyNs();
+    bool any = false;
+    for (uint32_t i = 0; i < h->device_count && i < KS_STATS_MAX_DEVICES; i++) {
+        KsStatsDevice& d = devices[i];
+        uint64_t updated = d.updated_ns.load(std::memory_order_acquire);
+        if (updated == 0 || now - updated > 2 * LEDGER_RATE_WINDOW_NS) continue;
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) {
+            int64_t inflight = d.inflight[c].load(std::memory_order_relaxed);
+            int64_t work = d.outstanding_ns[c].load(std::memory_order_relaxed);
+            uint64_t rate = d.grant_rate[c].load(std::memory_order_relaxed);
+            if (inflight == 0 && work == 0 && rate == 0) continue;
+            if (!any) printf("%3s %-8s %9s %12s %10s\n", "GPU", "QOS", "INFLIGHT", "OUTSTANDING", "GRANT/s");
+            any = true;
+            printf("%3d %-8s %9lld %12s %10llu\n", d.device, qosName(c), (long long)inflight,
+                   formatUs(static_cast<double>(std::max<int64_t>(work, 0))).c_str(), (unsigned long long)rate);
+        }
+    }
+    if (any) printf("\n");
+}
+
+static void render(void* base, const Snapshot& prev, const Snapshot& cur, const TopOptions& opts) {
+    const KsStatsHeader* h = static_cast<const KsStatsHeader*>(base);
+    KsStatsKernel* kernels = ks_stats_kernels(base);
+    double secs = (cur.takenNs - prev.takenNs) / 1e9;
+    if (secs <= 0) secs = 1e-9;
+
+    if (!opts.once) printf("\033[H\033[2J");
+    size_t active = 0;
+    for (const auto& c : cur.clients) active += c.session != 0;
+    printf("flexmps-top  policy %s  workers %u  pid %lld  uptime %.1fs  sessions %zu active / %llu total\n\n",
+           h->policy, h->workers, (long long)h->server_pid, (steadyNs() - h->start_ns) / 1e9, active,
+           (unsigned long long)h->sessions_total.load(std::memory_order_relaxed));
+
+    renderDevices(base);
+
+    printf("%8s %-10s %-16s %-8s %6s %3s %3s %6s %10s %10s %9s %9s %9s %7s %6s %5s %9s %9s %9s %6s\n",
+           "SESSION", "TYPE", "UNIQUE_ID", "QOS", "PID", "GPU", "WK", "NODE", "REQ/s", "GRANT/s", "DENY/s", "DEFER/s",
+           "LEASE/s", "DEPTH", "PARK", "BAD", "LAT_AVG", "LAT_P99", "LAT_MAX", "GPU%");
+    for (size_t i = 0; i < cur.clients.size(); i++) {
+        const ClientSnapshot& c = cur.clients[i];
+        if (!c.session) continue;
+        // 新出现的会话以零为基准
+        ClientSnapshot zero = ClientSnapshot();
+        const ClientSnapshot& p = (i < prev.clients.size() && prev.clients[i].session == c.session) ? prev.clients[i] : zero;
+        uint64_t n = c.requests - p.requests;
+        double avg = n ? static_cast<double>(c.latencySum - p.latencySum) / n : 0;
+        char depth[24];
+        snprintf(depth, sizeof(depth), "%llu/%llu", (unsigned long long)c.depth, (unsigned long long)c.depthMax);
+        // 上报的 GPU 执行时间占采样间隔的比例; 未上报完成记录的客户端为 0
+        double gpuPct = (c.gpuNs - p.gpuNs) / (secs * 1e7);
+        printf("%8llu %-10.10s %-16.16s %-8s %6lld %3d %3s %6s %10.0f %10.0f %9.0f %9.0f %9.0f %7s %6llu %5llu %9s %9s %9s %6.1f\n",
+               (unsigned long long)c.session, c.type.c_str(), c.uniqueId.c_str(), qosName(c.qosClass),
+               (long long)c.pid, c.device, c.worker >= 0 ? std::to_string(c.worker).c_str() : "-",
+               formatPlacement(c).c_str(), n / secs, (c.grants - p.grants) / secs, (c.denies - p.denies) / secs,
+               (c.defers - p.defers) / secs, (c.leased - p.leased) / secs, depth, (unsigned long long)c.parked,
+               (unsigned long long)c.malformed, formatUs(avg).c_str(),
+               formatUs(static_cast<double>(histPercentile(c.hist, p.hist, 0.99))).c_str(),
+               formatUs(static_cast<double>(c.latencyMax)).c_str(), gpuPct);
+    }
+
+    if (opts.kernels == 0) return;
+    std::vector<std::pair<uint64_t, uint32_t>> rates;
+    for (uint32_t k = 0; k < cur.kernelRequests.size(); k++) {
+        uint64_t before = k < prev.kernelRequests.size() ? prev.kernelRequests[k] : 0;
+        if (cur.kernelRequests[k] > before) rates.push_back(std::make_pair(cur.kernelRequests[k] - before, k));
+    }
+    std::sort(rates.begin(), rates.end(), [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+        return a.first > b.first;
+    });
+    printf("\n%-64s %10s %12s %9s\n", "KERNEL", "REQ/s", "TOTAL", "GPU_AVG");
+    for (size_t i = 0; i < rates.size() && i < opts.kernels; i++) {
+        uint32_t k = rates[i].second;
+        uint64_t done = cur.kernelCompletions[k];
+        printf("%-64.64s %10.0f %12llu %9s\n", kernels[k].name, rates[i].first / secs,
+               (unsigned long long)cur.kernelRequests[k],
+               done ? formatUs(static_cast<double>(cur.kernelGpuNs[k]) / done).c_str() : "-");
+    }
+    fflush(stdout);
+}
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+    g_stop = 1;
+}
+
+int main(int argc, char** argv) {
+    TopOptions opts;
+    if (!parseOptions(argc, argv, opts)) return 1;
+
+    std::string name = ks_stats_name();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "[Top] " << name << " not found (is the scheduler running with stats enabled?)" << std::endl;
+        return 1;
+    }
+    void* base = mmap(nullptr, KS_STATS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("[Top] mmap");
+        return 1;
+    }
+    const KsStatsHeader* h = static_cast<const KsStatsHeader*>(base);
+    if (memcmp(h->magic, KS_STATS_MAGIC, sizeof(h->magic)) != 0 || h->version != KS_STATS_VERSION ||
+        h->client_capacity > KS_STATS_MAX_CLIENTS || h->kernel_capacity > KS_STATS_MAX_KERNELS) {
+        std::cerr << "[Top] " << name << " has an unsupported layout" << std::endl;
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Snapshot prev, cur;
+    take(base, prev);
+    while (!g_stop) {
+        usleep(opts.intervalMs * 1000);
+        if (kill(static_cast<pid_t>(h->server_pid), 0) != 0 && errno == ESRCH) {
+            std::cerr << "[Top] Scheduler (pid " << h->server_pid << ") exited" << std::endl;
+            return 1;
+        }
+        take(base, cur);
+        render(base, prev, cur, opts);
+        if (opts.once) break;
+        std::swap(prev, cur);
+    }
+    munmap(base, KS_STATS_SIZE);
+    return 0;
+}
@@ -3,17 +3,39 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <cstddef>
+
+#include "wait_strategy.h"
+
+// 指向共享内存中一条消息的只读视图
+struct MsgView {
+    const char* data;
+    size_t len;
+};
+
+// 多通道休眠前的检查结果
+enum class WaitPrep {
+    Parked,        // 已声明休眠, 可以在返回的 futex 上等待
+    Ready,         // 已有消息就绪, 不应休眠
+    Unsupported,   // 对端不支持 futex 唤醒
+};
 
 // 代表一个已连接的客户端通道
 class IChannel {
 public:
     virtual ~IChannel() = default;
 
-    // 实现层应处理忙等待/CPU pause
-    virtual bool recvBlocking(std::string& outMsg) = 0;
+    // 零拷贝非阻塞批量接收: 取走当前所有就绪消息 (最多 maxMsgs 条), 没有就绪消息时立即返回 0
+    // 视图指向共享内存槽位, 处理完毕后调用 releaseBatch(n) 一次性归还前 n 条, 在此之前一直有效
+    virtual size_t tryRecvBatch(MsgView* out, size_t maxMsgs) = 0;
+    virtual void releaseBatch(size_t n) = 0;
+
+    // 批量发送: 全部写入后只发布一次 tail, 返回 false 表示超时
+    virtual bool sendBatch(const MsgView* msgs, size_t n) = 0;
 
-    // 发送响应
-    virtual bool sendBlocking(const std::string& msg) = 0;
+    // 多通道休眠: prepareWait 声明服务端即将休眠并给出 futex 句柄, 醒来后调用 finishWait
+    virtual WaitPrep prepareWait(WaitHandle& handle) = 0;
+    virtual void finishWait() = 0;
 
     // 检查连接是否仍然存活
     virtual bool isConnected() = 0;
@@ -25,6 +47,29 @@ public:
     virtual std::string getId() const = 0;
     virtual std::string getType() const = 0;
     virtual std::string getName() const = 0;
+
+    // 客户端注册时声明的 QoS 类别 (KsQosClass) 与权重 (0 表示未指定)
+    virtual uint32_t getQosClass() const = 0;
+    virtual uint32_t getWeight() const = 0;
+
+    // 客户端进程号, 未知时为 0
+    virtual pid_t getPid() const = 0;
+
+    // 客户端声明的 NUMA 节点, 未知时为 -1
+    virtual int getNumaNode() const = 0;
+
+    // 客户端使用的 GPU 序号
+    virtual int getDevice() const = 0;
+
+    // 客户端是否按 reqId 匹配裁决 (KS_CAP_OUT_OF_ORDER); 否则必须按请求顺序答复
+    virtual bool outOfOrder() const = 0;
+
+    // 租约 (KS_CAP_LEASE): 客户端是否接受租约; 发放 kernels 个额度, 在 expiryNs (steady_clock) 到期;
+    // 剩余额度多于 kernels 时收缩到 kernels; 客户端累计在租约内发射的 kernel 数
+    virtual bool acceptsLease() const = 0;
+    virtual void grantLease(uint32_t kernels, uint64_t expiryNs) = 0;
+    virtual void shrinkLease(uint32_t kernels) = 0;
+    virtual uint64_t leaseUsed() const = 0;
 };
 
 // 代表 IPC 服务端/监听器
@@ -0,0 +1,98 @@
+#include "kernel_table.h"
+
+#include <cstdio>
+
+KernelTable& KernelTable::instance() {
+    static KernelTable instance;
+    return instance;
+}
+
+KernelTable::KernelTable()
+    : slots_(SLOT_COUNT), names_(MAX_KERNEL_TYPES), placeholder_(MAX_KERNEL_TYPES), hashes_(MAX_KERNEL_TYPES, 0) {
+    for (auto& n : names_) n.store("", std::memory_order_relaxed);
+    names_[KERNEL_ID_OVERFLOW].store("<other kernels>", std::memory_order_relaxed);
+}
+
+// hash 0 用于标记空槽, 真实 hash 为 0 时映射为 1
+static inline uint64_t slotKey(uint64_t hash) {
+    return hash ? hash : 1;
+}
+
+uint32_t KernelTable::intern(uint64_t hash, const char* name, size_t len, bool* renamed) {
+    uint64_t key = slotKey(hash);
+    uint32_t mask = SLOT_COUNT - 1;
+    bool named = name && len > 0;
+
+    // 快路径: 无锁查找
+    for (uint32_t i = static_cast<uint32_t>(key) & mask;; i = (i + 1) & mask) {
+        uint64_t h = slots_[i].hash.load(std::memory_order_acquire);
+        if (h == key) {
+            uint32_t id = slots_[i].id;
+            if (named && placeholder_[id].load(std::memory_order_relaxed)) return rename(id, name, len, renamed);
+            return id;
+        }
+        if (h == 0) break;
+    }
+
+    // 慢路径: 加锁后重新查找并登记
+    std::unique_lock<std::mutex> lock(insertMutex_);
+    uint32_t i = static_cast<uint32_t>(key) & mask;
+    for (;; i = (i + 1) & mask) {
+        uint64_t h = slots_[i].hash.load(std::memory_order_relaxed);
+        if (h == key) {
+            uint32_t id = slots_[i].id;
+            lock.unlock();
+            if (named && placeholder_[id].load(std::memory_order_relaxed)) return rename(id, name, len, renamed);
+            return id;
+        }
+        if (h == 0) break;
+    }
+
+    uint32_t id = count_.load(std::memory_order_relaxed);
+    if (id >= KERNEL_ID_OVERFLOW) {
+        // 表满之后的新 hash 同样记入槽位, 映射到 KERNEL_ID_OVERFLOW, 之后的查找走无锁快路径;
+        // 槽位占用达到上限后不再记录, 保证探测序列总能遇到空槽
+        if (usedSlots_ < SLOT_LIMIT) {
+            slots_[i].id = KERNEL_ID_OVERFLOW;
+            slots_[i].hash.store(key, std::memory_order_release);
+            usedSlots_++;
+        }
+        return KERNEL_ID_OVERFLOW;
+    }
+
+    if (named) {
+        storage_.emplace_back(name, len);
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "kernel#%016llx", (unsigned long long)hash);
+        storage_.emplace_back(buf);
+        placeholder_[id].store(true, std::memory_order_relaxed);
+    }
+    names_[id].store(storage_.back().c_str(), std::memory_order_relaxed);
+    hashes_[id] = hash;
+    slots_[i].id = id;
+    // 先写好名称与 id 再发布 hash, 无锁读者看到 hash 时名称一定可见
+    slots_[i].hash.store(key, std::memory_order_release);
+    usedSlots_++;
+    count_.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+// 占位名称只替换一次; 旧字符串留在 storage_ 中, 已取得它的读者不受影响
+uint32_t KernelTable::rename(uint32_t id, const char* name, size_t len, bool* renamed) {
+    std::lock_guard<std::mutex> lock(insertMutex_);
+    if (!placeholder_[id].load(std::memory_order_relaxed)) return id;
+    storage_.emplace_back(name, len);
+    names_[id].store(storage_.back().c_str(), std::memory_order_release);
+    placeholder_[id].store(false, std::memory_order_relaxed);
+    if (renamed) *renamed = true;
+    return id;
+}
+
+const char* KernelTable::name(uint32_t id) const {
+    return id < MAX_KERNEL_TYPES ? names_[id].load(std::memory_order_acquire) : "";
+}
+
+uint64_t KernelTable::hash(uint32_t id) const {
+    return id < MAX_KERNEL_TYPES ? hashes_[id] : 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+constexpr uint32_t MAX_KERNEL_TYPES = 16384;
+constexpr uint32_t KERNEL_ID_OVERFLOW = MAX_KERNEL_TYPES - 1;   // 表满之后的 kernel 统一记到这里
+
+/**
+ * @brief kernel 名称驻留表 (全局单例, 跨会话复用)
+ * 把 kernel hash 映射为从 0 开始的稠密 id, 供各类统计以数组下标的方式使用
+ * 查找无锁 (开放寻址 + acquire 读), 只有首次出现的 kernel 需要加锁登记
+ */
+class KernelTable {
+public:
+    static KernelTable& instance();
+
+    // 查找或登记, name 为空时 (只带 hash 的二进制请求、完成记录) 使用 "kernel#<hash>" 作为占位名称;
+    // 之后第一次带名称的调用把占位名称替换为真实名称, 此时 *renamed 置为 true
+    uint32_t intern(uint64_t hash, const char* name, size_t len, bool* renamed = nullptr);
+
+    // 已登记 kernel 的名称; 返回的指针一直有效, 占位名称被替换后旧指针仍指向占位名称
+    const char* name(uint32_t id) const;
+    uint64_t hash(uint32_t id) const;
+
+    // 当前已登记的 kernel 数 (即最大 id + 1)
+    uint32_t size() const { return count_.load(std::memory_order_acquire); }
+
+private:
+    KernelTable();
+
+    static constexpr uint32_t SLOT_COUNT = MAX_KERNEL_TYPES * 2;   // 已登记的 kernel 负载因子 <= 0.5
+    static constexpr uint32_t SLOT_LIMIT = SLOT_COUNT / 4 * 3;     // 加上缓存的溢出 hash 不超过 0.75
+
+    struct Slot {
+        std::atomic<uint64_t> hash{0};   // 0 表示空槽
+        uint32_t id = 0;
+    };
+
+    uint32_t rename(uint32_t id, const char* name, size_t len, bool* renamed);
+
+    std::vector<Slot> slots_;
+    std::vector<std::atomic<const char*>> names_;   // 预先分配, 下标即 id, 指向 storage_ 中的字符串
+    std::vector<std::atomic<bool>> placeholder_;    // 名称仍是 "kernel#<hash>"
+    std::deque<std::string> storage_;               // 只追加, 已发布的名称不会移动或释放
+    std::vector<uint64_t> hashes_;
+    std::atomic<uint32_t> count_{0};
+    uint32_t usedSlots_ = 0;                        // 已占用的槽位数, 持 insertMutex_ 访问
+    std::mutex insertMutex_;
+};
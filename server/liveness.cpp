@@ -0,0 +1,137 @@
+#include "liveness.h"
+
+#include <iostream>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+static int pidfd_open(pid_t pid) {
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+LivenessMonitor::~LivenessMonitor() {
+    stop();
+}
+
+bool LivenessMonitor::start() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        perror("[Liveness] epoll/eventfd");
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+    running_ = true;
+    thread_ = std::thread(&LivenessMonitor::run, this);
+    return true;
+}
+
+void LivenessMonitor::wake() {
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) perror("[Liveness] eventfd write");
+}
+
+void LivenessMonitor::stop() {
+    if (running_.exchange(false)) {
+        wake();
+        thread_.join();
+    }
+    for (auto& w : watches_) {
+        if (w->pidfd >= 0) close(w->pidfd);
+    }
+    watches_.clear();
+    pending_.clear();
+    if (epollFd_ >= 0) close(epollFd_);
+    if (wakeFd_ >= 0) close(wakeFd_);
+    epollFd_ = wakeFd_ = -1;
+}
+
+void LivenessMonitor::watch(pid_t pid, std::shared_ptr<LivenessState> state, std::function<void()> onDeath) {
+    std::unique_ptr<Watch> w(new Watch{pid, -1, std::move(state), std::move(onDeath), false});
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        pending_.push_back(std::move(w));
+    }
+    wake();
+}
+
+void LivenessMonitor::adoptPending() {
+    std::vector<std::unique_ptr<Watch>> adopted;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        adopted.swap(pending_);
+    }
+    for (auto& w : adopted) {
+        w->pidfd = pidfd_open(w->pid);
+        if (w->pidfd < 0 && errno == ESRCH) {
+            // 登记之后、开始监视之前就已退出
+            died(*w);
+            continue;
+        }
+        if (w->pidfd >= 0) {
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = w.get();
+            if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, w->pidfd, &ev) != 0) {
+                close(w->pidfd);
+                w->pidfd = -1;
+            }
+        }
+        watches_.push_back(std::move(w));
+    }
+}
+
+void LivenessMonitor::died(Watch& w) {
+    w.state->dead.store(true, std::memory_order_release);
+    if (w.onDeath) w.onDeath();
+    w.done = true;
+}
+
+void LivenessMonitor::run() {
+    struct epoll_event events[16];
+    while (running_.load()) {
+        int n = epoll_wait(epollFd_, events, 16, LIVENESS_POLL_MS);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t v;
+                while (read(wakeFd_, &v, sizeof(v)) > 0) {}
+                continue;
+            }
+            Watch* w = static_cast<Watch*>(events[i].data.ptr);
+            if (!w->done) died(*w);
+        }
+        adoptPending();
+
+        // 无 pidfd 的监视逐个 kill(pid, 0); 已关闭的通道撤销监视
+        for (auto& w : watches_) {
+            if (w->done) continue;
+            if (w->state->closed.load(std::memory_order_acquire)) {
+                w->done = true;
+            } else if (w->pidfd < 0 && kill(w->pid, 0) != 0 && errno == ESRCH) {
+                died(*w);
+            }
+        }
+        for (size_t i = 0; i < watches_.size();) {
+            if (watches_[i]->done) {
+                // close 同时把 pidfd 从 epoll 中移除
+                if (watches_[i]->pidfd >= 0) close(watches_[i]->pidfd);
+                watches_[i] = std::move(watches_.back());
+                watches_.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+// 无 pidfd 可用时 kill(pid, 0) 的检查周期, 也是撤销已关闭通道的监视的周期
+constexpr int LIVENESS_POLL_MS = 5;
+
+// 单个被监视客户端的状态, 由通道与监视线程共同持有
+struct LivenessState {
+    std::atomic<bool> dead{false};     // 监视线程发现进程退出后置位; 热路径只读这个标志
+    std::atomic<bool> closed{false};   // 通道已销毁, 监视线程下一轮撤销监视
+};
+
+/**
+ * @brief 客户端进程存活监视 (单个后台线程)
+ * 优先使用 pidfd + epoll: 进程退出时 pidfd 可读, 立即置 dead;
+ * 内核不支持 pidfd_open (Linux < 5.3) 时退化为每 LIVENESS_POLL_MS 一次 kill(pid, 0)
+ * 这样 ShmChannel::isConnected 不再需要任何系统调用
+ */
+class LivenessMonitor {
+public:
+    LivenessMonitor() = default;
+    ~LivenessMonitor();
+    LivenessMonitor(const LivenessMonitor&) = delete;
+    LivenessMonitor& operator=(const LivenessMonitor&) = delete;
+
+    bool start();
+    void stop();
+
+    // 监视 pid; 进程退出后置 state->dead, 并在监视线程中调用 onDeath
+    // onDeath 持有的资源在监视撤销 (进程退出或 state->closed) 时释放
+    void watch(pid_t pid, std::shared_ptr<LivenessState> state, std::function<void()> onDeath);
+
+private:
+    struct Watch {
+        pid_t pid;
+        int pidfd;                     // -1 表示使用 kill 轮询
+        std::shared_ptr<LivenessState> state;
+        std::function<void()> onDeath;
+        bool done;
+    };
+
+    void run();
+    void wake();
+    void adoptPending();
+    void died(Watch& w);
+
+    int epollFd_ = -1;
+    int wakeFd_ = -1;                  // eventfd, 新的监视或 stop() 时唤醒监视线程
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    std::mutex pendingMutex_;
+    std::vector<std::unique_ptr<Watch>> pending_;
+    std::vector<std::unique_ptr<Watch>> watches_;   // 仅监视线程访问
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// ============================================================
+//  二进制 kernel 日志 (--log-format binary)
+// ============================================================
+//
+// 每个 unique_id 一个文件 logs/<time>/process_<id>.kslog, 取代逐行文本 "Kernel N: <name> from <client>":
+//   KsLogHeader
+//   块 ...                              每块以 KsLogBlock 开头, bytes 为含块头的总长 (8 字节对齐)
+//   { KsLogName, name[len] } ...        关闭时追加: kernel_count 个 kernel 名称, 之后 client_count 个客户端 id
+//
+// kernel 块按列存放 count 条记录 (每条 8 字节):
+//   uint32_t time[count]     相对块的 base_ns 的纳秒偏移 (服务端首次取到请求的时间)
+//   uint16_t kernel[count]   文件内 kernel 字典的下标
+//   uint16_t client[count]   文件内客户端字典的下标 (请求中的 client_id)
+// 记录的时间不保证单调 (同一 unique_id 的多个会话可能由不同 worker 写入); 偏移放不下 uint32 时另起一块.
+// 文本块保存写往该 Logger 的其他文本行 (如发送超时), count 为文本长度.
+// 服务端异常退出时文件没有字典, record_count 与 names_offset 为 0, 块仍然完整可读.
+// 全部字段为小端, 读者 (ks_logstat) 直接 mmap
+
+constexpr char KS_LOG_MAGIC[8] = {'K', 'S', 'L', 'O', 'G', '\0', '\0', '\0'};
+constexpr uint32_t KS_LOG_VERSION = 1;
+constexpr uint32_t KS_LOG_BLOCK_MAGIC = 0x424C534B;   // "KSLB"
+constexpr uint32_t KS_LOG_BLOCK_RECORDS = 4096;      // kernel 块最多的记录数
+constexpr uint32_t KS_LOG_MAX_KEYS = 65535;          // 每个文件 kernel / 客户端字典的上限, 超出的记到最后一项
+
+enum KsLogBlockKind : uint16_t {
+    KS_LOG_BLOCK_KERNELS = 1,
+    KS_LOG_BLOCK_TEXT = 2,
+};
+
+struct KsLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_records;
+    uint64_t start_ns;          // 文件创建时间 (steady_clock), 块的 base_ns 相对于它
+    int64_t start_unix_ns;      // 同一时刻的系统时间, 用于与其他日志对齐
+    uint64_t record_count;      // kernel 记录数, 关闭时写入
+    uint64_t dropped;           // 异步队列满而丢弃的记录数
+    uint64_t names_offset;      // 字典的文件偏移, 关闭时写入
+    uint32_t kernel_count;
+    uint32_t client_count;
+    char unique_id[64];
+};
+static_assert(sizeof(KsLogHeader) == 128, "KsLogHeader layout changed");
+
+struct KsLogBlock {
+    uint32_t magic;
+    uint16_t kind;              // KsLogBlockKind
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t base_ns;           // 相对 KsLogHeader::start_ns
+};
+static_assert(sizeof(KsLogBlock) == 24, "KsLogBlock layout changed");
+
+struct __attribute__((packed)) KsLogName {
+    uint64_t hash;              // kernel hash; 客户端为 0
+    uint16_t len;
+};
+
+inline size_t ks_log_align(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+// kernel 块的各列在块内的偏移与总长
+inline size_t ks_log_kernels_offset(uint32_t count) { return sizeof(KsLogBlock) + count * sizeof(uint32_t); }
+inline size_t ks_log_clients_offset(uint32_t count) { return ks_log_kernels_offset(count) + count * sizeof(uint16_t); }
+inline size_t ks_log_kernel_block_bytes(uint32_t count) {
+    return ks_log_align(ks_log_clients_offset(count) + count * sizeof(uint16_t));
+}
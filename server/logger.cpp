@@ -1,29 +1,87 @@
 #include "logger.h"
+#include "kernel_table.h"
+#include "log_format.h"
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <sys/stat.h>
+#include <sched.h>
+#include <unistd.h>
 
 // ==========================================
 // Logger Implementation (Individual Session)
 // ==========================================
 
-Logger::Logger(const std::string& id, const std::string& dirPath) 
-    : id_(id), dirPath_(dirPath) {
+// 异步模式下每个日志文件的写缓冲, 后台线程每轮排空后 flush 一次
+constexpr size_t ASYNC_STREAM_BUFFER = 1 << 20;
+
+// 异步队列中一条二进制格式的 kernel 记录 (LOG_RECORD_KERNEL), 其后是 client 的 clientLen 个字节
+struct LogKernelEntry {
+    uint64_t seenNs;
+    uint32_t kernelId;
+    uint32_t clientLen;
+};
+
+static uint64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool fileExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+Logger::Logger(const std::string& id, const std::string& dirPath, bool async, bool binary)
+    : id_(id), dirPath_(dirPath), async_(async), binary_(binary && !id.empty()) {
     
     std::string filename;
     if (id_.empty()) {
         filename = dirPath_ + "/meta.log";
+    } else if (binary_) {
+        // 文件头在关闭时改写, 不能追加: 同一目录中再次出现的 unique_id 另开一个文件
+        filename = dirPath_ + "/process_" + id_ + ".kslog";
+        for (int i = 1; fileExists(filename); i++) {
+            filename = dirPath_ + "/process_" + id_ + "." + std::to_string(i) + ".kslog";
+        }
     } else {
         filename = dirPath_ + "/process_" + id_ + ".log";
     }
 
-    fileStream_.open(filename, std::ios::out | std::ios::app);
+    if (async_) {
+        streamBuffer_.resize(ASYNC_STREAM_BUFFER);
+        fileStream_.rdbuf()->pubsetbuf(streamBuffer_.data(), streamBuffer_.size());
+    }
+    if (binary_) {
+        fileStream_.open(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    } else {
+        fileStream_.open(filename, std::ios::out | std::ios::app);
+    }
     if (!fileStream_.is_open()) {
         std::cerr << "[Logger] Error: Failed to open log file: " << filename << std::endl;
+        return;
+    }
+    if (binary_) {
+        // 先写入未完成的文件头, 关闭时补上记录数与字典位置
+        startNs_ = steadyNs();
+        startUnixNs_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        KsLogHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, KS_LOG_MAGIC, sizeof(h.magic));
+        h.version = KS_LOG_VERSION;
+        h.block_records = KS_LOG_BLOCK_RECORDS;
+        h.start_ns = startNs_;
+        h.start_unix_ns = startUnixNs_;
+        strncpy(h.unique_id, id_.c_str(), sizeof(h.unique_id) - 1);
+        fileStream_.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        blockTimes_.reserve(KS_LOG_BLOCK_RECORDS);
+        blockKernels_.reserve(KS_LOG_BLOCK_RECORDS);
+        blockClients_.reserve(KS_LOG_BLOCK_RECORDS);
     }
 }
 
@@ -32,16 +90,200 @@ Logger::~Logger() {
 }
 
 void Logger::write(const std::string& message) {
+    write(message.data(), message.size());
+}
+
+void Logger::write(const char* data, size_t len) {
+    if (async_) {
+        LogManager::instance().enqueue(this, data, len);
+        return;
+    }
     std::lock_guard<std::mutex> lock(opMutex_);
+    if (binary_) {
+        appendText(data, len);
+        if (!isClosed_ && fileStream_.is_open()) fileStream_.flush();
+        return;
+    }
     if (fileStream_.is_open()) {
-        fileStream_ << message << "\n";
-        fileStream_.flush(); 
+        fileStream_.write(data, len);
+        fileStream_ << "\n";
+        fileStream_.flush();
+    }
+}
+
+void Logger::kernel(uint32_t kernelId, const char* client, size_t clientLen, uint64_t seenNs) {
+    long long seq = nextKernelId();
+    if (!binary_) {
+        char line[LOG_RECORD_SIZE];
+        int len = snprintf(line, sizeof(line), "Kernel %lld: %s from %.*s",
+                           seq, KernelTable::instance().name(kernelId), (int)clientLen, client);
+        if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+        write(line, len);
+        return;
     }
+    if (!async_) {
+        // 同步模式同样攒满一块再写出, 只是由调用线程写
+        std::lock_guard<std::mutex> lock(opMutex_);
+        appendKernel(seenNs, kernelId, client, clientLen);
+        return;
+    }
+    char buf[sizeof(LogRecord::text)];
+    if (clientLen > sizeof(buf) - sizeof(LogKernelEntry)) clientLen = sizeof(buf) - sizeof(LogKernelEntry);
+    LogKernelEntry e = {seenNs, kernelId, static_cast<uint32_t>(clientLen)};
+    memcpy(buf, &e, sizeof(e));
+    memcpy(buf + sizeof(e), client, clientLen);
+    LogManager::instance().enqueue(this, buf, sizeof(e) + clientLen, LOG_RECORD_KERNEL);
 }
 
-void Logger::recordKernelStat(const std::string& kernelType) {
+void Logger::appendFromWriter(const char* data, size_t len) {
     std::lock_guard<std::mutex> lock(opMutex_);
-    kernelStats_[kernelType]++;
+    if (!isClosed_ && fileStream_.is_open()) {
+        if (binary_) {
+            appendText(data, len);
+        } else {
+            fileStream_.write(data, len);
+            fileStream_.put('\n');
+        }
+        dirty_ = true;
+    }
+}
+
+void Logger::appendKernelFromWriter(const char* entry, size_t len) {
+    LogKernelEntry e;
+    if (len < sizeof(e)) return;
+    memcpy(&e, entry, sizeof(e));
+    std::lock_guard<std::mutex> lock(opMutex_);
+    appendKernel(e.seenNs, e.kernelId, entry + sizeof(e), e.clientLen);
+    dirty_ = true;
+}
+
+void Logger::appendKernel(uint64_t seenNs, uint32_t kernelId, const char* client, size_t clientLen) {
+    if (isClosed_ || !fileStream_.is_open()) return;
+    // 首条请求在文件创建之前取到
+    uint64_t t = seenNs > startNs_ ? seenNs - startNs_ : 0;
+    if (!blockTimes_.empty() &&
+        (blockTimes_.size() >= KS_LOG_BLOCK_RECORDS || t < blockBaseNs_ || t - blockBaseNs_ > UINT32_MAX)) {
+        flushBlock();
+    }
+    if (blockTimes_.empty()) blockBaseNs_ = t;
+    blockTimes_.push_back(static_cast<uint32_t>(t - blockBaseNs_));
+    blockKernels_.push_back(kernelKey(kernelId));
+    blockClients_.push_back(clientKey(client, clientLen));
+    records_++;
+}
+
+uint16_t Logger::kernelKey(uint32_t kernelId) {
+    if (kernelId >= kernelIndex_.size()) kernelIndex_.resize(kernelId + 1, 0);
+    uint16_t& index = kernelIndex_[kernelId];
+    if (index == 0) {
+        if (kernelKeys_.size() >= KS_LOG_MAX_KEYS) return KS_LOG_MAX_KEYS - 1;
+        kernelKeys_.push_back(kernelId);
+        index = static_cast<uint16_t>(kernelKeys_.size());
+    }
+    return index - 1;
+}
+
+uint16_t Logger::clientKey(const char* client, size_t len) {
+    // 一个文件通常只有一个客户端 id
+    if (lastClient_ < clientKeys_.size()) {
+        const std::string& last = clientKeys_[lastClient_];
+        if (last.size() == len && memcmp(last.data(), client, len) == 0) return lastClient_;
+    }
+    std::string key(client, len);
+    auto it = clientIndex_.find(key);
+    if (it != clientIndex_.end()) return lastClient_ = it->second;
+    if (clientKeys_.size() >= KS_LOG_MAX_KEYS) return KS_LOG_MAX_KEYS - 1;
+    lastClient_ = static_cast<uint16_t>(clientKeys_.size());
+    clientIndex_[key] = lastClient_;
+    clientKeys_.push_back(key);
+    return lastClient_;
+}
+
+void Logger::flushBlock() {
+    uint32_t count = static_cast<uint32_t>(blockTimes_.size());
+    if (count == 0) return;
+    KsLogBlock b;
+    memset(&b, 0, sizeof(b));
+    b.magic = KS_LOG_BLOCK_MAGIC;
+    b.kind = KS_LOG_BLOCK_KERNELS;
+    b.count = count;
+    b.bytes = static_cast<uint32_t>(ks_log_kernel_block_bytes(count));
+    b.base_ns = blockBaseNs_;
+    fileStream_.write(reinterpret_cast<const char*>(&b), sizeof(b));
+    fileStream_.write(reinterpret_cast<const char*>(blockTimes_.data()), count * sizeof(uint32_t));
+    fileStream_.write(reinterpret_cast<const char*>(blockKernels_.data()), count * sizeof(uint16_t));
+    fileStream_.write(reinterpret_cast<const char*>(blockClients_.data()), count * sizeof(uint16_t));
+    static const char zeros[8] = {};
+    fileStream_.write(zeros, b.bytes - ks_log_clients_offset(count) - count * sizeof(uint16_t));
+    blockTimes_.clear();
+    blockKernels_.clear();
+    blockClients_.clear();
+}
+
+void Logger::appendText(const char* data, size_t len) {
+    if (isClosed_ || !fileStream_.is_open()) return;
+    // 先写出之前的 kernel 记录, 保持文件中的先后顺序
+    flushBlock();
+    uint64_t now = steadyNs();
+    KsLogBlock b;
+    memset(&b, 0, sizeof(b));
+    b.magic = KS_LOG_BLOCK_MAGIC;
+    b.kind = KS_LOG_BLOCK_TEXT;
+    b.count = static_cast<uint32_t>(len);
+    b.bytes = static_cast<uint32_t>(ks_log_align(sizeof(b) + len));
+    b.base_ns = now > startNs_ ? now - startNs_ : 0;
+    fileStream_.write(reinterpret_cast<const char*>(&b), sizeof(b));
+    fileStream_.write(data, len);
+    static const char zeros[8] = {};
+    fileStream_.write(zeros, b.bytes - sizeof(b) - len);
+}
+
+void Logger::finalizeBinary() {
+    flushBlock();
+    KsLogHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, KS_LOG_MAGIC, sizeof(h.magic));
+    h.version = KS_LOG_VERSION;
+    h.block_records = KS_LOG_BLOCK_RECORDS;
+    h.start_ns = startNs_;
+    h.start_unix_ns = startUnixNs_;
+    h.record_count = records_;
+    h.dropped = static_cast<uint64_t>(dropped_.load());
+    h.names_offset = static_cast<uint64_t>(fileStream_.tellp());
+    h.kernel_count = static_cast<uint32_t>(kernelKeys_.size());
+    h.client_count = static_cast<uint32_t>(clientKeys_.size());
+    strncpy(h.unique_id, id_.c_str(), sizeof(h.unique_id) - 1);
+
+    // 字典: kernel 名称与 hash (来自 KernelTable), 之后是客户端 id
+    for (uint32_t kid : kernelKeys_) {
+        const char* name = KernelTable::instance().name(kid);
+        KsLogName n = {KernelTable::instance().hash(kid), static_cast<uint16_t>(strnlen(name, UINT16_MAX))};
+        fileStream_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        fileStream_.write(name, n.len);
+    }
+    for (const std::string& c : clientKeys_) {
+        KsLogName n = {0, static_cast<uint16_t>(std::min<size_t>(c.size(), UINT16_MAX))};
+        fileStream_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        fileStream_.write(c.data(), n.len);
+    }
+    fileStream_.seekp(0);
+    fileStream_.write(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+void Logger::flushFromWriter() {
+    std::lock_guard<std::mutex> lock(opMutex_);
+    if (dirty_ && !isClosed_ && fileStream_.is_open()) {
+        fileStream_.flush();
+    }
+    dirty_ = false;
+}
+
+void Logger::mergeKernelStats(const std::vector<uint64_t>& counts) {
+    std::lock_guard<std::mutex> lock(opMutex_);
+    if (kernelStats_.size() < counts.size()) kernelStats_.resize(counts.size(), 0);
+    for (size_t i = 0; i < counts.size(); i++) {
+        kernelStats_[i] += static_cast<long long>(counts[i]);
+    }
 }
 
 void Logger::kernelIdIncrement() {
@@ -52,6 +294,10 @@ long long Logger::getKernelId() const {
     return kernelId.load();
 }
 
+long long Logger::nextKernelId() {
+    return kernelId.fetch_add(1) + 1;
+}
+
 void Logger::finalize() {
     std::lock_guard<std::mutex> lock(opMutex_);
     
@@ -59,15 +305,30 @@ void Logger::finalize() {
         return;
     }
 
+    if (binary_) {
+        // 统计由 ks_logstat 从记录中得出, 不另写汇总
+        finalizeBinary();
+        fileStream_.close();
+        isClosed_ = true;
+        std::vector<char>().swap(streamBuffer_);
+        return;
+    }
+
     fileStream_ << "\n=======================================================\n";
     fileStream_ << "      SESSION STATISTICS (" << (id_.empty() ? "Global" : id_) << ")\n";
     fileStream_ << "=======================================================\n";
 
-    if (kernelStats_.empty()) {
+    using PairType = std::pair<std::string, long long>;
+    std::vector<PairType> sortedStats;
+    for (size_t id = 0; id < kernelStats_.size(); id++) {
+        if (kernelStats_[id] > 0) {
+            sortedStats.emplace_back(KernelTable::instance().name(static_cast<uint32_t>(id)), kernelStats_[id]);
+        }
+    }
+
+    if (sortedStats.empty()) {
         fileStream_ << "No kernels executed.\n";
     } else {
-        using PairType = std::pair<std::string, long long>;
-        std::vector<PairType> sortedStats(kernelStats_.begin(), kernelStats_.end());
 
         std::sort(sortedStats.begin(), sortedStats.end(), 
             [](const PairType& a, const PairType& b) {
@@ -85,11 +346,16 @@ void Logger::finalize() {
         fileStream_ << "---------------------------------------------------|--------\n";
         fileStream_ << std::left << std::setw(50) << "TOTAL KERNEL CALLS" << " | " << total << "\n";
     }
+    long long dropped = dropped_.load();
+    if (dropped > 0) {
+        fileStream_ << "Dropped log records (async queue full): " << dropped << "\n";
+    }
     fileStream_ << "=======================================================\n";
     
     fileStream_.flush();
     fileStream_.close();
     isClosed_ = true;
+    std::vector<char>().swap(streamBuffer_);
 }
 
 // ==========================================
@@ -101,13 +367,24 @@ LogManager& LogManager::instance() {
     return instance;
 }
 
-std::shared_ptr<Logger> LogManager::getLogger(const std::string& unique_id) {
+// finalize 需要 KernelTable 的名称, 先构造它以保证它比 LogManager 晚析构
+LogManager::LogManager() {
+    KernelTable::instance();
+}
+
+void LogManager::configure(const LogOptions& options) {
+    std::lock_guard<std::mutex> lock(managerMutex_);
+    options_ = options;
+}
+
+std::shared_ptr<Logger> LogManager::acquireLogger(const std::string& unique_id) {
     std::lock_guard<std::mutex> lock(managerMutex_);
 
-    // 1. 如果 Logger 已存在，直接返回
+    // 1. 如果 Logger 已存在，登记使用者后返回
     auto it = activeLoggers_.find(unique_id);
     if (it != activeLoggers_.end()) {
-        return it->second;
+        it->second.users++;
+        return it->second.logger;
     }
 
     // 2. 如果当前没有活跃的 Logger (0 -> 1)，初始化新目录
@@ -115,9 +392,17 @@ std::shared_ptr<Logger> LogManager::getLogger(const std::string& unique_id) {
         initDirectory();
     }
 
-    // 3. 创建新的 Logger
-    std::shared_ptr<Logger> newLogger(new Logger(unique_id, currentSessionDir_));
-    activeLoggers_[unique_id] = newLogger;
+    // 3. 创建新的 Logger, 异步模式下按需启动后台写线程
+    bool async = options_.mode == LogMode::Async;
+    if (async && !writerRunning_.load()) {
+        writerRunning_.store(true);
+        writer_ = std::thread(&LogManager::writerLoop, this);
+    }
+    std::shared_ptr<Logger> newLogger(new Logger(unique_id, currentSessionDir_, async,
+                                                 options_.format == LogFormat::Binary));
+    LoggerEntry& entry = activeLoggers_[unique_id];
+    entry.logger = newLogger;
+    entry.users = 1;
 
     return newLogger;
 }
@@ -132,24 +417,113 @@ long long LogManager::getSessionId() {
     return sessionId_.load();
 }
 
-void LogManager::removeLogger(const std::string& unique_id) {
+void LogManager::releaseLogger(const std::string& unique_id) {
     std::lock_guard<std::mutex> lock(managerMutex_);
     
     auto it = activeLoggers_.find(unique_id);
-    if (it != activeLoggers_.end()) {
-        it->second->finalize();
-        activeLoggers_.erase(it);
+    if (it == activeLoggers_.end() || --it->second.users > 0) return;
+    if (it->second.logger->async_) {
+        retiring_.push_back(it->second.logger);
+    } else {
+        it->second.logger->finalize();
     }
+    activeLoggers_.erase(it);
 }
 
 LogManager::~LogManager() {
+    // 先停止后台线程: 它退出前会排空所有队列并 finalize 待退役的 Logger
+    if (writerRunning_.exchange(false) && writer_.joinable()) {
+        writer_.join();
+    }
     std::lock_guard<std::mutex> lock(managerMutex_);
     for (auto& pair : activeLoggers_) {
-        pair.second->finalize();
+        pair.second.logger->finalize();
     }
     activeLoggers_.clear();
 }
 
+// ==========================================
+// 异步写入 (线程本地无锁环形队列 + 后台写线程)
+// ==========================================
+
+LogRing* LogManager::threadRing() {
+    // 队列由 LogManager 持有, 线程退出后仍保留, 以保证未消费的记录不会丢失
+    static thread_local LogRing* ring = nullptr;
+    if (!ring) {
+        std::unique_ptr<LogRing> r(new LogRing());
+        ring = r.get();
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings_.push_back(std::move(r));
+    }
+    return ring;
+}
+
+void LogManager::enqueue(Logger* logger, const char* data, size_t len, uint32_t flags) {
+    LogRing* ring = threadRing();
+    LogRecord* rec = ring->claim();
+    while (!rec) {
+        if (options_.overflow == LogOverflow::Drop || !writerRunning_.load(std::memory_order_relaxed)) {
+            logger->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        sched_yield();
+        rec = ring->claim();
+    }
+    if (len > sizeof(rec->text)) len = sizeof(rec->text);
+    rec->logger = logger;
+    rec->len = static_cast<uint32_t>(len) | flags;
+    memcpy(rec->text, data, len);
+    ring->publish();
+}
+
+// 排空所有线程的队列, 返回是否写入了数据
+bool LogManager::drainRings() {
+    std::vector<LogRing*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        for (auto& r : rings_) snapshot.push_back(r.get());
+    }
+
+    std::vector<Logger*> touched;
+    for (LogRing* ring : snapshot) {
+        LogRecord* rec;
+        while ((rec = ring->front()) != nullptr) {
+            if (rec->len & LOG_RECORD_KERNEL) {
+                rec->logger->appendKernelFromWriter(rec->text, rec->len & ~LOG_RECORD_KERNEL);
+            } else {
+                rec->logger->appendFromWriter(rec->text, rec->len);
+            }
+            if (touched.empty() || touched.back() != rec->logger) touched.push_back(rec->logger);
+            ring->pop();
+        }
+    }
+    for (Logger* l : touched) {
+        l->flushFromWriter();
+    }
+    return !touched.empty();
+}
+
+void LogManager::writerLoop() {
+    for (;;) {
+        bool stopping = !writerRunning_.load();
+
+        // 先取出待退役列表再排空队列: 最后一次 releaseLogger 之前写入的记录此时一定可见,
+        // 之后不会再有指向它的记录, finalize 后即可释放
+        std::vector<std::shared_ptr<Logger>> retiring;
+        {
+            std::lock_guard<std::mutex> lock(managerMutex_);
+            retiring.swap(retiring_);
+        }
+        bool wrote = drainRings();
+        for (auto& l : retiring) {
+            l->finalize();
+        }
+
+        if (stopping) break;
+        if (!wrote && retiring.empty()) usleep(1000);
+    }
+}
+
 // 调用者已持有锁
 void LogManager::initDirectory() {
 #ifdef _WIN32
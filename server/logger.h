@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ring.h"
+
 #include <string>
 #include <mutex>
 #include <fstream>
@@ -8,9 +10,34 @@
 #include <memory>
 #include <atomic>
 #include <vector>
+#include <thread>
 
 class LogManager;
 
+// 日志写入方式
+enum class LogMode {
+    Sync,    // 调用线程直接写文件并 flush (原有行为)
+    Async,   // 调用线程写入本线程的无锁环形队列, 由后台线程批量落盘
+};
+
+// 异步模式下环形队列满时的处理
+enum class LogOverflow {
+    Drop,    // 丢弃并计数, 会话结束时写入统计
+    Block,   // 等待后台线程腾出空间
+};
+
+// 每个客户端 kernel 日志的格式
+enum class LogFormat {
+    Text,    // process_<id>.log, 每个 kernel 一行 (原有行为)
+    Binary,  // process_<id>.kslog, 按列存放的定长记录, 布局见 log_format.h, 由 ks_logstat 分析
+};
+
+struct LogOptions {
+    LogMode mode = LogMode::Sync;              // 原有行为; 异步需显式开启
+    LogOverflow overflow = LogOverflow::Block; // 丢弃记录需显式选择 drop
+    LogFormat format = LogFormat::Text;
+};
+
 /**
  * @brief 负责单个 Session/Client 的日志写入和统计
  * 每个客户端连接对应一个 Logger 实例
@@ -24,30 +51,84 @@ public:
 
     // 核心功能
     void write(const std::string& message);
-    void recordKernelStat(const std::string& kernelType);
+    void write(const char* data, size_t len);
+    // 记录一条已裁决的 kernel (seenNs 为首次取到请求的时间, steady_clock);
+    // 文本格式写一行 "Kernel N: <name> from <client>", 二进制格式追加一条记录
+    void kernel(uint32_t kernelId, const char* client, size_t clientLen, uint64_t seenNs);
+    // 会话结束时合并该会话按 kernel id 计数的统计 (下标见 KernelTable)
+    void mergeKernelStats(const std::vector<uint64_t>& counts);
     void kernelIdIncrement();
     long long getKernelId() const;
-    
+    // 递增并返回新的 kernel 序号
+    long long nextKernelId();
+
     // 显式关闭，通常由 Manager 调用，或者析构时自动调用
     void finalize();
 
 private:
     // 仅允许 LogManager 创建 Logger 实例
     friend class LogManager;
-    Logger(const std::string& id, const std::string& dirPath);
+    Logger(const std::string& id, const std::string& dirPath, bool async, bool binary);
+
+    // 异步模式: 由后台写线程调用, 只写入流缓冲区, 不 flush
+    void appendFromWriter(const char* data, size_t len);
+    void appendKernelFromWriter(const char* entry, size_t len);
+    void flushFromWriter();
+
+    // 二进制格式, 调用者持有 opMutex_; 记录先攒在当前块的各列中, 块满、遇到文本行或关闭时写出
+    void appendKernel(uint64_t seenNs, uint32_t kernelId, const char* client, size_t clientLen);
+    void appendText(const char* data, size_t len);
+    void flushBlock();
+    void finalizeBinary();
+    uint16_t kernelKey(uint32_t kernelId);
+    uint16_t clientKey(const char* client, size_t len);
 
 private:
     const std::string id_;
     const std::string dirPath_;
+    const bool async_;
+    const bool binary_;
     std::ofstream fileStream_;
+    std::vector<char> streamBuffer_;   // 异步模式下的大块写缓冲
     std::mutex opMutex_;
     bool isClosed_ = false;
+    bool dirty_ = false;
     std::atomic<long long> kernelId{0};
+    std::atomic<long long> dropped_{0};
 
-    // 统计数据
-    std::map<std::string, long long> kernelStats_;
+    // 统计数据, 下标为 KernelTable 中的 kernel id
+    std::vector<long long> kernelStats_;
+
+    // 二进制格式的状态
+    uint64_t startNs_ = 0;
+    int64_t startUnixNs_ = 0;
+    uint64_t records_ = 0;
+    uint64_t blockBaseNs_ = 0;
+    std::vector<uint32_t> blockTimes_;
+    std::vector<uint16_t> blockKernels_;
+    std::vector<uint16_t> blockClients_;
+    std::vector<uint16_t> kernelIndex_;       // KernelTable id -> 文件内字典下标 + 1, 0 表示尚未出现
+    std::vector<uint32_t> kernelKeys_;        // 文件内字典下标 -> KernelTable id
+    std::vector<std::string> clientKeys_;
+    std::unordered_map<std::string, uint16_t> clientIndex_;
+    uint16_t lastClient_ = 0;
+};
+
+// 异步日志记录: 定长, 直接在线程本地环形队列的槽位内构造
+constexpr size_t LOG_RECORD_SIZE = 512;
+constexpr size_t LOG_RING_CAPACITY = 2048;   // 每个写日志的线程 1 MB
+
+struct LogRecord {
+    Logger* logger;
+    uint32_t len;
+    char text[LOG_RECORD_SIZE - sizeof(Logger*) - sizeof(uint32_t)];
 };
 
+// LogRecord::len 的最高位: text 中是一条二进制格式的 kernel 记录 (见 Logger::kernel), 而不是文本行
+constexpr uint32_t LOG_RECORD_KERNEL = 1u << 31;
+
+using LogRing = SpscRing<LogRecord, LOG_RING_CAPACITY>;
+
 /**
  * @brief 全局日志管理器 (单例)
  * 负责目录创建逻辑 (0->1) 和 Logger 生命周期的管理
@@ -56,26 +137,50 @@ class LogManager {
 public:
     static LogManager& instance();
 
-    // 获取或创建一个指定 ID 的 Logger
+    // 在创建任何 Logger 之前调用
+    void configure(const LogOptions& options);
+
+    // 获取或创建一个指定 ID 的 Logger, 并登记一个使用者 (多个会话可能共用同一 unique_id, 如 TP 的各个 rank)
     // 如果这是第一个连接，会自动初始化目录
-    std::shared_ptr<Logger> getLogger(const std::string& unique_id);
+    std::shared_ptr<Logger> acquireLogger(const std::string& unique_id);
 
     void sessionIdIncrement();
     long long getSessionId();
 
-    // 当客户端断开连接时调用，触发统计写入并释放资源
-    void removeLogger(const std::string& unique_id);
+    // 每次 acquireLogger 对应一次调用; 最后一个使用者释放时触发统计写入并释放资源
+    // 异步模式下统计在后台线程写完该 Logger 之前的所有记录之后写入
+    void releaseLogger(const std::string& unique_id);
 
 private:
-    LogManager() = default;
-    ~LogManager(); // 析构时会关闭所有剩余 Logger
+    friend class Logger;
+
+    LogManager();
+    ~LogManager(); // 析构时会排空异步队列并关闭所有剩余 Logger
 
     void initDirectory();
     std::string generateTimeStr();
 
+    // 异步模式
+    void enqueue(Logger* logger, const char* data, size_t len, uint32_t flags = 0);
+    LogRing* threadRing();
+    void writerLoop();
+    bool drainRings();
+
 private:
     mutable std::mutex managerMutex_;
-    std::unordered_map<std::string, std::shared_ptr<Logger>> activeLoggers_;
+    struct LoggerEntry {
+        std::shared_ptr<Logger> logger;
+        size_t users = 0;
+    };
+    std::unordered_map<std::string, LoggerEntry> activeLoggers_;
     std::string currentSessionDir_;
     std::atomic<long long> sessionId_{0};
-};
\ No newline at end of file
+    LogOptions options_;
+
+    // 异步模式: 每个写日志的线程一个环形队列, 由唯一的后台线程消费
+    std::mutex ringsMutex_;
+    std::vector<std::unique_ptr<LogRing>> rings_;
+    std::thread writer_;
+    std::atomic<bool> writerRunning_{false};
+    std::vector<std::shared_ptr<Logger>> retiring_;   // 等待后台线程写完后 finalize
+};
@@ -0,0 +1,368 @@
+// ks_logstat: 离线分析 --log-format binary 写出的 .kslog 文件 (布局见 log_format.h)
+// 只读 mmap 每个文件, 按列扫描记录, 输出各客户端的速率、各 kernel 的次数与到达间隔分布
+
+#include "log_format.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+constexpr uint32_t GAP_BUCKETS = 40;   // 到达间隔直方图, 第 i 桶为 [2^(i-1), 2^i) ns
+
+struct LogStatOptions {
+    unsigned kernels = 20;     // 显示次数最多的 kernel 数
+    bool hist = false;         // 输出全部记录的到达间隔直方图
+    std::vector<std::string> paths;
+};
+
+// 一个文件中的一个客户端 id
+struct ClientStat {
+    std::string uniqueId;
+    std::string client;
+    std::string file;
+    uint64_t count = 0;
+    uint64_t firstNs = UINT64_MAX;
+    uint64_t lastNs = 0;
+    uint64_t dropped = 0;      // 所在文件的丢弃数, 只记在文件的第一个客户端上
+};
+
+// 按 kernel hash 合并所有文件
+struct KernelStat {
+    std::string name;
+    uint64_t count = 0;
+    uint64_t gaps[GAP_BUCKETS] = {};
+};
+
+struct Totals {
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    uint64_t texts = 0;        // 文本块 (如发送超时)
+    uint64_t firstNs = UINT64_MAX;
+    uint64_t lastNs = 0;
+    uint64_t gaps[GAP_BUCKETS] = {};
+};
+
+static void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options] <file.kslog|dir>...\n"
+              << "  --kernels <n>      显示次数最多的前 n 个 kernel (默认 20, 0 表示全部)\n"
+              << "  --hist             输出全部记录的到达间隔直方图\n"
+              << "  -h, --help         显示帮助\n"
+              << "目录中的 *.kslog 全部参与统计, 例如 logs/2025-01-01_00-00-00\n";
+}
+
+static bool parseOptions(int argc, char** argv, LogStatOptions& opts) {
+    enum { OPT_KERNELS = 256, OPT_HIST };
+    static const struct option longOpts[] = {
+        {"kernels", required_argument, nullptr, OPT_KERNELS},
+        {"hist",    no_argument,       nullptr, OPT_HIST},
+        {"help",    no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOpts, nullptr)) != -1) {
+        char* end = nullptr;
+        bool ok = true;
+        switch (c) {
+        case OPT_KERNELS:
+            opts.kernels = strtoul(optarg, &end, 10);
+            ok = optarg[0] && !*end;
+            break;
+        case OPT_HIST:
+            opts.hist = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return false;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            std::cerr << "[LogStat] Invalid argument for option " << argv[optind - 1] << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    for (int i = optind; i < argc; i++) opts.paths.push_back(argv[i]);
+    if (opts.paths.empty()) {
+        printUsage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static bool hasSuffix(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// 展开目录, 按文件名排序
+static std::vector<std::string> expandPaths(const std::vector<std::string>& paths) {
+    std::vector<std::string> files;
+    for (const std::string& p : paths) {
+        struct stat st;
+        if (stat(p.c_str(), &st) != 0) {
+            std::cerr << "[LogStat] Cannot stat " << p << ": " << strerror(errno) << std::endl;
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            files.push_back(p);
+            continue;
+        }
+        DIR* dir = opendir(p.c_str());
+        if (!dir) continue;
+        std::vector<std::string> found;
+        while (struct dirent* e = readdir(dir)) {
+            std::string name = e->d_name;
+            if (hasSuffix(name, ".kslog")) found.push_back(p + "/" + name);
+        }
+        closedir(dir);
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    return files;
+}
+
+static uint32_t gapBucket(uint64_t ns) {
+    uint32_t b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return b < GAP_BUCKETS ? b : GAP_BUCKETS - 1;
+}
+
+// 直方图的分位数, 取所在桶的上界
+static uint64_t histPercentile(const uint64_t* hist, double p) {
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < GAP_BUCKETS; b++) total += hist[b];
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * (total - 1));
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < GAP_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) return b ? (1ULL << b) - 1 : 0;
+    }
+    return 0;
+}
+
+static std::string formatNs(double ns) {
+    char buf[32];
+    if (ns >= 1e9) snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    else if (ns >= 1e6) snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else if (ns >= 1e3) snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else snprintf(buf, sizeof(buf), "%.0fns", ns);
+    return buf;
+}
+
+// 读取字典; 文件未正常关闭时没有字典, 返回 false
+static bool readNames(const char* base, size_t size, const KsLogHeader& h,
+                      std::vector<std::pair<uint64_t, std::string>>& kernels, std::vector<std::string>& clients) {
+    if (h.names_offset == 0 || h.names_offset > size) return false;
+    size_t off = h.names_offset;
+    for (uint32_t i = 0; i < h.kernel_count + h.client_count; i++) {
+        if (off + sizeof(KsLogName) > size) return false;
+        KsLogName n;
+        memcpy(&n, base + off, sizeof(n));
+        off += sizeof(n);
+        if (off + n.len > size) return false;
+        std::string name(base + off, n.len);
+        off += n.len;
+        uint64_t hash = n.hash;
+        if (i < h.kernel_count) kernels.push_back(std::make_pair(hash, name));
+        else clients.push_back(name);
+    }
+    return true;
+}
+
+static bool analyzeFile(const std::string& path, std::map<std::string, KernelStat>& kernels,
+                        std::vector<ClientStat>& clients, Totals& totals) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[LogStat] Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(KsLogHeader)) {
+        std::cerr << "[LogStat] " << path << " is not a kernel log" << std::endl;
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "[LogStat] Cannot map " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    const char* base = static_cast<const char*>(map);
+    KsLogHeader h;
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, KS_LOG_MAGIC, sizeof(h.magic)) != 0 || h.version != KS_LOG_VERSION) {
+        std::cerr << "[LogStat] " << path << " is not a kernel log (or has an unsupported version)" << std::endl;
+        munmap(map, size);
+        return false;
+    }
+    std::string uniqueId(h.unique_id, strnlen(h.unique_id, sizeof(h.unique_id)));
+
+    std::vector<std::pair<uint64_t, std::string>> kernelNames;
+    std::vector<std::string> clientNames;
+    bool complete = readNames(base, size, h, kernelNames, clientNames);
+    if (!complete) {
+        std::cerr << "[LogStat] " << path << " was not closed cleanly, kernel and client names are unknown" << std::endl;
+    }
+
+    // 按文件内的字典下标统计, 最后再按 hash 合并, 扫描时不做查找
+    std::vector<KernelStat> local(complete ? kernelNames.size() : KS_LOG_MAX_KEYS);
+    std::vector<uint64_t> lastSeen(local.size(), UINT64_MAX);
+    std::vector<ClientStat> fileClients(complete ? clientNames.size() : KS_LOG_MAX_KEYS);
+    uint64_t prevNs = UINT64_MAX;
+    uint64_t records = 0;
+
+    size_t end = complete ? h.names_offset : size;
+    size_t off = sizeof(KsLogHeader);
+    while (off + sizeof(KsLogBlock) <= end) {
+        KsLogBlock b;
+        memcpy(&b, base + off, sizeof(b));
+        // 异常退出时最后一块可能不完整
+        if (b.magic != KS_LOG_BLOCK_MAGIC || b.bytes < sizeof(b) || off + b.bytes > end) break;
+        if (b.kind == KS_LOG_BLOCK_TEXT) {
+            totals.texts++;
+        } else if (b.kind == KS_LOG_BLOCK_KERNELS && ks_log_kernel_block_bytes(b.count) <= b.bytes) {
+            const char* block = base + off;
+            const uint32_t* times = reinterpret_cast<const uint32_t*>(block + sizeof(KsLogBlock));
+            const uint16_t* kids = reinterpret_cast<const uint16_t*>(block + ks_log_kernels_offset(b.count));
+            const uint16_t* cids = reinterpret_cast<const uint16_t*>(block + ks_log_clients_offset(b.count));
+            uint64_t blockNs = h.start_ns + b.base_ns;
+            for (uint32_t i = 0; i < b.count; i++) {
+                uint64_t t = blockNs + times[i];
+                uint16_t k = kids[i];
+                uint16_t c = cids[i];
+                if (k >= local.size() || c >= fileClients.size()) continue;
+                KernelStat& ks = local[k];
+                ks.count++;
+                // 时间可能不单调 (同一 unique_id 的多个会话), 倒退的间隔不计入
+                if (lastSeen[k] != UINT64_MAX && t >= lastSeen[k]) ks.gaps[gapBucket(t - lastSeen[k])]++;
+                lastSeen[k] = t;
+                if (prevNs != UINT64_MAX && t >= prevNs) totals.gaps[gapBucket(t - prevNs)]++;
+                prevNs = t;
+                ClientStat& cs = fileClients[c];
+                cs.count++;
+                cs.firstNs = std::min(cs.firstNs, t);
+                cs.lastNs = std::max(cs.lastNs, t);
+            }
+            records += b.count;
+        }
+        off += b.bytes;
+    }
+
+    for (size_t k = 0; k < local.size(); k++) {
+        if (local[k].count == 0) continue;
+        std::string key;
+        if (complete) {
+            char hash[24];
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)kernelNames[k].first);
+            key = hash;
+            local[k].name = kernelNames[k].second;
+        } else {
+            key = path + "#" + std::to_string(k);
+            local[k].name = "(unknown #" + std::to_string(k) + " in " + uniqueId + ")";
+        }
+        KernelStat& ks = kernels[key];
+        if (ks.name.empty()) ks.name = local[k].name;
+        ks.count += local[k].count;
+        for (uint32_t b = 0; b < GAP_BUCKETS; b++) ks.gaps[b] += local[k].gaps[b];
+    }
+    bool first = true;
+    for (size_t c = 0; c < fileClients.size(); c++) {
+        ClientStat& cs = fileClients[c];
+        if (cs.count == 0) continue;
+        cs.uniqueId = uniqueId;
+        cs.client = complete ? clientNames[c] : "#" + std::to_string(c);
+        cs.file = path;
+        if (first) cs.dropped = h.dropped;
+        first = false;
+        totals.firstNs = std::min(totals.firstNs, cs.firstNs);
+        totals.lastNs = std::max(totals.lastNs, cs.lastNs);
+        clients.push_back(cs);
+    }
+    totals.records += records;
+    totals.bytes += size;
+    totals.files++;
+    munmap(map, size);
+    return true;
+}
+
+static void printHistogram(const uint64_t* hist) {
+    uint64_t total = 0, peak = 0;
+    uint32_t lo = GAP_BUCKETS, hi = 0;
+    for (uint32_t b = 0; b < GAP_BUCKETS; b++) {
+        if (!hist[b]) continue;
+        total += hist[b];
+        peak = std::max(peak, hist[b]);
+        lo = std::min(lo, b);
+        hi = b;
+    }
+    if (total == 0) return;
+    printf("\n%-22s %12s %7s\n", "INTER-ARRIVAL", "COUNT", "SHARE");
+    for (uint32_t b = lo; b <= hi; b++) {
+        std::string range = "[" + formatNs(b ? static_cast<double>(1ULL << (b - 1)) : 0) + ", " +
+                            formatNs(static_cast<double>(1ULL << b)) + ")";
+        printf("%-22s %12llu %6.2f%% %s\n", range.c_str(), (unsigned long long)hist[b], 100.0 * hist[b] / total,
+               std::string(static_cast<size_t>(40.0 * hist[b] / peak), '#').c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    LogStatOptions opts;
+    if (!parseOptions(argc, argv, opts)) return 1;
+
+    std::vector<std::string> files = expandPaths(opts.paths);
+    std::map<std::string, KernelStat> kernels;
+    std::vector<ClientStat> clients;
+    Totals totals;
+    for (const std::string& f : files) analyzeFile(f, kernels, clients, totals);
+    if (totals.files == 0) {
+        std::cerr << "[LogStat] No kernel logs found" << std::endl;
+        return 1;
+    }
+
+    double span = totals.lastNs > totals.firstNs ? (totals.lastNs - totals.firstNs) / 1e9 : 0;
+    printf("%llu files, %llu kernel records, %.1f MB (%.1f bytes/record), span %.3fs",
+           (unsigned long long)totals.files, (unsigned long long)totals.records, totals.bytes / 1e6,
+           totals.records ? static_cast<double>(totals.bytes) / totals.records : 0.0, span);
+    if (totals.texts) printf(", %llu text lines", (unsigned long long)totals.texts);
+    printf("\n\n");
+
+    // 各客户端: 首末两条记录之间的平均速率
+    printf("%-16s %-10s %12s %10s %12s %9s\n", "UNIQUE_ID", "CLIENT", "KERNELS", "SPAN(s)", "RATE(/s)", "DROPPED");
+    for (const ClientStat& c : clients) {
+        double secs = c.lastNs > c.firstNs ? (c.lastNs - c.firstNs) / 1e9 : 0;
+        printf("%-16.16s %-10.10s %12llu %10.3f %12.0f %9llu\n", c.uniqueId.c_str(), c.client.c_str(),
+               (unsigned long long)c.count, secs, secs > 0 ? c.count / secs : 0.0, (unsigned long long)c.dropped);
+    }
+
+    std::vector<const KernelStat*> sorted;
+    for (const auto& kv : kernels) sorted.push_back(&kv.second);
+    std::sort(sorted.begin(), sorted.end(), [](const KernelStat* a, const KernelStat* b) { return a->count > b->count; });
+    printf("\n%-64s %12s %7s %10s %9s %9s\n", "KERNEL", "COUNT", "SHARE", "RATE(/s)", "GAP_P50", "GAP_P99");
+    for (size_t i = 0; i < sorted.size() && (opts.kernels == 0 || i < opts.kernels); i++) {
+        const KernelStat& k = *sorted[i];
+        printf("%-64.64s %12llu %6.2f%% %10.0f %9s %9s\n", k.name.c_str(), (unsigned long long)k.count,
+               100.0 * k.count / totals.records, span > 0 ? k.count / span : 0.0,
+               formatNs(static_cast<double>(histPercentile(k.gaps, 0.5))).c_str(),
+               formatNs(static_cast<double>(histPercentile(k.gaps, 0.99))).c_str());
+    }
+
+    if (opts.hist) printHistogram(totals.gaps);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// ============================================================
+//  NUMA 拓扑与内存策略 (直接读取 sysfs / 系统调用, 不依赖 libnuma)
+// ============================================================
+
+constexpr int KS_NUMA_UNKNOWN = -1;
+
+// 解析 "0,2-3" 形式的 CPU/节点列表 (允许 sysfs 文件末尾的换行)
+inline bool ks_parse_cpu_list(const char* s, std::vector<int>& out) {
+    out.clear();
+    const char* p = s;
+    while (*p && *p != '\n') {
+        char* end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) return false;
+            p = end;
+        }
+        for (long c = first; c <= last; c++) out.push_back(static_cast<int>(c));
+        if (*p == ',') p++;
+        else if (*p && *p != '\n') return false;
+    }
+    return !out.empty();
+}
+
+inline std::string ks_read_sysfs_line(const std::string& path) {
+    char buf[4096];
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return std::string();
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return buf;
+}
+
+// 在线的 NUMA 节点; 没有 NUMA 信息时视为单个节点 0
+inline std::vector<int> ks_numa_online_nodes() {
+    std::vector<int> nodes;
+    if (!ks_parse_cpu_list(ks_read_sysfs_line("/sys/devices/system/node/online").c_str(), nodes)) nodes.assign(1, 0);
+    return nodes;
+}
+
+inline std::vector<int> ks_numa_node_cpus(int node) {
+    std::vector<int> cpus;
+    ks_parse_cpu_list(ks_read_sysfs_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").c_str(), cpus);
+    return cpus;
+}
+
+// CPU 所在的节点: /sys/devices/system/cpu/cpuN/ 下的 nodeK 链接
+inline int ks_numa_node_of_cpu(int cpu) {
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* d = opendir(dir.c_str());
+    if (!d) return KS_NUMA_UNKNOWN;
+    int node = KS_NUMA_UNKNOWN;
+    while (struct dirent* e = readdir(d)) {
+        if (strncmp(e->d_name, "node", 4) == 0 && isdigit(static_cast<unsigned char>(e->d_name[4]))) {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+// PCI 设备 (如 GPU, 总线号取自 cudaDeviceGetPCIBusId) 所在的节点, 未知时返回 KS_NUMA_UNKNOWN
+inline int ks_pci_numa_node(const std::string& busId) {
+    std::string id;
+    for (char c : busId) id += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    // CUDA 的总线号有时是 8 位域号 (00000000:3b:00.0), sysfs 中为 4 位
+    if (id.size() > 12 && id.find(':') == 8) id = id.substr(4);
+    std::string v = ks_read_sysfs_line("/sys/bus/pci/devices/" + id + "/numa_node");
+    if (v.empty()) return KS_NUMA_UNKNOWN;
+    int node = atoi(v.c_str());
+    return node >= 0 ? node : KS_NUMA_UNKNOWN;
+}
+
+// 当前进程所在的节点: CPU 亲和性内的 CPU 全部属于同一节点时取该节点, 否则未知
+inline int ks_current_numa_node() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return KS_NUMA_UNKNOWN;
+    int node = KS_NUMA_UNKNOWN;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        int n = ks_numa_node_of_cpu(cpu);
+        if (n == KS_NUMA_UNKNOWN || (node != KS_NUMA_UNKNOWN && n != node)) return KS_NUMA_UNKNOWN;
+        node = n;
+    }
+    return node;
+}
+
+// 把 [addr, addr + len) 之后首次访问的页优先分配在 node 上 (MPOL_PREFERRED).
+// 对共享内存段设置的是段本身的共享策略, 对所有映射它的进程生效; 已分配的页不迁移
+inline bool ks_mbind_preferred(void* addr, size_t len, int node) {
+    const int MPOL_PREFERRED_MODE = 1;
+    const size_t MASK_BITS = 1024;
+    unsigned long mask[MASK_BITS / (8 * sizeof(unsigned long))] = {};
+    if (node < 0 || static_cast<size_t>(node) >= MASK_BITS) return false;
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // maxnode 按内核的约定比位数多 1
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED_MODE, mask, MASK_BITS + 1, 0) == 0;
+}
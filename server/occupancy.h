@@ -0,0 +1,166 @@
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// ============================================================
+//  GPU 占用账本 (每个调度域一个, 域内所有 worker 共享)
+// ============================================================
+//
+// 按 QoS 类别记录:
+//   inflight       已放行、尚未完成的 kernel 数
+//   outstandingNs  这些 kernel 的估计 GPU 时间之和 (代价模型, 无样本的 kernel 计 0)
+//   grantRate      最近一个窗口 (LEDGER_RATE_WINDOW_NS) 内的放行速率, kernel/s
+// 只有上报完成消息的会话参与 inflight/outstandingNs (见 ClientSession::inflight), 放行速率统计所有会话
+// (含租约内发射的 kernel).
+//
+// 写入按 worker 分片: 每个 worker 只写自己的分片 (cache line 对齐, relaxed load + store, 无锁前缀),
+// 读者把所有分片相加; 会话迁移后放行与完成可能记在不同分片上, 单个分片可以为负, 总和正确.
+// 热路径上没有锁, 也不与其他 worker 争用 cache line
+
+constexpr uint32_t LEDGER_CLASSES = 3;                       // KsQosClass 的取值个数
+constexpr uint64_t LEDGER_RATE_WINDOW_NS = 100000000;        // 放行速率的统计窗口 100ms
+constexpr size_t LEDGER_MAX_INFLIGHT = 4096;                 // 每个会话跟踪的在途 kernel 上限, 超出时最早的视为已完成
+constexpr size_t LEDGER_MATCH_WINDOW = 64;                   // 完成记录只在最早的这么多个在途 kernel 中按 reqId 匹配
+
+inline uint32_t ledger_class(uint32_t qosClass) {
+    return qosClass < LEDGER_CLASSES ? qosClass : KS_QOS_DEFAULT;
+}
+
+// 会话的一个在途 kernel, 完成时按 reqId 匹配
+struct InflightKernel {
+    uint64_t reqId;
+    uint64_t costNs;
+};
+
+struct LedgerSnapshot {
+    int64_t inflight[LEDGER_CLASSES];
+    int64_t outstandingNs[LEDGER_CLASSES];
+    uint64_t grantRate[LEDGER_CLASSES];
+};
+
+class OccupancyLedger {
+public:
+    explicit OccupancyLedger(unsigned shards) : count_(shards ? shards : 1) {
+        void* p = nullptr;
+        if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(Shard) * count_) != 0) throw std::bad_alloc();
+        shards_ = static_cast<Shard*>(p);
+        for (unsigned i = 0; i < count_; i++) new (&shards_[i]) Shard();
+    }
+    ~OccupancyLedger() {
+        for (unsigned i = 0; i < count_; i++) shards_[i].~Shard();
+        free(shards_);
+    }
+    OccupancyLedger(const OccupancyLedger&) = delete;
+    OccupancyLedger& operator=(const OccupancyLedger&) = delete;
+
+    // ---- 写入: shard 为调用者 worker 在域内的序号, 每个分片只有一个写者 ----
+
+    // 放行一个 kernel; tracked 表示计入在途 (会话上报完成消息)
+    void grant(unsigned shard, uint32_t qosClass, bool tracked, uint64_t costNs) {
+        Shard& s = shards_[shard];
+        uint32_t c = ledger_class(qosClass);
+        add(s.grants[c], 1);
+        if (tracked) {
+            add(s.inflight[c], 1);
+            add(s.workNs[c], static_cast<int64_t>(costNs));
+        }
+    }
+
+    // 租约内发射了 kernels 个 kernel: 没有 reqId, 只计入放行速率
+    void leased(unsigned shard, uint32_t qosClass, uint64_t kernels) {
+        add(shards_[shard].grants[ledger_class(qosClass)], static_cast<int64_t>(kernels));
+    }
+
+    // kernels 个在途 kernel 已完成 (或会话结束), 其估计时间之和为 workNs
+    void retire(unsigned shard, uint32_t qosClass, uint64_t kernels, uint64_t workNs) {
+        Shard& s = shards_[shard];
+        uint32_t c = ledger_class(qosClass);
+        add(s.inflight[c], -static_cast<int64_t>(kernels));
+        add(s.workNs[c], -static_cast<int64_t>(workNs));
+    }
+
+    // 滚动放行速率的窗口; 任一 worker 可以调用, 每个窗口只有一个调用者成功并返回 true
+    bool tick(uint64_t now) {
+        uint64_t start = windowStartNs_.load(std::memory_order_relaxed);
+        if (start == 0) {
+            windowStartNs_.compare_exchange_strong(start, now, std::memory_order_relaxed);
+            return false;
+        }
+        if (now - start < LEDGER_RATE_WINDOW_NS) return false;
+        if (!windowStartNs_.compare_exchange_strong(start, now, std::memory_order_relaxed)) return false;
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) {
+            uint64_t total = 0;
+            for (unsigned i = 0; i < count_; i++) total += static_cast<uint64_t>(shards_[i].grants[c].load(std::memory_order_relaxed));
+            uint64_t prev = windowGrants_[c].load(std::memory_order_relaxed);
+            windowGrants_[c].store(total, std::memory_order_relaxed);
+            grantRate_[c].store((total - prev) * 1000000000ULL / (now - start), std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // ---- 读取: 各分片之和, 近似一致 ----
+
+    int64_t inflight(uint32_t qosClass) const { return sum(&Shard::inflight, ledger_class(qosClass)); }
+    int64_t outstandingNs(uint32_t qosClass) const { return sum(&Shard::workNs, ledger_class(qosClass)); }
+    uint64_t grantRate(uint32_t qosClass) const {
+        return grantRate_[ledger_class(qosClass)].load(std::memory_order_relaxed);
+    }
+
+    int64_t inflightTotal() const {
+        int64_t n = 0;
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) n += inflight(c);
+        return n;
+    }
+    int64_t outstandingTotalNs() const {
+        int64_t n = 0;
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) n += outstandingNs(c);
+        return n;
+    }
+
+    LedgerSnapshot snapshot() const {
+        LedgerSnapshot s;
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) {
+            s.inflight[c] = inflight(c);
+            s.outstandingNs[c] = outstandingNs(c);
+            s.grantRate[c] = grantRate(c);
+        }
+        return s;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic<int64_t> inflight[LEDGER_CLASSES];
+        std::atomic<int64_t> workNs[LEDGER_CLASSES];
+        std::atomic<int64_t> grants[LEDGER_CLASSES];
+
+        Shard() {
+            for (uint32_t c = 0; c < LEDGER_CLASSES; c++) {
+                inflight[c].store(0, std::memory_order_relaxed);
+                workNs[c].store(0, std::memory_order_relaxed);
+                grants[c].store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // 单写者: 不需要原子读-改-写
+    static void add(std::atomic<int64_t>& v, int64_t d) {
+        v.store(v.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+    }
+
+    int64_t sum(std::atomic<int64_t> (Shard::*field)[LEDGER_CLASSES], uint32_t c) const {
+        int64_t n = 0;
+        for (unsigned i = 0; i < count_; i++) n += (shards_[i].*field)[c].load(std::memory_order_relaxed);
+        return n;
+    }
+
+    Shard* shards_ = nullptr;
+    unsigned count_;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> windowStartNs_{0};
+    std::atomic<uint64_t> windowGrants_[LEDGER_CLASSES] = {};
+    std::atomic<uint64_t> grantRate_[LEDGER_CLASSES] = {};
+};
@@ -0,0 +1,276 @@
+#include "options.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+static void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --wait <spin|adaptive>     请求等待策略 (默认 adaptive)\n"
+              << "  --spin-iters <n>           进入 yield 之前的 pause 自旋次数\n"
+              << "  --yield-iters <n>          进入 futex 休眠之前的 sched_yield 次数\n"
+              << "  --futex-timeout-us <n>     单次 futex 休眠上限 (微秒, 0 表示不设上限)\n"
+              << "  --workers <n>              每个调度域的 worker 线程数 (默认 2)\n"
+              << "  --cpus <list>              worker 绑核列表, 例如 0,2-3\n"
+              << "  --numa                     未指定 --cpus 时把 worker 轮流分配到各 NUMA 节点并绑定到该节点的 CPU\n"
+              << "  --devices <list>           每个 GPU 一个独立的调度域 (策略实例与 worker), 例如 0-7 (默认 0)\n"
+              << "  --log-mode <sync|async>    日志写入方式 (默认 sync; async 为后台线程批量落盘)\n"
+              << "  --log-overflow <drop|block> 异步日志队列满时丢弃并计数或等待 (默认 block)\n"
+              << "  --log-format <text|binary>  每个客户端的 kernel 日志格式 (默认 text; binary 写 .kslog, 用 ks_logstat 分析)\n"
+              << "  --policy <name>            调度策略: slo (默认), always-allow, static-priority, token-bucket, round-robin\n"
+              << "  --qos <id=class[:w],...>   按 unique_id 指定 QoS, class 为 decode 或 prefill, 例如 2=decode:4,1=prefill\n"
+              << "  --decode-gap-us <n>        decode kernel 间隔超过该值视为 decode step 结束 (默认 200)\n"
+              << "  --prefill-max-delay-us <n> 单个 prefill kernel 最长推迟时间 (默认 2000)\n"
+              << "  --decode-tpot-us <n>       decode step 时间预算, 超出后 prefill 完全让路 (默认 0, 不启用)\n"
+              << "  --token-rate <n>           token-bucket: 每单位权重每秒放行的 kernel 数 (默认 20000)\n"
+              << "  --token-burst <n>          token-bucket: 每单位权重的桶容量 (默认 64)\n"
+              << "  --token-cost-us <n>        token-bucket: 按客户端上报的 GPU 时间计费, 一个令牌对应 n 微秒 (默认 0, 按个数)\n"
+              << "  --rr-quantum <n>           round-robin: 每轮放行的 kernel 数 (默认 8)\n"
+              << "  --rr-idle-us <n>           round-robin: 超过该时间无请求的客户端不参与轮转 (默认 200)\n"
+              << "  --lease <n>                放行请求时附带最多 n 个 kernel 的租约, 客户端在额度内不再请求 (默认 0, 不发放)\n"
+              << "  --lease-us <n>             租约的有效期 (默认 1000)\n"
+              << "  --record <file>            把收到的请求流录制为二进制 trace, 供 ks_replay 回放\n"
+              << "  --record-max <n>           最多录制的请求数 (默认 8388608)\n"
+              << "  --timeline <file>          导出调度时间线 (Chrome trace JSON, 可用 ui.perfetto.dev 打开)\n"
+              << "  --hugepages                registry 使用 hugetlbfs 大页 (挂载点 /dev/hugepages, 可用 KS_HUGETLBFS 指定)\n"
+              << "  --no-stats                 不创建实时统计页 (flexmps-top 无法查看)\n"
+              << "  --takeover                 热重启: 接管正在运行的服务端的 registry 与客户端通道, 客户端无需重连\n"
+              << "  -h, --help                 显示帮助\n";
+}
+
+static bool parseUint(const char* s, uint32_t& out) {
+    char* end = nullptr;
+    unsigned long v = strtoul(s, &end, 10);
+    if (!s[0] || *end) return false;
+    out = static_cast<uint32_t>(v);
+    return true;
+}
+
+// 解析 "2=decode:4,1=prefill"
+static bool parseQosList(const char* s, std::map<std::string, ClientQos>& out) {
+    std::string all(s);
+    size_t pos = 0;
+    while (pos <= all.size()) {
+        size_t comma = all.find(',', pos);
+        std::string item = all.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos || eq == 0) return false;
+        std::string id = item.substr(0, eq);
+        std::string cls = item.substr(eq + 1);
+        uint32_t weight = 0;
+        size_t colon = cls.find(':');
+        if (colon != std::string::npos) {
+            if (!parseUint(cls.c_str() + colon + 1, weight) || weight == 0) return false;
+            cls.resize(colon);
+        }
+
+        ClientQos qos;
+        if (cls == "decode") {
+            qos.qosClass = KS_QOS_DECODE;
+        } else if (cls == "prefill") {
+            qos.qosClass = KS_QOS_PREFILL;
+        } else {
+            return false;
+        }
+        qos.weight = weight;
+        out[id] = qos;
+
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    return true;
+}
+
+bool parseOptions(int argc, char** argv, ServerOptions& opts) {
+    enum {
+        OPT_WAIT = 256,
+        OPT_SPIN_ITERS,
+        OPT_YIELD_ITERS,
+        OPT_FUTEX_TIMEOUT,
+        OPT_WORKERS,
+        OPT_CPUS,
+        OPT_NUMA,
+        OPT_DEVICES,
+        OPT_LOG_MODE,
+        OPT_LOG_OVERFLOW,
+        OPT_LOG_FORMAT,
+        OPT_QOS,
+        OPT_DECODE_GAP,
+        OPT_PREFILL_MAX_DELAY,
+        OPT_DECODE_TPOT,
+        OPT_POLICY,
+        OPT_TOKEN_RATE,
+        OPT_TOKEN_BURST,
+        OPT_TOKEN_COST,
+        OPT_RR_QUANTUM,
+        OPT_RR_IDLE,
+        OPT_LEASE,
+        OPT_LEASE_US,
+        OPT_RECORD,
+        OPT_RECORD_MAX,
+        OPT_TIMELINE,
+        OPT_NO_STATS,
+        OPT_HUGEPAGES,
+        OPT_TAKEOVER,
+    };
+    static const struct option longOpts[] = {
+        {"wait",             required_argument, nullptr, OPT_WAIT},
+        {"spin-iters",       required_argument, nullptr, OPT_SPIN_ITERS},
+        {"yield-iters",      required_argument, nullptr, OPT_YIELD_ITERS},
+        {"futex-timeout-us", required_argument, nullptr, OPT_FUTEX_TIMEOUT},
+        {"workers",          required_argument, nullptr, OPT_WORKERS},
+        {"cpus",             required_argument, nullptr, OPT_CPUS},
+        {"numa",             no_argument,       nullptr, OPT_NUMA},
+        {"devices",          required_argument, nullptr, OPT_DEVICES},
+        {"log-mode",         required_argument, nullptr, OPT_LOG_MODE},
+        {"log-overflow",     required_argument, nullptr, OPT_LOG_OVERFLOW},
+        {"log-format",       required_argument, nullptr, OPT_LOG_FORMAT},
+        {"qos",              required_argument, nullptr, OPT_QOS},
+        {"decode-gap-us",    required_argument, nullptr, OPT_DECODE_GAP},
+        {"prefill-max-delay-us", required_argument, nullptr, OPT_PREFILL_MAX_DELAY},
+        {"decode-tpot-us",   required_argument, nullptr, OPT_DECODE_TPOT},
+        {"policy",           required_argument, nullptr, OPT_POLICY},
+        {"token-rate",       required_argument, nullptr, OPT_TOKEN_RATE},
+        {"token-burst",      required_argument, nullptr, OPT_TOKEN_BURST},
+        {"token-cost-us",    required_argument, nullptr, OPT_TOKEN_COST},
+        {"rr-quantum",       required_argument, nullptr, OPT_RR_QUANTUM},
+        {"rr-idle-us",       required_argument, nullptr, OPT_RR_IDLE},
+        {"lease",            required_argument, nullptr, OPT_LEASE},
+        {"lease-us",         required_argument, nullptr, OPT_LEASE_US},
+        {"record",           required_argument, nullptr, OPT_RECORD},
+        {"record-max",       required_argument, nullptr, OPT_RECORD_MAX},
+        {"timeline",         required_argument, nullptr, OPT_TIMELINE},
+        {"no-stats",         no_argument,       nullptr, OPT_NO_STATS},
+        {"hugepages",        no_argument,       nullptr, OPT_HUGEPAGES},
+        {"takeover",         no_argument,       nullptr, OPT_TAKEOVER},
+        {"help",             no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOpts, nullptr)) != -1) {
+        bool ok = true;
+        switch (c) {
+        case OPT_WAIT:
+            if (strcmp(optarg, "spin") == 0) opts.wait.mode = WaitMode::Spin;
+            else if (strcmp(optarg, "adaptive") == 0) opts.wait.mode = WaitMode::Adaptive;
+            else ok = false;
+            break;
+        case OPT_SPIN_ITERS:
+            ok = parseUint(optarg, opts.wait.spinIters);
+            break;
+        case OPT_YIELD_ITERS:
+            ok = parseUint(optarg, opts.wait.yieldIters);
+            break;
+        case OPT_FUTEX_TIMEOUT:
+            ok = parseUint(optarg, opts.wait.futexTimeoutUs);
+            break;
+        case OPT_WORKERS: {
+            uint32_t n = 0;
+            ok = parseUint(optarg, n) && n > 0;
+            opts.workers = n;
+            break;
+        }
+        case OPT_CPUS:
+            ok = ks_parse_cpu_list(optarg, opts.workerCpus);
+            break;
+        case OPT_NUMA:
+            opts.numa = true;
+            break;
+        case OPT_DEVICES:
+            ok = ks_parse_cpu_list(optarg, opts.devices);
+            for (size_t i = 0; ok && i < opts.devices.size(); i++) {
+                ok = std::count(opts.devices.begin(), opts.devices.end(), opts.devices[i]) == 1;
+            }
+            break;
+        case OPT_LOG_MODE:
+            if (strcmp(optarg, "sync") == 0) opts.log.mode = LogMode::Sync;
+            else if (strcmp(optarg, "async") == 0) opts.log.mode = LogMode::Async;
+            else ok = false;
+            break;
+        case OPT_LOG_OVERFLOW:
+            if (strcmp(optarg, "drop") == 0) opts.log.overflow = LogOverflow::Drop;
+            else if (strcmp(optarg, "block") == 0) opts.log.overflow = LogOverflow::Block;
+            else ok = false;
+            break;
+        case OPT_LOG_FORMAT:
+            if (strcmp(optarg, "text") == 0) opts.log.format = LogFormat::Text;
+            else if (strcmp(optarg, "binary") == 0) opts.log.format = LogFormat::Binary;
+            else ok = false;
+            break;
+        case OPT_QOS:
+            ok = parseQosList(optarg, opts.qosOverrides);
+            break;
+        case OPT_DECODE_GAP:
+            ok = parseUint(optarg, opts.policy.slo.decodeGapUs);
+            break;
+        case OPT_PREFILL_MAX_DELAY:
+            ok = parseUint(optarg, opts.policy.slo.prefillMaxDelayUs);
+            break;
+        case OPT_DECODE_TPOT:
+            ok = parseUint(optarg, opts.policy.slo.decodeTpotUs);
+            break;
+        case OPT_POLICY:
+            opts.policy.name = optarg;
+            ok = isKnownPolicy(opts.policy.name);
+            break;
+        case OPT_TOKEN_RATE:
+            ok = parseUint(optarg, opts.policy.tokenRate) && opts.policy.tokenRate > 0;
+            break;
+        case OPT_TOKEN_BURST:
+            ok = parseUint(optarg, opts.policy.tokenBurst) && opts.policy.tokenBurst > 0;
+            break;
+        case OPT_TOKEN_COST:
+            ok = parseUint(optarg, opts.policy.tokenCostUs);
+            break;
+        case OPT_RR_QUANTUM:
+            ok = parseUint(optarg, opts.policy.rrQuantum) && opts.policy.rrQuantum > 0;
+            break;
+        case OPT_RR_IDLE:
+            ok = parseUint(optarg, opts.policy.rrIdleUs);
+            break;
+        case OPT_LEASE:
+            ok = parseUint(optarg, opts.leaseKernels);
+            break;
+        case OPT_LEASE_US:
+            ok = parseUint(optarg, opts.leaseUs) && opts.leaseUs > 0;
+            break;
+        case OPT_RECORD:
+            opts.recordPath = optarg;
+            break;
+        case OPT_RECORD_MAX: {
+            char* end = nullptr;
+            opts.recordMax = strtoull(optarg, &end, 10);
+            ok = optarg[0] && !*end && opts.recordMax > 0;
+            break;
+        }
+        case OPT_TIMELINE:
+            opts.timelinePath = optarg;
+            break;
+        case OPT_NO_STATS:
+            opts.stats = false;
+            break;
+        case OPT_HUGEPAGES:
+            opts.hugePages = true;
+            break;
+        case OPT_TAKEOVER:
+            opts.takeover = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return false;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            std::cerr << "[Main] Invalid argument for option " << argv[optind - 1] << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
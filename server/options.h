@@ -0,0 +1,59 @@
+#pragma once
+
+#include "logger.h"
+#include "policy.h"
+#include "wait_strategy.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+ * @brief 调度服务端的启动参数
+ * 所有字段都有默认值; 日志默认同步写入, 不会丢记录 (与原有行为一致),
+ * 异步日志与丢弃策略需要 --log-mode / --log-overflow 显式开启
+ */
+struct ServerOptions {
+    WaitStrategy wait;
+
+    // 调度 worker 线程池: 每个 worker 轮询一组通道
+    unsigned workers = 2;
+    std::vector<int> workerCpus;   // 为空时不绑核; 否则 worker i 绑定到 workerCpus[i % size]
+    // workerCpus 为空时把 worker 轮流分配到各 NUMA 节点, 绑定到节点内的全部 CPU.
+    // 无论哪种方式, 新会话优先分配给与客户端同节点的 worker
+    bool numa = false;
+
+    // 每个 GPU 一个调度域 (独立的策略实例与 worker 组), 每个域 workers 个 worker;
+    // 客户端按注册时声明的设备号归入对应的域
+    std::vector<int> devices = {0};
+
+    LogOptions log;
+
+    // 调度策略及其参数
+    PolicyOptions policy;
+    // 按 unique_id 覆盖客户端注册的 QoS 声明 (未改造的客户端可借此参与仲裁)
+    std::map<std::string, ClientQos> qosOverrides;
+
+    // 租约 (policy.h): 放行请求时附带的预先放行额度上限与有效期; 0 表示不发放
+    uint32_t leaseKernels = 0;
+    uint32_t leaseUs = 1000;
+
+    // 请求流录制 (trace.h), 为空时不录制
+    std::string recordPath;
+    uint64_t recordMax = 8 << 20;   // 最多录制的请求数, 每条 32 字节
+
+    // 调度时间线 (timeline.h), Chrome trace JSON; 为空时不导出
+    std::string timelinePath;
+
+    // registry 放在 hugetlbfs 上 (segment.h); 通道段的后备存储由各客户端自己选择
+    bool hugePages = false;
+
+    // 热重启 (shm_core.h 中的交接流程): 附着到已有的 registry, 请求旧进程交出后接管全部客户端
+    bool takeover = false;
+
+    // 实时统计页 (stats.h), 供 flexmps-top 查看
+    bool stats = true;
+};
+
+// 解析命令行; 出错或 --help 时打印用法并返回 false
+bool parseOptions(int argc, char** argv, ServerOptions& opts);
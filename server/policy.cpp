@@ -0,0 +1,107 @@
+#include "policy.h"
+
+const char* const POLICY_NAMES[] = {
+    "slo", "always-allow", "static-priority", "token-bucket", "round-robin", nullptr,
+};
+
+bool isKnownPolicy(const std::string& name) {
+    for (const char* const* p = POLICY_NAMES; *p; p++) {
+        if (name == *p) return true;
+    }
+    return false;
+}
+
+int ClientSlots::acquire() {
+    uint64_t used = used_.load(std::memory_order_relaxed);
+    while (~used != 0) {
+        int slot = __builtin_ctzll(~used);
+        if (slot >= POLICY_MAX_SLOTS) break;
+        if (used_.compare_exchange_weak(used, used | (1ULL << slot))) return slot;
+    }
+    return -1;
+}
+
+void ClientSlots::release(int slot) {
+    if (slot >= 0) used_.fetch_and(~(1ULL << slot));
+}
+
+// ------------------------------------------------------------
+//  slo
+// ------------------------------------------------------------
+
+SloPolicy::SloPolicy(const PolicyOptions& options, const OccupancyLedger&) : options_(options.slo) {}
+
+void SloPolicy::onClientJoin(ClientQos& client) {
+    if (client.qosClass == KS_QOS_DECODE) {
+        decodeClients_.fetch_add(1);
+    } else if (client.qosClass == KS_QOS_PREFILL) {
+        prefillWeight_.fetch_add(client.weight);
+    }
+}
+
+void SloPolicy::onClientLeave(ClientQos& client) {
+    if (client.qosClass == KS_QOS_DECODE) {
+        decodeClients_.fetch_sub(1);
+        // 最后一个 decode 客户端离开后 prefill 不再受限
+        epoch_.fetch_add(1, std::memory_order_relaxed);
+    } else if (client.qosClass == KS_QOS_PREFILL) {
+        prefillWeight_.fetch_sub(client.weight);
+    }
+}
+
+// ------------------------------------------------------------
+//  static-priority
+// ------------------------------------------------------------
+
+StaticPriorityPolicy::StaticPriorityPolicy(const PolicyOptions& options, const OccupancyLedger&) : options_(options.slo) {}
+
+// ------------------------------------------------------------
+//  token-bucket
+// ------------------------------------------------------------
+
+TokenBucketPolicy::TokenBucketPolicy(const PolicyOptions& options, const OccupancyLedger&)
+    : rate_(options.tokenRate), burst_(options.tokenBurst ? options.tokenBurst : 1),
+      costUnitNs_(static_cast<uint64_t>(options.tokenCostUs) * 1000) {}
+
+void TokenBucketPolicy::onClientJoin(ClientQos& client) {
+    // 新会话从满桶开始
+    client.tokens = static_cast<int64_t>(burst_) * client.weight * TOKEN_UNIT;
+    client.refillNs = 0;
+}
+
+// ------------------------------------------------------------
+//  round-robin
+// ------------------------------------------------------------
+
+RoundRobinPolicy::RoundRobinPolicy(const PolicyOptions& options, const OccupancyLedger&)
+    : quantum_(options.rrQuantum ? options.rrQuantum : 1),
+      idleNs_(static_cast<uint64_t>(options.rrIdleUs) * 1000) {}
+
+void RoundRobinPolicy::onClientJoin(ClientQos& client) {
+    client.slot = clientSlots_.acquire();
+}
+
+void RoundRobinPolicy::onClientLeave(ClientQos& client) {
+    if (client.slot < 0) return;
+    slots_[client.slot].lastSeenNs.store(0, std::memory_order_relaxed);
+    int turn = client.slot;
+    if (turn_.compare_exchange_strong(turn, -1)) epoch_.fetch_add(1, std::memory_order_relaxed);
+    clientSlots_.release(client.slot);
+    client.slot = -1;
+}
+
+void RoundRobinPolicy::advance(int from, uint64_t now) {
+    for (int i = 1; i < POLICY_MAX_SLOTS; i++) {
+        int next = (from + i) % POLICY_MAX_SLOTS;
+        if (!idle(next, now)) {
+            int expected = from;
+            if (turn_.compare_exchange_strong(expected, next, std::memory_order_acq_rel)) {
+                grants_.store(0, std::memory_order_relaxed);
+                epoch_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+    // 只有一个活跃客户端: 继续持有
+    grants_.store(0, std::memory_order_relaxed);
+}
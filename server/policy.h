@@ -0,0 +1,450 @@
+#pragma once
+
+#include "config.h"
+#include "occupancy.h"
+#include "request.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================
+//  调度策略 (编译期接口)
+// ============================================================
+//
+// 策略作为 Scheduler 的模板参数在编译期实例化, 每个 kernel 的调用可以被内联,
+// 不经过虚函数. 一个策略类型需要提供:
+//
+//   Policy(const PolicyOptions& options, const OccupancyLedger& ledger);
+//   void onClientJoin(ClientQos& client);              // 会话开始, 可初始化 client 中的策略状态
+//   void onClientLeave(ClientQos& client);             // 会话结束
+//   Decision onRequest(const KernelRequest& req, ClientQos& client, uint64_t now);
+//   void onCompletion(ClientQos& client, uint32_t kernelId, uint64_t durationNs);   // 客户端上报的实测耗时
+//   void tick(uint64_t now);                           // 每个 worker 约每 POLICY_TICK_NS 调用一次
+//   uint64_t epoch() const;                            // 可能让被推迟的请求变为可放行的事件 (如配额增加) 发生时递增
+//   uint32_t lease(ClientQos& client, uint64_t now);   // 此刻可以预先放行给 client 的 kernel 数 (租约), 0 表示不发放
+//   void onLeaseUse(ClientQos& client, uint32_t kernels, uint64_t now);   // client 在租约内发射了 kernels 个 kernel
+//   uint64_t leaseEpoch() const;                       // 竞争加剧、已发放的租约可能需要收缩时递增
+//
+// req.costNs 为代价模型对该 kernel 的估计 (0 表示未知), 策略可以按 GPU 时间而不是 kernel 个数计费.
+// 推迟 (Defer) 时在 Decision::retryAtNs 中给出预计可以放行的时间; 只能由其他客户端的活动触发放行时
+// 给 0 并在该活动发生时递增 epoch(). 挂起的请求在二者之一到来时重新裁决, 早于实际可放行的时间只多一次裁决.
+// ledger 是所属调度域的 GPU 占用账本 (occupancy.h, 由调度器维护), 跨客户端的策略可以据此读取
+// 各 QoS 类别的在途 kernel 数、估计的未完成 GPU 时间与放行速率, 读取只是几次 relaxed load.
+// 策略实例由同一调度域的所有 worker 共享, 跨客户端的状态必须是原子变量;
+// ClientQos 只被其会话当前所属的 worker 访问, 可以自由读写
+//
+// 租约 (--lease): 放行声明了 KS_CAP_LEASE 的客户端的请求后, 调度器调用 lease 并把结果 (不超过 --lease) 写入通道,
+// 客户端在额度内发射 kernel 不再请求. 调度器从通道读到的发射数经 onLeaseUse 交给策略, 按同样数量的放行记账
+// (延迟不超过 LEASE_POLL_NS); leaseEpoch 变化时以及每个 tick, 调度器对持有租约的会话重新调用 lease, 结果更小则收缩.
+// lease 可以返回 POLICY_LEASE_UNLIMITED
+
+constexpr uint32_t DEFAULT_DECODE_WEIGHT = 4;
+constexpr uint32_t DEFAULT_PREFILL_WEIGHT = 1;
+constexpr uint64_t POLICY_TICK_NS = 50000;
+constexpr int POLICY_MAX_SLOTS = static_cast<int>(MAX_REGISTERED_CLIENTS);
+constexpr uint32_t POLICY_LEASE_UNLIMITED = UINT32_MAX;
+
+// 客户端在策略中的身份与每客户端状态, 由所属会话持有
+struct ClientQos {
+    uint32_t qosClass = KS_QOS_DEFAULT;
+    uint32_t weight = 1;
+    uint64_t deferSinceNs = 0;   // 队头请求第一次被推迟的时间, 0 表示未推迟
+
+    // 供策略使用的每客户端状态
+    int slot = -1;               // 策略分配的槽位, -1 表示未分配
+    int64_t tokens = 0;          // 令牌桶 (单位: 1/1000 个 kernel)
+    uint64_t refillNs = 0;
+};
+
+struct SloOptions {
+    uint32_t decodeGapUs = 200;          // 距上一个 decode kernel 超过该间隔, 视为 decode step 结束
+    uint32_t prefillMaxDelayUs = 2000;   // 单个 prefill kernel 最长被推迟的时间, 保证 TTFT 有界
+    uint32_t decodeTpotUs = 0;           // decode step 的时间预算, 超出后 prefill 完全让路; 0 表示不启用
+};
+
+struct PolicyOptions {
+    std::string name = "slo";            // 见 POLICY_NAMES
+    SloOptions slo;                      // slo 与 static-priority 共用
+    uint32_t tokenRate = 20000;          // token-bucket: 每单位权重每秒放行的 kernel 数
+    uint32_t tokenBurst = 64;            // token-bucket: 每单位权重的桶容量
+    uint32_t tokenCostUs = 0;            // token-bucket: >0 时按估计的 GPU 时间计费, 一个令牌对应该时长; 0 按个数计费
+    uint32_t rrQuantum = 8;              // round-robin: 每次轮到一个客户端时最多放行的 kernel 数
+    uint32_t rrIdleUs = 200;             // round-robin: 超过该时间没有请求的客户端视为空闲
+};
+
+// 内置策略名称, 以 nullptr 结尾
+extern const char* const POLICY_NAMES[];
+bool isKnownPolicy(const std::string& name);
+
+// 为客户端分配 [0, POLICY_MAX_SLOTS) 中的一个槽位, 供策略按槽位保存跨客户端可见的状态
+class ClientSlots {
+public:
+    int acquire();
+    void release(int slot);
+
+private:
+    static_assert(POLICY_MAX_SLOTS <= 64, "ClientSlots uses a single 64-bit bitmap");
+    std::atomic<uint64_t> used_{0};
+};
+
+// ------------------------------------------------------------
+//  always-allow: 原有行为, 全部放行
+// ------------------------------------------------------------
+class AlwaysAllowPolicy {
+public:
+    AlwaysAllowPolicy(const PolicyOptions&, const OccupancyLedger&) {}
+
+    void onClientJoin(ClientQos&) {}
+    void onClientLeave(ClientQos&) {}
+    Decision onRequest(const KernelRequest&, ClientQos&, uint64_t) {
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+    void onCompletion(ClientQos&, uint32_t, uint64_t) {}
+    void tick(uint64_t) {}
+    uint64_t epoch() const { return 0; }
+    uint32_t lease(ClientQos&, uint64_t) { return POLICY_LEASE_UNLIMITED; }
+    void onLeaseUse(ClientQos&, uint32_t, uint64_t) {}
+    uint64_t leaseEpoch() const { return 0; }
+};
+
+// ------------------------------------------------------------
+//  slo: SLO 感知的 prefill/decode 优先级
+// ------------------------------------------------------------
+/**
+ * - decode 活跃 (最近 decodeGapUs 内有 decode kernel) 时推迟 prefill kernel
+ * - 推迟期间 prefill 按权重分享: 每放行一个 decode kernel 积累 wPrefill/wDecode 个 prefill 配额,
+ *   wPrefill 为当前所有 prefill 客户端的权重之和 (配额由它们共用)
+ * - 当前 decode step 已超过 TPOT 预算时不再发放配额
+ * - 单个 prefill kernel 被推迟超过 prefillMaxDelayUs 后无条件放行
+ */
+class SloPolicy {
+public:
+    SloPolicy(const PolicyOptions& options, const OccupancyLedger& ledger);
+
+    void onClientJoin(ClientQos& client);
+    void onClientLeave(ClientQos& client);
+    inline Decision onRequest(const KernelRequest& req, ClientQos& client, uint64_t now);
+    void onCompletion(ClientQos&, uint32_t, uint64_t) {}
+    void tick(uint64_t) {}
+    // prefill 配额从无到有、或 decode 客户端离开时递增
+    uint64_t epoch() const { return epoch_.load(std::memory_order_relaxed); }
+    // decode 与未声明类别的 kernel 总是放行; prefill 只在 decode 不活跃时获得租约
+    uint32_t lease(ClientQos& client, uint64_t now) {
+        if (client.qosClass != KS_QOS_PREFILL || decodeClients_.load(std::memory_order_relaxed) == 0) {
+            return POLICY_LEASE_UNLIMITED;
+        }
+        return decodeActive(now) ? 0 : POLICY_LEASE_UNLIMITED;
+    }
+    void onLeaseUse(ClientQos& client, uint32_t kernels, uint64_t now) {
+        if (client.qosClass == KS_QOS_DECODE) onDecode(client, kernels, now);
+    }
+    // 新的 decode step 开始时递增, prefill 的租约随之撤销
+    uint64_t leaseEpoch() const { return leaseEpoch_.load(std::memory_order_relaxed); }
+
+private:
+    // 放行了 kernels 个 decode kernel: 推进 decode step, 积累 prefill 配额
+    inline void onDecode(const ClientQos& client, uint32_t kernels, uint64_t now);
+
+    bool decodeActive(uint64_t now) const {
+        uint64_t last = lastDecodeNs_.load(std::memory_order_relaxed);
+        return last != 0 && now - last < static_cast<uint64_t>(options_.decodeGapUs) * 1000;
+    }
+
+    static constexpr int64_t CREDIT_UNIT = 1000;
+
+    SloOptions options_;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> lastDecodeNs_{0};
+    std::atomic<uint64_t> decodeStepStartNs_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> prefillCredits_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> decodeClients_{0};
+    std::atomic<uint32_t> prefillWeight_{0};   // 已加入的 prefill 客户端权重之和
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> epoch_{0};
+    std::atomic<uint64_t> leaseEpoch_{0};
+};
+
+void SloPolicy::onDecode(const ClientQos& client, uint32_t kernels, uint64_t now) {
+    // 新的 decode step: 与上一个 decode kernel 的间隔超过 decodeGapUs
+    if (!decodeActive(now)) {
+        decodeStepStartNs_.store(now, std::memory_order_relaxed);
+        leaseEpoch_.fetch_add(1, std::memory_order_relaxed);
+    }
+    lastDecodeNs_.store(now, std::memory_order_relaxed);
+
+    int64_t add = CREDIT_UNIT * prefillWeight_.load(std::memory_order_relaxed) * kernels / client.weight;
+    int64_t prev = prefillCredits_.fetch_add(add, std::memory_order_relaxed);
+    int64_t credits = prev + add;
+    // 只在配额从不足一个变为至少一个时通知挂起的 prefill 请求
+    if (prev < CREDIT_UNIT && credits >= CREDIT_UNIT) epoch_.fetch_add(1, std::memory_order_relaxed);
+    if (credits > CREDIT_UNIT * static_cast<int64_t>(SPSC_MAX_BATCH)) {
+        prefillCredits_.store(CREDIT_UNIT * SPSC_MAX_BATCH, std::memory_order_relaxed);
+    }
+}
+
+Decision SloPolicy::onRequest(const KernelRequest&, ClientQos& client, uint64_t now) {
+    if (client.qosClass == KS_QOS_DECODE) {
+        onDecode(client, 1, now);
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+
+    if (client.qosClass != KS_QOS_PREFILL ||
+        decodeClients_.load(std::memory_order_relaxed) == 0 || !decodeActive(now)) {
+        client.deferSinceNs = 0;
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+
+    // decode 活跃: prefill 需要配额, 或者已经等够了最长推迟时间
+    if (client.deferSinceNs == 0) client.deferSinceNs = now;
+    if (now - client.deferSinceNs >= static_cast<uint64_t>(options_.prefillMaxDelayUs) * 1000) {
+        client.deferSinceNs = 0;
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+
+    bool overBudget = options_.decodeTpotUs > 0 &&
+        now - decodeStepStartNs_.load(std::memory_order_relaxed) > static_cast<uint64_t>(options_.decodeTpotUs) * 1000;
+    if (!overBudget) {
+        int64_t credits = prefillCredits_.load(std::memory_order_relaxed);
+        while (credits >= CREDIT_UNIT) {
+            if (prefillCredits_.compare_exchange_weak(credits, credits - CREDIT_UNIT, std::memory_order_relaxed)) {
+                client.deferSinceNs = 0;
+                return {Verdict::Grant, KS_REASON_OK};
+            }
+        }
+    }
+    // 最迟在推迟满 prefillMaxDelayUs 或 decode step 结束时放行
+    uint64_t deadline = client.deferSinceNs + static_cast<uint64_t>(options_.prefillMaxDelayUs) * 1000;
+    uint64_t stepEnd = lastDecodeNs_.load(std::memory_order_relaxed) + static_cast<uint64_t>(options_.decodeGapUs) * 1000;
+    return {Verdict::Defer, KS_REASON_THROTTLE, stepEnd < deadline ? stepEnd : deadline};
+}
+
+// ------------------------------------------------------------
+//  static-priority: 严格优先级 decode > 未声明 > prefill
+// ------------------------------------------------------------
+/**
+ * 更高优先级的类别在 decodeGapUs 内有请求时, 低优先级请求被推迟,
+ * 单个请求最多推迟 prefillMaxDelayUs
+ */
+class StaticPriorityPolicy {
+public:
+    StaticPriorityPolicy(const PolicyOptions& options, const OccupancyLedger& ledger);
+
+    void onClientJoin(ClientQos&) {}
+    void onClientLeave(ClientQos&) {}
+    inline Decision onRequest(const KernelRequest& req, ClientQos& client, uint64_t now);
+    void onCompletion(ClientQos&, uint32_t, uint64_t) {}
+    void tick(uint64_t) {}
+    uint64_t epoch() const { return 0; }
+    // 更高优先级的类别活跃时不发放租约
+    uint32_t lease(ClientQos& client, uint64_t now) {
+        return higherActiveUntil(rank(client.qosClass), now) ? 0 : POLICY_LEASE_UNLIMITED;
+    }
+    void onLeaseUse(ClientQos& client, uint32_t, uint64_t now) { touch(rank(client.qosClass), now); }
+    // 非最低的类别从空闲变为活跃时递增
+    uint64_t leaseEpoch() const { return leaseEpoch_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int LEVELS = 3;
+
+    static int rank(uint32_t qosClass) {
+        return qosClass == KS_QOS_DECODE ? 2 : (qosClass == KS_QOS_PREFILL ? 0 : 1);
+    }
+
+    void touch(int r, uint64_t now) {
+        uint64_t last = levels_[r].lastSeenNs.load(std::memory_order_relaxed);
+        levels_[r].lastSeenNs.store(now, std::memory_order_relaxed);
+        if (r > 0 && (last == 0 || now - last >= static_cast<uint64_t>(options_.decodeGapUs) * 1000)) {
+            leaseEpoch_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // 比 r 更高的类别全部进入空闲的时间, 0 表示已经空闲
+    uint64_t higherActiveUntil(int r, uint64_t now) const {
+        uint64_t window = static_cast<uint64_t>(options_.decodeGapUs) * 1000;
+        uint64_t until = 0;
+        for (int h = r + 1; h < LEVELS; h++) {
+            uint64_t last = levels_[h].lastSeenNs.load(std::memory_order_relaxed);
+            if (last != 0 && now - last < window && last + window > until) until = last + window;
+        }
+        return until;
+    }
+
+    SloOptions options_;
+    struct alignas(CACHE_LINE_SIZE) Level {
+        std::atomic<uint64_t> lastSeenNs{0};
+    };
+    Level levels_[LEVELS];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> leaseEpoch_{0};
+};
+
+Decision StaticPriorityPolicy::onRequest(const KernelRequest&, ClientQos& client, uint64_t now) {
+    int r = rank(client.qosClass);
+    touch(r, now);
+
+    uint64_t higherUntil = higherActiveUntil(r, now);
+    if (higherUntil == 0) {
+        client.deferSinceNs = 0;
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+
+    if (client.deferSinceNs == 0) client.deferSinceNs = now;
+    if (now - client.deferSinceNs >= static_cast<uint64_t>(options_.prefillMaxDelayUs) * 1000) {
+        client.deferSinceNs = 0;
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+    uint64_t deadline = client.deferSinceNs + static_cast<uint64_t>(options_.prefillMaxDelayUs) * 1000;
+    return {Verdict::Defer, KS_REASON_THROTTLE, higherUntil < deadline ? higherUntil : deadline};
+}
+
+// ------------------------------------------------------------
+//  token-bucket: 每客户端按权重限速
+// ------------------------------------------------------------
+class TokenBucketPolicy {
+public:
+    TokenBucketPolicy(const PolicyOptions& options, const OccupancyLedger& ledger);
+
+    void onClientJoin(ClientQos& client);
+    void onClientLeave(ClientQos&) {}
+    inline Decision onRequest(const KernelRequest& req, ClientQos& client, uint64_t now);
+    void onCompletion(ClientQos&, uint32_t, uint64_t) {}
+    void tick(uint64_t) {}
+    uint64_t epoch() const { return 0; }
+    // 租约不超过桶中的令牌数; 租约内的 kernel 耗时未知, 每个收取一个令牌, 令牌可以暂时为负
+    uint32_t lease(ClientQos& client, uint64_t now) {
+        refill(client, now);
+        return client.tokens > 0 ? static_cast<uint32_t>(client.tokens / TOKEN_UNIT) : 0;
+    }
+    void onLeaseUse(ClientQos& client, uint32_t kernels, uint64_t) {
+        client.tokens -= static_cast<int64_t>(kernels) * TOKEN_UNIT;
+    }
+    uint64_t leaseEpoch() const { return 0; }
+
+private:
+    static constexpr int64_t TOKEN_UNIT = 1000;
+
+    // 惰性补充: 令牌桶只属于一个会话, 无需原子操作; 返回桶容量
+    int64_t refill(ClientQos& client, uint64_t now) {
+        if (client.refillNs == 0) client.refillNs = now;
+        uint64_t elapsed = now - client.refillNs;
+        if (elapsed > 1000000000ULL) elapsed = 1000000000ULL;
+        int64_t refill = static_cast<int64_t>(elapsed * rate_ * client.weight / 1000000ULL);
+        int64_t cap = static_cast<int64_t>(burst_) * client.weight * TOKEN_UNIT;
+        if (refill > 0) {
+            client.tokens = client.tokens + refill > cap ? cap : client.tokens + refill;
+            client.refillNs = now;
+        }
+        return cap;
+    }
+
+    uint32_t rate_;
+    uint32_t burst_;
+    uint64_t costUnitNs_;
+};
+
+Decision TokenBucketPolicy::onRequest(const KernelRequest& req, ClientQos& client, uint64_t now) {
+    int64_t cap = refill(client, now);
+
+    // 按 GPU 时间计费时, 耗时未知的 kernel 按一个令牌计; 单个 kernel 最多收取整桶
+    int64_t charge = TOKEN_UNIT;
+    if (costUnitNs_ && req.costNs) {
+        charge = static_cast<int64_t>(req.costNs * TOKEN_UNIT / costUnitNs_);
+        if (charge < 1) charge = 1;
+        if (charge > cap) charge = cap;
+    }
+    if (client.tokens >= charge) {
+        client.tokens -= charge;
+        return {Verdict::Grant, KS_REASON_OK};
+    }
+    // 补足差额所需的时间; 补充从 refillNs 开始计算
+    uint64_t perMs = static_cast<uint64_t>(rate_) * client.weight;
+    if (perMs == 0) return {Verdict::Defer, KS_REASON_THROTTLE, 0};
+    uint64_t deficit = static_cast<uint64_t>(charge - client.tokens);
+    return {Verdict::Defer, KS_REASON_THROTTLE, client.refillNs + (deficit * 1000000ULL + perMs - 1) / perMs};
+}
+
+// ------------------------------------------------------------
+//  round-robin: 活跃客户端轮流获得 rrQuantum 个 kernel 的发射权
+// ------------------------------------------------------------
+class RoundRobinPolicy {
+public:
+    RoundRobinPolicy(const PolicyOptions& options, const OccupancyLedger& ledger);
+
+    void onClientJoin(ClientQos& client);
+    void onClientLeave(ClientQos& client);
+    inline Decision onRequest(const KernelRequest& req, ClientQos& client, uint64_t now);
+    void onCompletion(ClientQos&, uint32_t, uint64_t) {}
+    void tick(uint64_t) {}
+    // 发射权转交或释放时递增
+    uint64_t epoch() const { return epoch_.load(std::memory_order_relaxed); }
+    // 只有发射权的持有者获得租约, 额度为本轮剩余的 kernel 数; 发射权转交时撤销
+    uint32_t lease(ClientQos& client, uint64_t) {
+        if (client.slot < 0) return POLICY_LEASE_UNLIMITED;
+        if (turn_.load(std::memory_order_acquire) != client.slot) return 0;
+        uint32_t granted = grants_.load(std::memory_order_relaxed);
+        return granted < quantum_ ? quantum_ - granted : 0;
+    }
+    void onLeaseUse(ClientQos& client, uint32_t kernels, uint64_t now) {
+        if (client.slot < 0) return;
+        slots_[client.slot].lastSeenNs.store(now, std::memory_order_relaxed);
+        if (turn_.load(std::memory_order_acquire) != client.slot) return;
+        if (grants_.fetch_add(kernels, std::memory_order_relaxed) + kernels >= quantum_) advance(client.slot, now);
+    }
+    uint64_t leaseEpoch() const { return epoch(); }
+
+private:
+    bool idle(int slot, uint64_t now) const {
+        uint64_t last = slots_[slot].lastSeenNs.load(std::memory_order_relaxed);
+        return last == 0 || now - last >= idleNs_;
+    }
+    // 把发射权交给 from 之后第一个活跃的客户端; 没有其他活跃客户端时保持不变
+    void advance(int from, uint64_t now);
+    // 推迟: 持有者空闲时可以抢占; 挂起期间每半个 idle 周期重新裁决一次,
+    // 刷新本客户端的 lastSeenNs, 否则 advance 会把它当作空闲而跳过
+    Decision defer(int turn, uint64_t now) const {
+        uint64_t retry = now + idleNs_ / 2;
+        if (turn >= 0) {
+            uint64_t holderIdle = slots_[turn].lastSeenNs.load(std::memory_order_relaxed) + idleNs_;
+            if (holderIdle < retry) retry = holderIdle;
+        }
+        return {Verdict::Defer, KS_REASON_THROTTLE, retry};
+    }
+
+    uint32_t quantum_;
+    uint64_t idleNs_;
+    ClientSlots clientSlots_;
+
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<uint64_t> lastSeenNs{0};
+    };
+    Slot slots_[POLICY_MAX_SLOTS];
+    alignas(CACHE_LINE_SIZE) std::atomic<int> turn_{-1};
+    std::atomic<uint32_t> grants_{0};
+    std::atomic<uint64_t> epoch_{0};
+};
+
+Decision RoundRobinPolicy::onRequest(const KernelRequest&, ClientQos& client, uint64_t now) {
+    if (client.slot < 0) return {Verdict::Grant, KS_REASON_OK};
+    slots_[client.slot].lastSeenNs.store(now, std::memory_order_relaxed);
+
+    int turn = turn_.load(std::memory_order_acquire);
+    if (turn != client.slot) {
+        // 持有者已空闲 (或尚无持有者) 时抢占发射权
+        if (turn >= 0 && !idle(turn, now)) {
+            return defer(turn, now);
+        }
+        if (!turn_.compare_exchange_strong(turn, client.slot, std::memory_order_acq_rel)) {
+            return defer(turn, now);
+        }
+        grants_.store(0, std::memory_order_relaxed);
+    }
+
+    if (grants_.fetch_add(1, std::memory_order_relaxed) + 1 >= quantum_) {
+        advance(client.slot, now);
+    }
+    return {Verdict::Grant, KS_REASON_OK};
+}
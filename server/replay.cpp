@@ -0,0 +1,338 @@
+// ks_replay: 把 --record 录制的 trace 通过真实的共享内存通道回放给调度服务端
+// 每个 (或折叠后的每组) 客户端会话由一个子进程扮演, 无需 GPU
+
+#include "config.h"
+#include "flexmps_client.h"
+#include "policy.h"
+#include "trace.h"
+#include "wait_strategy.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+struct ReplayOptions {
+    double speed = 1.0;        // 到达间隔缩放, 2 表示两倍速
+    bool afap = false;         // 忽略到达时间, 尽快发送
+    unsigned clients = 0;      // 折叠后的客户端进程数, 0 表示每个会话一个进程
+    unsigned window = 1;       // 每个客户端的最大在途请求数; 1 与拦截器一致 (等待裁决后才发射 kernel)
+    std::string path;
+};
+
+// 回放的一个客户端进程
+struct ReplayGroup {
+    KsTraceClient client;
+    std::vector<const KsTraceRecord*> records;   // 按 recv_ns 排序
+    size_t resultOffset = 0;                     // 在共享结果数组中的起始位置
+};
+
+// 父子进程共享的结果区
+struct ReplayShared {
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> failed;
+    std::atomic<uint64_t> startNs;
+};
+
+struct ReplayClientStats {
+    uint64_t sent;
+    uint64_t denied;
+    uint64_t endNs;
+};
+
+static void printUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options] <trace>\n"
+              << "  --speed <f>      到达间隔缩放, 2 表示两倍速 (默认 1)\n"
+              << "  --afap           忽略到达时间, 尽快发送\n"
+              << "  --clients <n>    把 trace 中的会话折叠为 n 个客户端进程 (默认每个会话一个进程)\n"
+              << "  --window <n>     每个客户端最多在途请求数 (默认 1)\n"
+              << "  -h, --help       显示帮助\n";
+}
+
+static bool parseReplayOptions(int argc, char** argv, ReplayOptions& opts) {
+    enum { OPT_SPEED = 256, OPT_AFAP, OPT_CLIENTS, OPT_WINDOW };
+    static const struct option longOpts[] = {
+        {"speed",   required_argument, nullptr, OPT_SPEED},
+        {"afap",    no_argument,       nullptr, OPT_AFAP},
+        {"clients", required_argument, nullptr, OPT_CLIENTS},
+        {"window",  required_argument, nullptr, OPT_WINDOW},
+        {"help",    no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOpts, nullptr)) != -1) {
+        char* end = nullptr;
+        bool ok = true;
+        switch (c) {
+        case OPT_SPEED:
+            opts.speed = strtod(optarg, &end);
+            ok = !*end && opts.speed > 0;
+            break;
+        case OPT_AFAP:
+            opts.afap = true;
+            break;
+        case OPT_CLIENTS:
+            opts.clients = strtoul(optarg, &end, 10);
+            ok = !*end && opts.clients > 0 && opts.clients <= MAX_REGISTERED_CLIENTS;
+            break;
+        case OPT_WINDOW:
+            opts.window = strtoul(optarg, &end, 10);
+            ok = !*end && opts.window > 0 && opts.window <= SPSC_RING_MIN_MSGS;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return false;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            std::cerr << "[Replay] Invalid argument for option " << argv[optind - 1] << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (optind != argc - 1) {
+        printUsage(argv[0]);
+        return false;
+    }
+    opts.path = argv[optind];
+    return true;
+}
+
+// 按客户端分组; 折叠时把会话轮流分配到各组, 组内按时间合并
+static std::vector<ReplayGroup> buildGroups(const TraceReader& trace, unsigned clients) {
+    std::map<uint32_t, KsTraceClient> known;
+    for (const KsTraceClient& c : trace.clients()) known[c.session] = c;
+
+    std::map<uint32_t, std::vector<const KsTraceRecord*>> bySession;
+    for (uint64_t i = 0; i < trace.recordCount(); i++) {
+        bySession[trace.records()[i].session].push_back(&trace.records()[i]);
+    }
+
+    size_t n = clients ? std::min<size_t>(clients, bySession.size()) : bySession.size();
+    std::vector<ReplayGroup> groups(n);
+    size_t i = 0;
+    for (auto& kv : bySession) {
+        ReplayGroup& g = groups[i % n];
+        if (g.records.empty()) {
+            auto it = known.find(kv.first);
+            if (it != known.end()) {
+                g.client = it->second;
+            } else {
+                memset(&g.client, 0, sizeof(g.client));
+                g.client.session = kv.first;
+                snprintf(g.client.unique_id, sizeof(g.client.unique_id), "replay%u", kv.first);
+            }
+        }
+        g.records.insert(g.records.end(), kv.second.begin(), kv.second.end());
+        i++;
+    }
+
+    size_t offset = 0;
+    for (ReplayGroup& g : groups) {
+        std::stable_sort(g.records.begin(), g.records.end(),
+                         [](const KsTraceRecord* a, const KsTraceRecord* b) { return a->recv_ns < b->recv_ns; });
+        g.resultOffset = offset;
+        offset += g.records.size();
+    }
+    return groups;
+}
+
+static void sleepUntil(uint64_t deadlineNs) {
+    uint64_t now = nowNs();
+    // 提前 50us 醒来, 剩余部分自旋, 避免定时器精度影响到达间隔
+    if (deadlineNs > now + 100000) {
+        uint64_t ns = deadlineNs - now - 50000;
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000ULL;
+        ts.tv_nsec = ns % 1000000000ULL;
+        nanosleep(&ts, nullptr);
+    } else {
+        cpu_relax();
+    }
+}
+
+// 子进程: 注册为客户端, 按 trace 中的时间发送请求并记录每条请求的调度延迟
+static int runClient(const ReplayOptions& opts, const TraceReader& trace, const ReplayGroup& group,
+                     ReplayShared* shared, uint64_t* latencies, uint64_t* lateness, ReplayClientStats* stats) {
+    FlexClientOptions clientOpts;
+    clientOpts.clientType = "replay";
+    clientOpts.uniqueId = group.client.unique_id;
+    clientOpts.clientId = group.client.session;
+    clientOpts.qosClass = group.client.qos_class;
+    clientOpts.weight = group.client.weight;
+    FlexClient client;
+    if (!client.connect(clientOpts)) return 1;
+
+    // 预先解析 kernel 名称, 发送循环中不做查找
+    const size_t n = group.records.size();
+    std::vector<std::string> names(n);
+    for (size_t i = 0; i < n; i++) names[i] = trace.kernelName(group.records[i]->kernel_hash);
+
+    shared->ready.fetch_add(1);
+    uint64_t start;
+    while ((start = shared->startNs.load(std::memory_order_acquire)) == 0) usleep(100);
+
+    std::vector<uint64_t> sendNs(n);
+    std::vector<FlexRequest> batch;
+    FlexDecision decisions[SPSC_MAX_BATCH];
+    size_t next = 0, done = 0;
+    uint64_t denied = 0;
+
+    while (done < n) {
+        uint64_t now = nowNs();
+
+        // 一次提交所有已到期的请求
+        batch.clear();
+        while (next + batch.size() < n && next + batch.size() - done < opts.window) {
+            size_t i = next + batch.size();
+            uint64_t due = start + static_cast<uint64_t>(group.records[i]->recv_ns / opts.speed);
+            if (!opts.afap && now < due) break;
+            lateness[i] = opts.afap ? 0 : now - due;
+            sendNs[i] = now;
+            batch.push_back(FlexRequest{i, group.records[i]->kernel_hash, names[i].data(), names[i].size()});
+        }
+        next += client.submitBatch(batch.data(), batch.size());
+
+        // 收取裁决
+        size_t got = client.poll(decisions, SPSC_MAX_BATCH);
+        if (got) {
+            now = nowNs();
+            for (size_t i = 0; i < got; i++) {
+                if (decisions[i].reqId < n) latencies[decisions[i].reqId] = now - sendNs[decisions[i].reqId];
+                if (!decisions[i].allow) denied++;
+            }
+            done += got;
+            continue;
+        }
+
+        if (next > done) {
+            // 有请求在途: 等待裁决, 但不错过下一条请求的发送时间
+            uint32_t timeoutUs = 1000;
+            if (!opts.afap && next < n && next - done < opts.window) {
+                uint64_t due = start + static_cast<uint64_t>(group.records[next]->recv_ns / opts.speed);
+                timeoutUs = due > now ? static_cast<uint32_t>(std::min<uint64_t>((due - now) / 1000, 1000)) : 0;
+            }
+            client.waitDecision(timeoutUs);
+        } else if (next < n && batch.empty()) {
+            sleepUntil(start + static_cast<uint64_t>(group.records[next]->recv_ns / opts.speed));
+        }
+    }
+
+    stats->sent = n;
+    stats->denied = denied;
+    stats->endNs = nowNs();
+    client.close();
+    return 0;
+}
+
+static double percentileUs(std::vector<uint64_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t i = static_cast<size_t>(p * (v.size() - 1));
+    return v[i] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    ReplayOptions opts;
+    if (!parseReplayOptions(argc, argv, opts)) return 1;
+
+    TraceReader trace;
+    if (!trace.open(opts.path)) return 1;
+    std::vector<ReplayGroup> groups = buildGroups(trace, opts.clients);
+    if (groups.empty()) {
+        std::cerr << "[Replay] Trace has no records" << std::endl;
+        return 1;
+    }
+    if (groups.size() > MAX_REGISTERED_CLIENTS) {
+        std::cerr << "[Replay] Trace has " << groups.size() << " sessions, use --clients <= "
+                  << MAX_REGISTERED_CLIENTS << std::endl;
+        return 1;
+    }
+
+    uint64_t total = trace.recordCount();
+    size_t sharedSize = sizeof(ReplayShared) + groups.size() * sizeof(ReplayClientStats) + 2 * total * sizeof(uint64_t);
+    void* mem = mmap(nullptr, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("[Replay] mmap");
+        return 1;
+    }
+    ReplayShared* shared = new (mem) ReplayShared();
+    ReplayClientStats* stats = reinterpret_cast<ReplayClientStats*>(shared + 1);
+    uint64_t* latencies = reinterpret_cast<uint64_t*>(stats + groups.size());
+    uint64_t* lateness = latencies + total;
+
+    std::cout << "[Replay] " << total << " requests, " << groups.size() << " clients, "
+              << (opts.afap ? std::string("as fast as possible") : "speed x" + std::to_string(opts.speed))
+              << ", window " << opts.window << std::endl;
+
+    std::vector<pid_t> children;
+    for (size_t i = 0; i < groups.size(); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            const ReplayGroup& g = groups[i];
+            int rc = runClient(opts, trace, g, shared, latencies + g.resultOffset,
+                               lateness + g.resultOffset, &stats[i]);
+            if (rc != 0) shared->failed.fetch_add(1);
+            _exit(rc);
+        }
+        if (pid < 0) {
+            perror("[Replay] fork");
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    // 所有客户端都被服务端接纳后同时开始
+    while (shared->ready.load() + shared->failed.load() < children.size()) usleep(1000);
+    uint64_t start = nowNs() + 1000000;
+    shared->startNs.store(start, std::memory_order_release);
+
+    int failures = 0;
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failures++;
+    }
+    if (failures) {
+        std::cerr << "[Replay] " << failures << " client(s) failed" << std::endl;
+        return 1;
+    }
+
+    uint64_t end = start;
+    uint64_t denied = 0;
+    for (size_t i = 0; i < groups.size(); i++) {
+        end = std::max(end, stats[i].endNs);
+        denied += stats[i].denied;
+        std::vector<uint64_t> lat(latencies + groups[i].resultOffset,
+                                  latencies + groups[i].resultOffset + groups[i].records.size());
+        std::sort(lat.begin(), lat.end());
+        printf("[Replay] client %-12s qos=%u  n=%-8zu p50=%8.1fus p99=%8.1fus\n",
+               groups[i].client.unique_id, groups[i].client.qos_class, lat.size(),
+               percentileUs(lat, 0.50), percentileUs(lat, 0.99));
+    }
+
+    std::vector<uint64_t> lat(latencies, latencies + total);
+    std::vector<uint64_t> late(lateness, lateness + total);
+    std::sort(lat.begin(), lat.end());
+    std::sort(late.begin(), late.end());
+    double seconds = (end - start) / 1e9;
+    printf("[Replay] total n=%llu denied=%llu elapsed=%.3fs throughput=%.0f req/s\n",
+           (unsigned long long)total, (unsigned long long)denied, seconds, seconds > 0 ? total / seconds : 0.0);
+    printf("[Replay] latency p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+           percentileUs(lat, 0.50), percentileUs(lat, 0.99), percentileUs(lat, 0.999), percentileUs(lat, 1.0));
+    if (!opts.afap) {
+        printf("[Replay] send lateness p50=%.1fus p99=%.1fus (time behind the recorded arrival)\n",
+               percentileUs(late, 0.50), percentileUs(late, 0.99));
+    }
+    return 0;
+}
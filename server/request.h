@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 一条 kernel 请求的只读视图, 所有指针均指向 SPSC 槽位, releaseBatch() 归还之后失效
+struct KernelRequest {
+    bool binary = false;
+    uint64_t kernelHash = 0;
+    const char* kernelName = nullptr;
+    size_t kernelNameLen = 0;
+
+    // 文本协议的 reqId 原样回显; 二进制协议使用数值
+    uint64_t reqId = 0;
+    const char* reqIdText = nullptr;
+    size_t reqIdTextLen = 0;
+
+    uint32_t clientIdNum = 0;
+    const char* clientId = nullptr;
+    size_t clientIdLen = 0;
+    const char* uniqueId = nullptr;
+    size_t uniqueIdLen = 0;
+
+    // 由调度器在调用策略之前填写
+    uint32_t kernelId = 0;   // KernelTable id
+    uint64_t costNs = 0;     // 代价模型估计的 GPU 执行时间 (cost_model.h), 0 表示尚无样本
+};
+
+// 策略对一条请求的裁决
+enum class Verdict {
+    Grant,   // 放行
+    Deny,    // 拒绝 (客户端自行处理, 例如重试)
+    Defer,   // 暂不答复: 请求留在队列中 (或被挂起, 见 scheduler.h), 稍后重新裁决
+};
+
+struct Decision {
+    Verdict verdict;
+    uint32_t reason;      // KsReason
+    uint64_t retryAtNs;   // Defer: 预计可以放行的时间, 挂起的请求到时重新裁决; 0 表示等待策略事件 (Policy::epoch)
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/**
+ * @brief 进程内单生产者/单消费者无锁环形队列
+ * 容量为 2 的幂, 下标用掩码回绕; 生产者与消费者各自缓存对端下标,
+ * 只有在缓存判断为满/空时才重新读取对端的 cache line
+ * 使用 claim/publish 两段式写入, 大记录可以直接在槽位内构造, 避免二次拷贝
+ */
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    // C++11 的 new 不保证 cache line 对齐, 堆上分配时显式对齐
+    static void* operator new(size_t size) {
+        void* p = nullptr;
+        if (posix_memalign(&p, CACHE_LINE_SIZE, size) != 0) throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete(void* p) { free(p); }
+
+    // 生产者: 返回可写槽位, 队列满时返回 nullptr
+    T* claim() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ >= N) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ >= N) return nullptr;
+        }
+        return &slots_[tail & (N - 1)];
+    }
+
+    // 生产者: 发布 claim() 得到的槽位
+    void publish() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // 消费者: 返回队头元素, 队列空时返回 nullptr
+    T* front() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return nullptr;
+        }
+        return &slots_[head & (N - 1)];
+    }
+
+    // 消费者: 弹出 front() 返回的元素
+    void pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    // 消费者侧
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+    size_t cachedTail_ = 0;
+    // 生产者侧
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+    size_t cachedHead_ = 0;
+    alignas(CACHE_LINE_SIZE) T slots_[N];
+};
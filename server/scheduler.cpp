@@ -1,108 +1,1135 @@
+#include "config.h"
+#include "kernel_table.h"
 #include "logger.h"
+#include "numa.h"
 #include "scheduler.h"
 
-#include <sstream>
+#include <algorithm>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
-Scheduler::Scheduler() {}
+// 一组 CPU 共同所在的节点, 跨节点或未知时为 -1
+static int commonNode(const std::vector<int>& cpus) {
+    int node = KS_NUMA_UNKNOWN;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        int n = ks_numa_node_of_cpu(cpus[i]);
+        if (n == KS_NUMA_UNKNOWN || (i > 0 && n != node)) return KS_NUMA_UNKNOWN;
+        node = n;
+    }
+    return node;
+}
 
-Scheduler::~Scheduler() {
+static std::string formatCpus(const std::vector<int>& cpus) {
+    std::string s;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        // 连续的 CPU 合并为区间, 与 --cpus 的格式一致
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        if (!s.empty()) s += ',';
+        s += std::to_string(cpus[i]);
+        if (j > i) s += '-' + std::to_string(cpus[j]);
+        i = j;
+    }
+    return s;
+}
+
+template <typename Policy>
+Scheduler<Policy>::Scheduler(const ServerOptions& opts) : options(opts) {
+    if (options.devices.empty()) options.devices.push_back(0);
+    unsigned perDomain = options.workers > 0 ? options.workers : 1;
+    unsigned n = perDomain * static_cast<unsigned>(options.devices.size());
+    for (int device : options.devices) {
+        domains.push_back(std::unique_ptr<Domain>(new Domain(device, options.policy, perDomain)));
+    }
+    std::vector<int> nodes;
+    if (options.numa && options.workerCpus.empty()) nodes = ks_numa_online_nodes();
+    // worker 按域连续编号: 域 d 拥有 [d * perDomain, (d + 1) * perDomain)
+    for (unsigned i = 0; i < n; i++) {
+        std::unique_ptr<SchedulerWorker> w(new SchedulerWorker());
+        w->index = static_cast<int>(i);
+        w->domain = i / perDomain;
+        w->shard = i % perDomain;
+        domains[w->domain]->workers.push_back(w.get());
+        if (!options.workerCpus.empty()) {
+            w->cpus.push_back(options.workerCpus[i % options.workerCpus.size()]);
+        } else if (!nodes.empty()) {
+            // 节点内的 CPU 列表为空 (无 CPU 的内存节点) 时不绑核
+            w->cpus = ks_numa_node_cpus(nodes[i % nodes.size()]);
+        }
+        w->node = commonNode(w->cpus);
+        if (!w->cpus.empty()) {
+            std::cout << "[Scheduler] Worker " << i << ": cpus " << formatCpus(w->cpus) << ", node ";
+            if (w->node >= 0) std::cout << w->node;
+            else std::cout << "-";
+            std::cout << std::endl;
+        }
+        pool.push_back(std::move(w));
+    }
+    if (domains.size() > 1) {
+        for (auto& d : domains) {
+            std::cout << "[Scheduler] Device " << d->device << ": workers " << d->workers.front()->index;
+            if (d->workers.size() > 1) std::cout << "-" << d->workers.back()->index;
+            std::cout << std::endl;
+        }
+    }
+    if (!options.recordPath.empty()) {
+        recorder.reset(new TraceRecorder());
+        if (!recorder->open(options.recordPath, options.recordMax)) recorder.reset();
+    }
+    if (!options.timelinePath.empty()) {
+        timeline.reset(new TimelineWriter());
+        if (!timeline->open(options.timelinePath, n, options.policy.name, options.devices)) timeline.reset();
+    }
+    if (options.stats) {
+        stats.reset(new StatsPage());
+        if (!stats->open(options.policy.name, n, options.devices)) stats.reset();
+    }
+    // 所有 worker 对象就绪后再启动线程, worker 之间会互相引用 (再平衡)
+    for (auto& w : pool) {
+        w->thread = std::thread(&Scheduler<Policy>::workerLoop, this, w.get());
+    }
+}
+
+template <typename Policy>
+Scheduler<Policy>::~Scheduler() {
+    stop();
+}
+
+template <typename Policy>
+void Scheduler<Policy>::stop() {
+    // 析构时会再次调用
+    bool first = running.exchange(false);
+    std::lock_guard<std::mutex> lock(poolMutex);
+    for (auto& w : pool) {
+        ring(w.get());
+    }
+    for (auto& w : pool) {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+    if (recorder) recorder->close();
+    if (timeline) timeline->close();
+    if (stats) stats->close();
+    if (first) reportCosts();
+}
+
+template <typename Policy>
+void Scheduler<Policy>::handOver() {
+    handingOver.store(true);
     stop();
 }
 
-void Scheduler::stop() {
-    running = false;
-    std::lock_guard<std::mutex> lock(threadsMutex);
-    for (auto& t : workers) {
-        if (t.joinable())
-            t.join();
+template <typename Policy>
+void Scheduler<Policy>::reportCosts() {
+    uint32_t kernels = std::min(KernelTable::instance().size(), MAX_KERNEL_TYPES);
+    for (auto& d : domains) {
+        // 按累计 GPU 时间 (样本数 x 中位数) 排序, 只列出前几个
+        std::vector<std::pair<uint64_t, uint32_t>> top;
+        for (uint32_t kid = 0; kid < kernels; kid++) {
+            uint64_t n = d->costs.samples(kid);
+            if (n) top.push_back(std::make_pair(n * d->costs.quantile(kid, 0.5), kid));
+        }
+        if (top.empty()) continue;
+        std::sort(top.begin(), top.end(), [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+            return a.first > b.first;
+        });
+        std::cout << "[CostModel] Device " << d->device << ": " << top.size() << " kernel types with completions"
+                  << std::endl;
+        for (size_t i = 0; i < top.size() && i < COST_REPORT_KERNELS; i++) {
+            uint32_t kid = top[i].second;
+            char line[256];
+            snprintf(line, sizeof(line), "  %-60.60s n=%-8llu p50=%lluns p99=%lluns",
+                     KernelTable::instance().name(kid), (unsigned long long)d->costs.samples(kid),
+                     (unsigned long long)d->costs.quantile(kid, 0.5), (unsigned long long)d->costs.quantile(kid, 0.99));
+            std::cout << line << std::endl;
+        }
+    }
+}
+
+template <typename Policy>
+size_t Scheduler<Policy>::getActiveCount() {
+    return activeSessions.load();
+}
+
+template <typename Policy>
+Decision Scheduler<Policy>::makeDecision(const KernelRequest& req, ClientSession& session, uint64_t now) {
+    // 核心调度算法, 只涉及会话所属域的策略状态
+    return domains[session.domain]->policy.onRequest(req, session.qos, now);
+}
+
+// 在槽位内原地解析请求, 不做任何堆分配
+// 文本格式: kernel|reqId|client_id[|unique_id]
+static bool parseRequest(const char* msg, size_t len, KernelRequest& req) {
+    if (ks_is_binary(msg, len)) {
+        if (ks_binary_length(msg, len) == 0) return false;
+        const KsKernelRequest* r = reinterpret_cast<const KsKernelRequest*>(msg);
+        if (r->hdr.type != KS_MSG_KERNEL_REQUEST) return false;
+        req.binary = true;
+        req.kernelHash = r->kernel_hash;
+        if (r->hdr.flags & KS_REQ_FLAG_HAS_NAME) {
+            req.kernelName = r->kernel_name;
+            req.kernelNameLen = r->name_len;
+        }
+        req.reqId = r->req_id;
+        req.clientIdNum = r->client_id;
+        return true;
+    }
+
+    while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r')) {
+        len--;
+    }
+
+    const char* fields[4];
+    size_t lens[4];
+    size_t n = 0;
+    const char* p = msg;
+    const char* end = msg + len;
+    while (n < 4) {
+        const char* sep = static_cast<const char*>(memchr(p, '|', end - p));
+        fields[n] = p;
+        lens[n] = (sep ? sep : end) - p;
+        n++;
+        if (!sep) break;
+        p = sep + 1;
     }
-    workers.clear();
+    if (n < 3) return false;
+
+    req.binary = false;
+    req.kernelName = fields[0];
+    req.kernelNameLen = lens[0];
+    req.kernelHash = ks_kernel_hash(fields[0], lens[0]);
+    req.reqIdText = fields[1];
+    req.reqIdTextLen = lens[1];
+    req.clientId = fields[2];
+    req.clientIdLen = lens[2];
+    req.uniqueId = n >= 4 ? fields[3] : fields[2];
+    req.uniqueIdLen = n >= 4 ? lens[3] : lens[2];
+    return true;
 }
 
-size_t Scheduler::getActiveCount() {
-    std::lock_guard<std::mutex> lock(threadsMutex);
-    return workers.size(); 
+// 合法的完成消息, 其他消息返回 nullptr
+static const KsCompletion* asCompletion(const MsgView& m) {
+    if (!ks_is_binary(m.data, m.len) || ks_binary_length(m.data, m.len) == 0) return nullptr;
+    const KsCompletion* c = reinterpret_cast<const KsCompletion*>(m.data);
+    return c->hdr.type == KS_MSG_COMPLETION ? c : nullptr;
 }
 
-std::pair<bool, std::string> Scheduler::makeDecision(const std::string& kernelType) {
-    // 核心调度算法
-    return {true, "OK"};
+// 请求的数值 id; 文本协议中非数字的 reqId 记为 0
+static uint64_t requestNumber(const KernelRequest& req) {
+    if (req.binary) return req.reqId;
+    uint64_t v = 0;
+    for (size_t i = 0; i < req.reqIdTextLen; i++) {
+        char c = req.reqIdText[i];
+        if (c < '0' || c > '9') return 0;
+        v = v * 10 + (c - '0');
+    }
+    return v;
 }
 
-std::vector<std::string> split(const std::string& s, char delimiter) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
+// 构建响应, 写入调用者提供的缓冲区, 返回长度
+static size_t formatResponse(const KernelRequest& req, const Decision& d, char* out, size_t cap) {
+    if (req.binary) {
+        KsDecision* r = reinterpret_cast<KsDecision*>(out);
+        r->hdr.magic = KS_WIRE_MAGIC;
+        r->hdr.version = KS_WIRE_VERSION;
+        r->hdr.type = KS_MSG_DECISION;
+        r->hdr.flags = 0;
+        r->req_id = req.reqId;
+        r->allow = d.verdict == Verdict::Grant ? 1 : 0;
+        r->reason = d.reason;
+        return sizeof(KsDecision);
     }
-    return tokens;
+
+    // reqId|1|OK\n
+    const char* reason = d.reason == KS_REASON_OK ? "OK" : "THROTTLE";
+    size_t reasonLen = strlen(reason);
+    size_t idLen = req.reqIdTextLen;
+    if (idLen + reasonLen + 5 > cap) idLen = cap - reasonLen - 5;
+    size_t n = 0;
+    memcpy(out + n, req.reqIdText, idLen); n += idLen;
+    out[n++] = '|';
+    out[n++] = d.verdict == Verdict::Grant ? '1' : '0';
+    out[n++] = '|';
+    memcpy(out + n, reason, reasonLen); n += reasonLen;
+    out[n++] = '\n';
+    return n;
 }
 
-void Scheduler::onNewClient(std::unique_ptr<IChannel> channel) {
+template <typename Policy>
+void Scheduler<Policy>::onNewClient(std::unique_ptr<IChannel> channel) {
     LogManager::instance().sessionIdIncrement();
-    // 转移 channel 所有权给线程
-    std::lock_guard<std::mutex> lock(threadsMutex);
-    workers.emplace_back(&Scheduler::clientHandler, this, std::move(channel));
+
+    std::unique_ptr<ClientSession> session(new ClientSession());
+    session->domain = domainFor(channel->getDevice());
+    Domain& domain = *domains[session->domain];
+    session->sessionId = LogManager::instance().getSessionId();
+    session->clientKey = channel->getType() + ":" + channel->getId();
+    session->qos.qosClass = channel->getQosClass();
+    session->qos.weight = channel->getWeight();
+    auto override = options.qosOverrides.find(channel->getId());
+    if (override != options.qosOverrides.end()) {
+        session->qos.qosClass = override->second.qosClass;
+        if (override->second.weight) session->qos.weight = override->second.weight;
+    }
+    if (session->qos.weight == 0) {
+        session->qos.weight = session->qos.qosClass == KS_QOS_DECODE ? DEFAULT_DECODE_WEIGHT : DEFAULT_PREFILL_WEIGHT;
+    }
+    if (recorder) {
+        recorder->addClient(static_cast<uint32_t>(session->sessionId), channel->getType(), channel->getId(),
+                            session->qos.qosClass, session->qos.weight);
+    }
+    if (timeline) {
+        timeline->addClient(static_cast<uint32_t>(session->sessionId), domain.device, channel->getType(),
+                            channel->getId(), session->qos.qosClass);
+    }
+    if (stats) {
+        session->stats = stats->attach(static_cast<uint64_t>(session->sessionId), channel->getType(), channel->getId(),
+                                       channel->getPid(), domain.device, channel->getNumaNode(),
+                                       session->qos.qosClass, session->qos.weight);
+    }
+    session->numaNode = channel->getNumaNode();
+    session->channel = std::move(channel);
+    domain.policy.onClientJoin(session->qos);
+    activeSessions++;
+
+    // 在域内分配给与客户端同节点、负载最低的 worker; 该节点上没有 worker 时在域内全部 worker 中选
+    SchedulerWorker* target = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(domain.mutex);
+        if (session->numaNode >= 0) {
+            for (SchedulerWorker* w : domain.workers) {
+                if (w->node != session->numaNode) continue;
+                if (!target || w->load.load() < target->load.load()) target = w;
+            }
+        }
+        if (!target) {
+            for (SchedulerWorker* w : domain.workers) {
+                if (!target || w->load.load() < target->load.load()) target = w;
+            }
+        }
+    }
+    assign(target, std::move(session));
+}
+
+template <typename Policy>
+size_t Scheduler<Policy>::domainFor(int device) {
+    for (size_t i = 0; i < domains.size(); i++) {
+        if (domains[i]->device == device) return i;
+    }
+    std::cerr << "[Scheduler] Device " << device << " has no scheduling domain (see --devices), using device "
+              << domains.front()->device << std::endl;
+    return 0;
+}
+
+template <typename Policy>
+void Scheduler<Policy>::assign(SchedulerWorker* worker, std::unique_ptr<ClientSession> session) {
+    {
+        std::lock_guard<std::mutex> lock(worker->inboxMutex);
+        worker->inbox.push_back(std::move(session));
+    }
+    worker->load++;
+    ring(worker);
 }
 
-void Scheduler::clientHandler(std::unique_ptr<IChannel> channel) {
-    std::stringstream ss;
-    long long sessionId = LogManager::instance().getSessionId();
-    std::string clientKey = channel->getType() + ":" + channel->getId();
-    ss << "[Scheduler] Session #" << sessionId << " started for " 
-       << clientKey << " (SHM: " << channel->getName() << ")";
-    std::cout << ss.str() << std::endl;
+template <typename Policy>
+void Scheduler<Policy>::ring(SchedulerWorker* worker) {
+    worker->doorbell.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&worker->doorbell), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::rebalance(Domain& domain) {
+    std::lock_guard<std::mutex> lock(domain.mutex);
+    const std::vector<SchedulerWorker*>& workers = domain.workers;
+    // 只在同一节点的 worker 之间迁移, 不把会话搬离客户端通道所在的节点
+    for (size_t g = 0; g < workers.size(); g++) {
+        int node = workers[g]->node;
+        bool seen = false;
+        for (size_t k = 0; k < g && !seen; k++) seen = workers[k]->node == node;
+        if (seen) continue;
+
+        SchedulerWorker* busiest = nullptr;
+        SchedulerWorker* idlest = nullptr;
+        for (SchedulerWorker* w : workers) {
+            if (w->node != node) continue;
+            if (!busiest || w->load.load() > busiest->load.load()) busiest = w;
+            if (!idlest || w->load.load() < idlest->load.load()) idlest = w;
+        }
+        if (busiest && idlest && busiest->load.load() > idlest->load.load() + 1) {
+            int expected = -1;
+            if (busiest->donateTo.compare_exchange_strong(expected, idlest->index)) {
+                ring(busiest);
+            }
+        }
+    }
+}
+
+static void pinToCpus(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        std::cerr << "[Scheduler] Failed to pin worker to CPUs " << formatCpus(cpus) << ": " << strerror(rc)
+                  << std::endl;
+    }
+}
+
+template <typename Policy>
+void Scheduler<Policy>::workerLoop(SchedulerWorker* worker) {
+    // 绑核之后再分配 worker 的本地数据, 按 first-touch 落在所在节点上
+    if (!worker->cpus.empty()) {
+        pinToCpus(worker->cpus);
+    }
+
+    Domain& domain = *domains[worker->domain];
+    std::vector<std::unique_ptr<ClientSession>> sessions;
+    Backoff backoff(options.wait);
+    uint64_t lastTick = 0;
+    uint32_t handledDoorbell = worker->doorbell.load() - 1;
+    uint64_t seenEpoch = domain.policy.epoch();
+    uint64_t seenLeaseEpoch = domain.policy.leaseEpoch();
+    worker->timers = TimerWheel<ParkTimer>(nowNs());
+    // 立即重新裁决一个会话的挂起请求并发出结果
+    auto wakeParked = [&](ClientSession& s, uint64_t now) {
+        ReplyBatch batch;
+        retryParked(worker, s, now, batch);
+        flushReplies(s, batch);
+        armTimer(worker, s, now);
+    };
+    while (running) {
+        uint32_t doorbellSeq = worker->doorbell.load(std::memory_order_acquire);
+
+        uint64_t now = nowNs();
+        bool ticked = now - lastTick >= POLICY_TICK_NS;
+        if (ticked) {
+            domain.policy.tick(now);
+            // 每个速率窗口由一个 worker 把账本发布到统计页
+            if (domain.ledger.tick(now) && stats) stats->publishDevice(worker->domain, domain.ledger.snapshot(), now);
+            lastTick = now;
+        }
+
+        // 租约: 把客户端在租约内的发射交给策略; 竞争变化 (leaseEpoch) 或每个 tick 按策略重新计算额度, 只收缩不扩大
+        uint64_t leaseEpoch = domain.policy.leaseEpoch();
+        bool revise = ticked || leaseEpoch != seenLeaseEpoch;
+        seenLeaseEpoch = leaseEpoch;
+        if (worker->leases.load(std::memory_order_relaxed) || ticked) {
+            for (auto& s : sessions) {
+                if (!s->leases) continue;
+                // 已到期的租约在 tick 时再记账一次, 收下到期前最后几次发射
+                if (!s->leaseActive) {
+                    if (ticked) settleLease(*s, now);
+                    continue;
+                }
+                settleLease(*s, now);
+                if (now >= s->leaseExpiryNs) {
+                    dropLease(*s);
+                } else if (revise) {
+                    reviseLease(*s, now);
+                }
+            }
+        }
+
+        // 挂起的请求: 重新裁决时间已到, 或者策略事件 (epoch 变化) 可能让它们可以放行
+        worker->timers.advance(now, [&](const ParkTimer& t) {
+            if (t.session->timerDeadline != t.deadline) return;
+            t.session->timerDeadline = 0;
+            wakeParked(*t.session, now);
+        });
+        // 重新裁决放行的请求可能再次触发策略事件 (如轮转到下一个客户端), 直到稳定;
+        // 每次事件都伴随至少一次放行, 挂起的请求有限, 循环必然结束
+        for (uint64_t epoch = domain.policy.epoch(); epoch != seenEpoch; epoch = domain.policy.epoch()) {
+            seenEpoch = epoch;
+            if (!worker->parked.load(std::memory_order_relaxed)) break;
+            for (auto& s : sessions) {
+                if (!s->parked.empty()) wakeParked(*s, now);
+            }
+        }
+
+        // 新会话与再平衡请求都会敲 doorbell, doorbell 未变化时不必加锁检查
+        if (doorbellSeq != handledDoorbell) {
+            handledDoorbell = doorbellSeq;
+            // 领取新分配/迁入的会话
+            {
+                std::lock_guard<std::mutex> lock(worker->inboxMutex);
+                for (auto& s : worker->inbox) {
+                    s->worker = static_cast<unsigned>(worker->index);
+                    if (s->stats) {
+                        s->stats->worker.store(worker->index, std::memory_order_relaxed);
+                        s->stats->worker_node.store(worker->node, std::memory_order_relaxed);
+                    }
+                    // 迁入的会话带着挂起的请求, 在本 worker 的时间轮中重新登记
+                    if (!s->parked.empty()) {
+                        worker->parked.fetch_add(s->parked.size(), std::memory_order_relaxed);
+                        armTimer(worker, *s, now);
+                    }
+                    if (s->leaseActive) worker->leases.fetch_add(1, std::memory_order_relaxed);
+                    sessions.push_back(std::move(s));
+                }
+                worker->inbox.clear();
+            }
+            for (auto& s : sessions) {
+                if (!s->started) {
+                    std::cout << "[Scheduler] Session #" << s->sessionId << " started for "
+                              << s->clientKey << " (SHM: " << s->channel->getName()
+                              << ", worker " << worker->index;
+                    if (domains.size() > 1) std::cout << ", device " << domain.device;
+                    if (s->numaNode >= 0 || worker->node >= 0) {
+                        std::cout << ", client node " << s->numaNode << ", worker node " << worker->node;
+                    }
+                    std::cout << ")" << std::endl;
+                    s->outOfOrder = s->channel->outOfOrder();
+                    // 通道中可能留有上一个服务端进程发放的租约 (热重启或异常退出), 从零开始
+                    s->leases = options.leaseKernels > 0 && s->channel->acceptsLease();
+                    if (s->leases) {
+                        s->channel->shrinkLease(0);
+                        s->leaseUsed = s->channel->leaseUsed();
+                    }
+                    s->channel->setReady();
+                    s->started = true;
+                }
+            }
+
+            // 再平衡: 把最后一个会话转交给目标 worker
+            int target = worker->donateTo.exchange(-1);
+            if (target >= 0 && target != worker->index && sessions.size() > 1) {
+                std::unique_ptr<ClientSession> moved = std::move(sessions.back());
+                sessions.pop_back();
+                worker->load--;
+                detachParked(worker, *moved);
+                std::cout << "[Scheduler] Session #" << moved->sessionId << " migrated from worker "
+                          << worker->index << " to worker " << target << std::endl;
+                assign(pool[target].get(), std::move(moved));
+            }
+        }
+
+        // 轮询所有通道
+        bool progress = false;
+        for (size_t i = 0; i < sessions.size();) {
+            int n = serviceSession(worker, *sessions[i]);
+            if (n < 0) {
+                detachParked(worker, *sessions[i]);
+                endSession(*sessions[i]);
+                sessions.erase(sessions.begin() + i);
+                worker->load--;
+                activeSessions--;
+                rebalance(domain);
+                continue;
+            }
+            if (n > 0) progress = true;
+            i++;
+        }
+
+        // 本轮的裁决 (含重新裁决) 触发了策略事件: 唤醒域内有挂起请求的其他 worker, 本 worker 不休眠, 下一轮处理
+        if (domain.policy.epoch() != seenEpoch) {
+            for (SchedulerWorker* w : domain.workers) {
+                if (w != worker && w->parked.load(std::memory_order_relaxed)) ring(w);
+            }
+            progress = true;
+        }
+        // 同样, 租约需要收缩时唤醒域内持有租约的其他 worker
+        if (domain.policy.leaseEpoch() != seenLeaseEpoch) {
+            for (SchedulerWorker* w : domain.workers) {
+                if (w != worker && w->leases.load(std::memory_order_relaxed)) ring(w);
+            }
+            progress = true;
+        }
+
+        if (progress) {
+            backoff.reset();
+        } else {
+            idleWait(worker, sessions, backoff, doorbellSeq);
+        }
+    }
+
+    // 退出前结束自己名下 (含尚未领取) 的会话
+    {
+        std::lock_guard<std::mutex> lock(worker->inboxMutex);
+        for (auto& s : worker->inbox) {
+            sessions.push_back(std::move(s));
+        }
+        worker->inbox.clear();
+    }
+    for (auto& s : sessions) {
+        if (!s->started) continue;
+        if (handingOver && !s->parked.empty()) grantParked(worker, *s);
+        endSession(*s);
+    }
+}
+
+template <typename Policy>
+void Scheduler<Policy>::idleWait(SchedulerWorker* worker, std::vector<std::unique_ptr<ClientSession>>& sessions,
+                                 Backoff& backoff, uint32_t doorbellSeq) {
+    if (backoff.step()) return;
+
+    // 休眠不超过时间轮中最近的重新裁决时间; timeoutUs 为 0 表示不设上限
+    uint32_t timeoutUs = options.wait.futexTimeoutUs;
+    if (uint64_t next = worker->timers.nextDeadlineNs()) {
+        uint64_t now = nowNs();
+        if (next <= now) return;
+        uint64_t us = (next - now + 999) / 1000;
+        if (timeoutUs == 0 || us < timeoutUs) timeoutUs = static_cast<uint32_t>(us);
+    }
+    // 客户端在租约内发射不会唤醒 worker, 按 LEASE_POLL_NS 轮询
+    if (worker->leases.load(std::memory_order_relaxed) && (timeoutUs == 0 || LEASE_POLL_NS / 1000 < timeoutUs)) {
+        timeoutUs = static_cast<uint32_t>(LEASE_POLL_NS / 1000);
+    }
+
+    // 预算用完: 在所有通道的 futex 与本 worker 的 doorbell 上一起休眠
+    WaitHandle handles[KS_FUTEX_WAITV_MAX];
+    size_t n = 0;
+    bool ready = false;
+    bool unsupported = sessions.size() >= KS_FUTEX_WAITV_MAX;
+    for (size_t i = 0; i < sessions.size() && !unsupported; i++) {
+        WaitPrep prep = sessions[i]->channel->prepareWait(handles[n]);
+        if (prep == WaitPrep::Parked) {
+            n++;
+        } else if (prep == WaitPrep::Ready) {
+            ready = true;
+            break;
+        } else {
+            unsupported = true;
+        }
+    }
 
-    channel->setReady();
+    if (!ready) {
+        if (unsupported) {
+            usleep(50);
+        } else {
+            ks_futex_waitv(handles, n, &worker->doorbell, doorbellSeq, timeoutUs);
+        }
+    }
+    for (auto& s : sessions) {
+        s->channel->finishWait();
+    }
+}
 
-    std::string message;
-    std::string the_unique_id;
-    while (running && channel->isConnected()) {
-        // 阻塞接收 (底层实现忙等待)
-        if (!channel->recvBlocking(message)) {
-             continue; 
+// 会话的 Logger 在首条请求时查找一次并缓存; 文本协议下 unique_id 取自消息,
+// 同一通道出现不同 unique_id 时 (少见) 按原语义写入对应的 Logger.
+// 每个缓存的 Logger 都在 LogManager 登记为一个使用者, 会话结束时释放 (见 endSession)
+static Logger* sessionLogger(ClientSession& session, const KernelRequest& req) {
+    if (req.binary) {
+        if (!session.logger) {
+            session.uniqueId = session.channel->getId();
+            session.logger = LogManager::instance().acquireLogger(session.uniqueId);
+        }
+        return session.logger.get();
+    }
+    const char* id = req.uniqueId;
+    size_t len = req.uniqueIdLen;
+    if (session.logger) {
+        if (session.uniqueId.size() == len && memcmp(session.uniqueId.data(), id, len) == 0) {
+            return session.logger.get();
         }
+        std::string other(id, len);
+        auto it = session.otherLoggers.find(other);
+        if (it == session.otherLoggers.end()) {
+            it = session.otherLoggers.emplace(other, LogManager::instance().acquireLogger(other)).first;
+        }
+        return it->second.get();
+    }
+    session.uniqueId.assign(id, len);
+    session.logger = LogManager::instance().acquireLogger(session.uniqueId);
+    return session.logger.get();
+}
+
+template <typename Policy>
+int Scheduler<Policy>::serviceSession(SchedulerWorker* worker, ClientSession& session) {
+    IChannel* channel = session.channel.get();
+    MsgView requests[SPSC_MAX_BATCH];
+    ReplyBatch batch;
+
+    // 一次取走所有已就绪的请求, 消息保留在槽位内原地解析
+    size_t count = channel->tryRecvBatch(requests, SPSC_MAX_BATCH);
+    if (count == 0) {
+        return channel->isConnected() ? 0 : -1;
+    }
 
-        // 简单的协议解析
-        while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) {
-            message.pop_back();
+    uint64_t now = nowNs();
+    size_t consumed = 0;
+    size_t decided = 0;
+    KsStatsClient* st = session.stats;
+    if (st) {
+        ks_stats_add(st->batches, 1);
+        st->queue_depth.store(count, std::memory_order_relaxed);
+        if (count > st->queue_depth_max.load(std::memory_order_relaxed)) {
+            st->queue_depth_max.store(count, std::memory_order_relaxed);
         }
+    }
+    // 先重新裁决已挂起的请求, 新到的请求不越过它们取得刚释放的配额
+    if (!session.parked.empty()) retryParked(worker, session, now, batch);
 
-        auto parts = split(message, '|');
-        if (parts.size() < 3) {
+    for (size_t i = 0; i < count; i++) {
+        // 完成消息不需要答复, 与请求一样按顺序消费
+        if (const KsCompletion* c = asCompletion(requests[i])) {
+            recordCompletions(session, *c);
+            consumed++;
+            continue;
+        }
+        KernelRequest req;
+        if (!parseRequest(requests[i].data, requests[i].len, req)) {
+            rejectMalformed(session, requests[i], now, batch);
+            consumed++;
             continue;
         }
+        // 挂起的请求已满: 剩下的请求留在队列中, 不再调用策略
+        bool canPark = session.outOfOrder && req.binary;
+        if (canPark && session.parked.size() >= PARK_MAX_PER_SESSION) break;
+
+        bool renamed = false;
+        uint32_t kid = KernelTable::instance().intern(req.kernelHash, req.kernelName, req.kernelNameLen, &renamed);
+        if (renamed && stats) stats->renameKernel(kid, KernelTable::instance().name(kid));
+        req.kernelId = kid;
+        req.costNs = estimateCost(session, kid);
+        // 本轮还没有裁决过请求时, 当前请求就是队头
+        bool head = decided == 0;
+
+        // 可以乱序答复时每个请求单独计算推迟时间
+        if (canPark) session.qos.deferSinceNs = 0;
+        Decision decision = makeDecision(req, session, now);
+        if (decision.verdict == Verdict::Defer) {
+            if (canPark) {
+                park(worker, session, req, decision, now);
+                consumed++;
+                decided++;
+                continue;
+            }
+            // 按顺序答复: 被推迟的请求及其后的请求都留在队列中
+            if (head && session.headSeenNs == 0) {
+                session.headSeenNs = now;
+                if (timeline) {
+                    // 只标记第一次推迟, 之后的轮询从 slice 的长度上体现
+                    TimelineEvent ev = {};
+                    ev.beginNs = now;
+                    ev.endNs = now;
+                    ev.reqId = requestNumber(req);
+                    ev.session = static_cast<uint32_t>(session.sessionId);
+                    ev.kernel = kid;
+                    ev.kind = TimelineKind::Defer;
+                    ev.reason = decision.reason;
+                    timeline->push(session.worker, ev);
+                }
+            }
+            if (st) ks_stats_add(st->defers, 1);
+            break;
+        }
+        consumed++;
+        decided++;
+
+        uint64_t seen = (head && session.headSeenNs) ? session.headSeenNs : now;
+        session.headSeenNs = 0;
+        answer(session, req, decision, seen, batch);
+    }
+
+    // 整批请求处理完毕: 一次归还请求槽位, 一次发布所有响应
+    channel->releaseBatch(consumed);
+    flushReplies(session, batch);
+    armTimer(worker, session, now);
+    return static_cast<int>(consumed);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::answer(ClientSession& session, const KernelRequest& req, const Decision& decision,
+                               uint64_t seenNs, ReplyBatch& batch) {
+    if (batch.count == SPSC_MAX_BATCH) flushReplies(session, batch);
+    uint32_t kid = req.kernelId;
+    if (recorder) {
+        recorder->record(seenNs, requestNumber(req), req.kernelHash,
+                         static_cast<uint32_t>(session.sessionId), req.binary ? KS_TRACE_BINARY : 0);
+    }
+    KsStatsClient* st = session.stats;
+    if (st) ks_stats_add(decision.verdict == Verdict::Grant ? st->grants : st->denies, 1);
+    if (decision.verdict == Verdict::Grant) {
+        chargeLedger(session, req);
+        if (session.leases) session.leaseRenew = true;
+    }
+
+    Logger* logger = sessionLogger(session, req);
+
+    if (kid >= session.kernelCounts.size()) {
+        session.kernelCounts.resize(std::max<size_t>(kid + 1, session.kernelCounts.size() * 2), 0);
+    }
+    session.kernelCounts[kid]++;
+    if (stats) stats->countKernel(kid, req.kernelHash, KernelTable::instance().name(kid));
+
+    if (req.binary) {
+        char client[16];
+        int len = snprintf(client, sizeof(client), "%u", req.clientIdNum);
+        logger->kernel(kid, client, len, seenNs);
+    } else {
+        logger->kernel(kid, req.clientId, req.clientIdLen, seenNs);
+    }
+
+    // 构建响应 (栈上缓冲区)
+    size_t i = batch.count;
+    batch.replies[i].data = batch.responses[i];
+    batch.replies[i].len = formatResponse(req, decision, batch.responses[i], SPSC_MSG_SIZE);
+    batch.seenNs[i] = seenNs;
+    if (timeline) {
+        TimelineEvent& ev = batch.events[i];
+        ev.beginNs = seenNs;
+        ev.reqId = requestNumber(req);
+        ev.session = static_cast<uint32_t>(session.sessionId);
+        ev.kernel = kid;
+        ev.kind = TimelineKind::Decision;
+        ev.grant = decision.verdict == Verdict::Grant ? 1 : 0;
+        ev.reason = decision.reason;
+        ev.reserved = 0;
+    }
+    batch.count++;
+}
+
+template <typename Policy>
+void Scheduler<Policy>::rejectMalformed(ClientSession& session, const MsgView& msg, uint64_t now, ReplyBatch& batch) {
+    KsStatsClient* st = session.stats;
+    if (st) ks_stats_add(st->malformed, 1);
+    // 只有 req_id 所在的定长部分完整时才能答复
+    if (!ks_is_binary(msg.data, msg.len) || msg.len < KS_KERNEL_REQUEST_FIXED) return;
+    const KsKernelRequest* r = reinterpret_cast<const KsKernelRequest*>(msg.data);
+    if (r->hdr.magic != KS_WIRE_MAGIC || r->hdr.type != KS_MSG_KERNEL_REQUEST) return;
+
+    if (batch.count == SPSC_MAX_BATCH) flushReplies(session, batch);
+    if (st) ks_stats_add(st->denies, 1);
+    KernelRequest req;
+    req.binary = true;
+    req.reqId = r->req_id;
+    Decision decision{Verdict::Deny, KS_REASON_PROTOCOL, 0};
+    size_t i = batch.count;
+    batch.replies[i].data = batch.responses[i];
+    batch.replies[i].len = formatResponse(req, decision, batch.responses[i], SPSC_MSG_SIZE);
+    batch.seenNs[i] = now;
+    if (timeline) {
+        TimelineEvent& ev = batch.events[i];
+        ev.beginNs = now;
+        ev.reqId = req.reqId;
+        ev.session = static_cast<uint32_t>(session.sessionId);
+        ev.kernel = KERNEL_ID_OVERFLOW;
+        ev.kind = TimelineKind::Decision;
+        ev.grant = 0;
+        ev.reason = decision.reason;
+        ev.reserved = 0;
+    }
+    batch.count++;
+}
 
-        std::string kernelType = parts[0];     
-        std::string reqId = parts[1];  
-        std::string client_id = parts[2];
-        std::string unique_id = parts.size() >=4 ? parts[3] : client_id;
-        if (the_unique_id.empty()) {
-            the_unique_id = unique_id;
+template <typename Policy>
+void Scheduler<Policy>::flushReplies(ClientSession& session, ReplyBatch& batch) {
+    size_t n = batch.count;
+    batch.count = 0;
+    if (n == 0) return;
+    // 租约先于响应写入, 客户端收到放行时即可看到新的额度
+    if (session.leaseRenew) renewLease(session, nowNs());
+    if (!session.channel->sendBatch(batch.replies, n) && session.logger) {
+        session.logger->write("[Scheduler] Send timeout for " + session.clientKey);
+    }
+    KsStatsClient* st = session.stats;
+    if (!st && !timeline) return;
+
+    // 每批只读一次时钟: 裁决延迟 = 发出本批响应 - 首次取到请求 (挂起的请求包含挂起的时间)
+    uint64_t sent = nowNs();
+    if (timeline) {
+        for (size_t i = 0; i < n; i++) {
+            batch.events[i].endNs = sent;
+            timeline->push(session.worker, batch.events[i]);
+        }
+    }
+    if (st) {
+        uint64_t sum = 0;
+        uint64_t maxLat = st->latency_max_ns.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t lat = sent - batch.seenNs[i];
+            sum += lat;
+            if (lat > maxLat) maxLat = lat;
+            ks_stats_add(st->latency_hist[ks_stats_lat_bucket(lat)], 1);
         }
+        ks_stats_add(st->requests, n);
+        ks_stats_add(st->latency_sum_ns, sum);
+        st->latency_max_ns.store(maxLat, std::memory_order_relaxed);
+    }
+}
 
-        LogManager::instance().getLogger(unique_id)->kernelIdIncrement();
-        long long kernelId = LogManager::instance().getLogger(unique_id)->getKernelId();
-        LogManager::instance().getLogger(unique_id)->recordKernelStat(kernelType);
+template <typename Policy>
+void Scheduler<Policy>::park(SchedulerWorker* worker, ClientSession& session, const KernelRequest& req,
+                             const Decision& decision, uint64_t now) {
+    ParkedRequest p;
+    p.reqId = req.reqId;
+    p.kernelHash = req.kernelHash;
+    p.kernelId = req.kernelId;
+    p.clientIdNum = req.clientIdNum;
+    p.seenNs = now;
+    p.deferSinceNs = session.qos.deferSinceNs;
+    p.retryAtNs = decision.retryAtNs;
+    session.parked.push_back(p);
+    session.qos.deferSinceNs = 0;
+    worker->parked.fetch_add(1, std::memory_order_relaxed);
 
-        ss.str("");
-        ss << "Kernel " << kernelId << ": " << kernelType << " from " << client_id;
-        LogManager::instance().getLogger(unique_id)->write(ss.str());
+    KsStatsClient* st = session.stats;
+    if (st) {
+        ks_stats_add(st->defers, 1);
+        st->parked.store(session.parked.size(), std::memory_order_relaxed);
+    }
+    if (timeline) {
+        TimelineEvent ev = {};
+        ev.beginNs = now;
+        ev.endNs = now;
+        ev.reqId = req.reqId;
+        ev.session = static_cast<uint32_t>(session.sessionId);
+        ev.kernel = req.kernelId;
+        ev.kind = TimelineKind::Defer;
+        ev.reason = decision.reason;
+        timeline->push(session.worker, ev);
+    }
+}
 
-        // 决策
-        auto decision = makeDecision(kernelType);
-        
-        // 构建响应
-        std::string response = reqId + "|" + (decision.first ? "1" : "0") + "|" + decision.second + "\n";
-        
-        if (!channel->sendBlocking(response)) {
-            LogManager::instance().getLogger(unique_id)->write("[Scheduler] Send timeout for " + clientKey);
+template <typename Policy>
+void Scheduler<Policy>::retryParked(SchedulerWorker* worker, ClientSession& session, uint64_t now,
+                                    ReplyBatch& batch) {
+    std::vector<ParkedRequest>& parked = session.parked;
+    size_t kept = 0;
+    for (size_t i = 0; i < parked.size(); i++) {
+        ParkedRequest p = parked[i];
+        KernelRequest req = unpark(session, p);
+
+        // 策略按 ClientQos::deferSinceNs 计算最长推迟时间, 换成该请求自己的
+        session.qos.deferSinceNs = p.deferSinceNs;
+        Decision decision = makeDecision(req, session, now);
+        if (decision.verdict == Verdict::Defer) {
+            p.deferSinceNs = session.qos.deferSinceNs;
+            p.retryAtNs = decision.retryAtNs;
+            parked[kept++] = p;
+            continue;
         }
+        answer(session, req, decision, p.seenNs, batch);
     }
-    LogManager::instance().removeLogger(the_unique_id);
-    ss.str("");
-    ss << "[Scheduler] Session #" << sessionId << " ended (" << clientKey << ")";
-    std::cout << ss.str() << std::endl;
-}
\ No newline at end of file
+    session.qos.deferSinceNs = 0;
+    if (kept == parked.size()) return;
+    worker->parked.fetch_sub(parked.size() - kept, std::memory_order_relaxed);
+    parked.resize(kept);
+    if (session.stats) session.stats->parked.store(kept, std::memory_order_relaxed);
+}
+
+template <typename Policy>
+KernelRequest Scheduler<Policy>::unpark(const ClientSession& session, const ParkedRequest& p) const {
+    KernelRequest req;
+    req.binary = true;
+    req.kernelHash = p.kernelHash;
+    req.reqId = p.reqId;
+    req.clientIdNum = p.clientIdNum;
+    req.kernelId = p.kernelId;
+    req.costNs = estimateCost(session, p.kernelId);
+    return req;
+}
+
+template <typename Policy>
+void Scheduler<Policy>::grantParked(SchedulerWorker* worker, ClientSession& session) {
+    // 策略状态不随交接转移, 新进程的策略从空状态开始; 挂起的请求不再推迟
+    ReplyBatch batch;
+    for (const ParkedRequest& p : session.parked) {
+        answer(session, unpark(session, p), Decision{Verdict::Grant, KS_REASON_OK, 0}, p.seenNs, batch);
+    }
+    flushReplies(session, batch);
+    detachParked(worker, session);
+    session.parked.clear();
+    if (session.stats) session.stats->parked.store(0, std::memory_order_relaxed);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::armTimer(SchedulerWorker* worker, ClientSession& session, uint64_t now) {
+    if (session.parked.empty()) return;
+    uint64_t deadline = UINT64_MAX;
+    for (const ParkedRequest& p : session.parked) {
+        uint64_t at = p.retryAtNs ? p.retryAtNs : now + PARK_RECHECK_NS;
+        if (at < deadline) deadline = at;
+    }
+    // 已登记的时间不晚于它时保留原登记; 提前到期只多一次重新裁决
+    if (session.timerDeadline != 0 && session.timerDeadline <= deadline) return;
+    session.timerDeadline = deadline;
+    worker->timers.schedule(deadline, ParkTimer{&session, deadline});
+}
+
+template <typename Policy>
+void Scheduler<Policy>::detachParked(SchedulerWorker* worker, ClientSession& session) {
+    // 过时的条目同样引用该会话, 一并删除
+    if (!worker->timers.empty()) {
+        ClientSession* s = &session;
+        worker->timers.removeIf([s](const ParkTimer& t) { return t.session == s; });
+    }
+    session.timerDeadline = 0;
+    if (!session.parked.empty()) worker->parked.fetch_sub(session.parked.size(), std::memory_order_relaxed);
+    if (session.leaseActive) worker->leases.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <typename Policy>
+uint32_t Scheduler<Policy>::leaseFor(ClientSession& session, uint64_t now) {
+    return std::min(domains[session.domain]->policy.lease(session.qos, now), options.leaseKernels);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::renewLease(ClientSession& session, uint64_t now) {
+    session.leaseRenew = false;
+    // 先把已发射的交给策略, 新的额度以此为准; 未用完的旧额度作废
+    settleLease(session, now);
+    uint32_t kernels = leaseFor(session, now);
+    if (kernels == 0) {
+        dropLease(session);
+        return;
+    }
+    session.leaseExpiryNs = now + static_cast<uint64_t>(options.leaseUs) * 1000;
+    session.channel->grantLease(kernels, session.leaseExpiryNs);
+    if (!session.leaseActive) {
+        session.leaseActive = true;
+        pool[session.worker]->leases.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename Policy>
+void Scheduler<Policy>::settleLease(ClientSession& session, uint64_t now) {
+    uint64_t used = session.channel->leaseUsed();
+    if (used == session.leaseUsed) return;
+    uint64_t kernels = used - session.leaseUsed;
+    session.leaseUsed = used;
+    Domain& domain = *domains[session.domain];
+    domain.policy.onLeaseUse(session.qos, static_cast<uint32_t>(kernels), now);
+    domain.ledger.leased(pool[session.worker]->shard, session.qos.qosClass, kernels);
+    if (session.stats) ks_stats_add(session.stats->leased, kernels);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::reviseLease(ClientSession& session, uint64_t now) {
+    uint32_t kernels = leaseFor(session, now);
+    if (kernels == 0) {
+        dropLease(session);
+    } else {
+        session.channel->shrinkLease(kernels);
+    }
+}
+
+template <typename Policy>
+void Scheduler<Policy>::dropLease(ClientSession& session) {
+    session.channel->shrinkLease(0);
+    if (!session.leaseActive) return;
+    session.leaseActive = false;
+    pool[session.worker]->leases.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::recordCompletions(ClientSession& session, const KsCompletion& msg) {
+    Domain& domain = *domains[session.domain];
+    KsStatsClient* st = session.stats;
+    uint64_t sum = 0;
+    for (uint16_t i = 0; i < msg.count; i++) {
+        const KsCompletionEntry& e = msg.entries[i];
+        settleLedger(session, e.req_id);
+        uint32_t kid = KernelTable::instance().intern(e.kernel_hash, nullptr, 0);
+        if (kid >= session.kernelCosts.size()) {
+            session.kernelCosts.resize(std::max<size_t>(kid + 1, session.kernelCosts.size() * 2));
+        }
+        session.kernelCosts[kid].observe(e.duration_ns);
+        domain.costs.observe(kid, e.duration_ns);
+        domain.policy.onCompletion(session.qos, kid, e.duration_ns);
+        if (stats) stats->countCompletion(kid, e.kernel_hash, KernelTable::instance().name(kid), e.duration_ns);
+        sum += e.duration_ns;
+    }
+    if (st) {
+        ks_stats_add(st->completions, msg.count);
+        ks_stats_add(st->gpu_ns, sum);
+    }
+}
+
+template <typename Policy>
+uint64_t Scheduler<Policy>::estimateCost(const ClientSession& session, uint32_t kid) const {
+    if (kid < session.kernelCosts.size() && session.kernelCosts[kid].samples >= COST_MIN_SAMPLES) {
+        return session.kernelCosts[kid].ewmaNs;
+    }
+    return domains[session.domain]->costs.estimate(kid);
+}
+
+template <typename Policy>
+void Scheduler<Policy>::chargeLedger(ClientSession& session, const KernelRequest& req) {
+    OccupancyLedger& ledger = domains[session.domain]->ledger;
+    unsigned shard = pool[session.worker]->shard;
+    ledger.grant(shard, session.qos.qosClass, session.tracksCompletions, req.costNs);
+    if (!session.tracksCompletions) return;
+    if (session.inflight.size() >= LEDGER_MAX_INFLIGHT) {
+        // 客户端只为部分 kernel 上报完成: 最早的在途 kernel 视为已完成
+        ledger.retire(shard, session.qos.qosClass, 1, session.inflight.front().costNs);
+        session.inflight.pop_front();
+    }
+    session.inflight.push_back(InflightKernel{requestNumber(req), req.costNs});
+}
+
+template <typename Policy>
+void Scheduler<Policy>::settleLedger(ClientSession& session, uint64_t reqId) {
+    if (!session.tracksCompletions) {
+        // 第一条完成消息: 从之后放行的 kernel 开始跟踪
+        session.tracksCompletions = true;
+        return;
+    }
+    // 同一个流上的 kernel 按放行顺序完成, 匹配位置之前的 kernel 也已完成 (客户端可以只上报其中一部分)
+    size_t window = std::min(session.inflight.size(), LEDGER_MATCH_WINDOW);
+    for (size_t i = 0; i < window; i++) {
+        if (session.inflight[i].reqId != reqId) continue;
+        uint64_t work = 0;
+        for (size_t j = 0; j <= i; j++) work += session.inflight[j].costNs;
+        domains[session.domain]->ledger.retire(pool[session.worker]->shard, session.qos.qosClass, i + 1, work);
+        session.inflight.erase(session.inflight.begin(), session.inflight.begin() + i + 1);
+        return;
+    }
+}
+
+template <typename Policy>
+void Scheduler<Policy>::clearLedger(ClientSession& session) {
+    if (session.inflight.empty()) return;
+    uint64_t work = 0;
+    for (const InflightKernel& k : session.inflight) work += k.costNs;
+    domains[session.domain]->ledger.retire(pool[session.worker]->shard, session.qos.qosClass,
+                                           session.inflight.size(), work);
+    session.inflight.clear();
+}
+
+template <typename Policy>
+void Scheduler<Policy>::endSession(ClientSession& session) {
+    // 撤销租约 (热重启时新进程从零开始发放), 已发射的照常记账; worker 的租约计数已随 detachParked 扣除
+    if (session.leases) {
+        session.channel->shrinkLease(0);
+        settleLease(session, nowNs());
+        session.leaseActive = false;
+    }
+    clearLedger(session);
+    domains[session.domain]->policy.onClientLeave(session.qos);
+    if (stats) stats->detach(session.stats);
+    session.stats = nullptr;
+    if (session.logger) {
+        session.logger->mergeKernelStats(session.kernelCounts);
+        session.logger.reset();
+        LogManager::instance().releaseLogger(session.uniqueId);
+    }
+    for (auto& other : session.otherLoggers) {
+        LogManager::instance().releaseLogger(other.first);
+    }
+    session.otherLoggers.clear();
+    std::cout << "[Scheduler] Session #" << session.sessionId << " ended (" << session.clientKey << ")" << std::endl;
+}
+
+std::unique_ptr<IScheduler> createScheduler(const ServerOptions& opts) {
+    const std::string& name = opts.policy.name;
+    if (name == "always-allow") return std::unique_ptr<IScheduler>(new Scheduler<AlwaysAllowPolicy>(opts));
+    if (name == "static-priority") return std::unique_ptr<IScheduler>(new Scheduler<StaticPriorityPolicy>(opts));
+    if (name == "token-bucket") return std::unique_ptr<IScheduler>(new Scheduler<TokenBucketPolicy>(opts));
+    if (name == "round-robin") return std::unique_ptr<IScheduler>(new Scheduler<RoundRobinPolicy>(opts));
+    return std::unique_ptr<IScheduler>(new Scheduler<SloPolicy>(opts));
+}
+
+template class Scheduler<AlwaysAllowPolicy>;
+template class Scheduler<SloPolicy>;
+template class Scheduler<StaticPriorityPolicy>;
+template class Scheduler<TokenBucketPolicy>;
+template class Scheduler<RoundRobinPolicy>;
@@ -1,33 +1,249 @@
 #pragma once
+#include "cost_model.h"
 #include "ipc.h"
+#include "logger.h"
+#include "occupancy.h"
+#include "options.h"
+#include "policy.h"
+#include "stats.h"
+#include "timeline.h"
+#include "timer_wheel.h"
+#include "trace.h"
+#include <deque>
 #include <vector>
 #include <thread>
 #include <atomic>
 #include <map>
 #include <mutex>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <cstdlib>
 
-class Scheduler {
+// 挂起的请求 (KS_CAP_OUT_OF_ORDER 客户端): 已从请求队列取走, 尚未答复
+struct ParkedRequest {
+    uint64_t reqId;
+    uint64_t kernelHash;
+    uint32_t kernelId;
+    uint32_t clientIdNum;
+    uint64_t seenNs;         // 首次取到的时间 (录制与延迟统计用)
+    uint64_t deferSinceNs;   // 该请求的 ClientQos::deferSinceNs
+    uint64_t retryAtNs;      // 策略给出的重新裁决时间, 0 表示只等策略事件
+};
+
+// 每个会话最多挂起的请求数; 达到后新请求留在队列中, 退回按顺序推迟
+constexpr size_t PARK_MAX_PER_SESSION = 1024;
+// 策略没有给出重新裁决时间时的兜底间隔 (防止错过策略事件后一直挂起)
+constexpr uint64_t PARK_RECHECK_NS = 1000000;
+// worker 名下有租约时的轮询间隔: 读取租约内的发射数交给策略, 以及收缩/到期 (客户端在租约内不发消息, 不会唤醒 worker)
+constexpr uint64_t LEASE_POLL_NS = 100000;
+
+// 一个客户端连接的服务状态, 任一时刻只属于一个 worker
+struct ClientSession {
+    std::unique_ptr<IChannel> channel;
+    long long sessionId = 0;
+    std::string clientKey;
+    std::string uniqueId;      // 首条请求携带的 unique_id, 用于日志
+    std::shared_ptr<Logger> logger;   // 按 uniqueId 缓存, 整个会话只查找一次
+    std::unordered_map<std::string, std::shared_ptr<Logger>> otherLoggers;   // 文本协议下消息携带的其他 unique_id
+    bool started = false;      // 是否已 setReady
+    ClientQos qos;             // 策略中的身份与状态
+    uint64_t headSeenNs = 0;   // 队头请求被推迟时, 第一次取到它的时间 (录制与延迟统计用)
+    KsStatsClient* stats = nullptr;   // 统计页中的条目, 只由当前所属 worker 更新
+    unsigned worker = 0;       // 当前所属 worker 的下标 (时间线按 worker 分队列)
+    int numaNode = -1;         // 客户端声明的 NUMA 节点, -1 表示未知
+    size_t domain = 0;         // 所属调度域 (Scheduler::domains 的下标)
+    bool outOfOrder = false;   // 客户端按 reqId 匹配裁决, 被推迟的请求可以挂起
+
+    // 挂起的请求, 按挂起顺序; timerDeadline 为所属 worker 时间轮中本会话最早的登记 (0 表示没有),
+    // 时间轮中与之不符的条目已过时
+    std::vector<ParkedRequest> parked;
+    uint64_t timerDeadline = 0;
+
+    // 已放行、尚未完成的 kernel (按放行顺序), 计入域的占用账本; 收到第一条完成消息后才开始跟踪,
+    // 从不上报完成的客户端不会在账本中累积在途 kernel
+    std::deque<InflightKernel> inflight;
+    bool tracksCompletions = false;
+
+    // 租约 (--lease 且客户端声明 KS_CAP_LEASE); leaseUsed 为已交给策略的 IChannel::leaseUsed,
+    // leaseRenew 表示本批有放行、发出响应前重新发放
+    bool leases = false;
+    bool leaseActive = false;
+    bool leaseRenew = false;
+    uint64_t leaseUsed = 0;
+    uint64_t leaseExpiryNs = 0;
+
+    // 按 kernel id (KernelTable) 计数, 只由当前所属 worker 访问, 会话结束时合并到 Logger
+    std::vector<uint64_t> kernelCounts;
+    // 本客户端各 kernel 的实测耗时 (完成消息), 同样只由所属 worker 访问
+    std::vector<ClientKernelCost> kernelCosts;
+};
+
+// 时间轮中的一个条目: 会话 session 的挂起请求在 deadline 重新裁决
+struct ParkTimer {
+    ClientSession* session;
+    uint64_t deadline;
+};
+
+// 轮询一组通道的调度线程
+struct SchedulerWorker {
+    int index = 0;
+    std::vector<int> cpus;     // 绑定的 CPU, 为空表示不绑核
+    int node = -1;             // 所在的 NUMA 节点, 未绑核或跨节点时为 -1
+    size_t domain = 0;         // 所属调度域, 只服务该域的会话
+    unsigned shard = 0;        // 在域内的序号, 即写入占用账本的分片
+    std::thread thread;
+
+    // 新分配/迁入的会话, 由 worker 在下一轮循环中领取
+    std::mutex inboxMutex;
+    std::vector<std::unique_ptr<ClientSession>> inbox;
+
+    // 进程内 futex: 有新会话、需要再平衡或停止时递增并唤醒
+    std::atomic<uint32_t> doorbell{0};
+    std::atomic<size_t> load{0};       // 拥有的会话数 (含 inbox)
+    std::atomic<int> donateTo{-1};     // 再平衡: 请求把一个会话转交给该 worker (同一域内)
+    std::atomic<size_t> parked{0};     // 名下会话挂起的请求数; 策略事件发生时只唤醒有挂起请求的 worker
+    std::atomic<size_t> leases{0};     // 名下持有未到期租约的会话数; 租约需要收缩时只唤醒有租约的 worker
+
+    TimerWheel<ParkTimer> timers;      // 挂起请求的重新裁决时间, 只由 worker 线程访问
+};
+
+// 调度器的运行期接口, 供 IPC 层与 main 使用; 具体策略在编译期选定
+class IScheduler {
 public:
-    Scheduler();
-    ~Scheduler();
+    virtual ~IScheduler() = default;
 
     // 收到新连接的回调
-    void onNewClient(std::unique_ptr<IChannel> channel);
-    
+    virtual void onNewClient(std::unique_ptr<IChannel> channel) = 0;
+
     // 停止所有服务
-    void stop();
-    
+    virtual void stop() = 0;
+
+    // 热重启: 停止所有服务, 通道与请求环中未取走的请求留给接管的新进程; 已取走、尚未答复 (挂起) 的请求先放行
+    virtual void handOver() = 0;
+
     // 获取活跃连接数
-    size_t getActiveCount();
+    virtual size_t getActiveCount() = 0;
+};
+
+/**
+ * @brief 以策略类型为模板参数的调度器
+ * 策略接口见 policy.h; 每个请求对 Policy::onRequest 的调用在编译期绑定并可内联
+ * 成员函数定义在 scheduler.cpp 中, 并为每个内置策略显式实例化
+ */
+template <typename Policy>
+class Scheduler : public IScheduler {
+public:
+    explicit Scheduler(const ServerOptions& opts = ServerOptions());
+    ~Scheduler() override;
+
+    void onNewClient(std::unique_ptr<IChannel> channel) override;
+    void stop() override;
+    void handOver() override;
+    size_t getActiveCount() override;
 
 private:
-    void clientHandler(std::unique_ptr<IChannel> channel);
-    
+    /**
+     * @brief 一个 GPU 的调度域
+     * 每个设备有独立的策略实例、worker 组与分配锁, 不同设备的客户端之间不共享任何调度状态
+     */
+    struct alignas(CACHE_LINE_SIZE) Domain {
+        Domain(int device, const PolicyOptions& opts, unsigned workers)
+            : device(device), ledger(workers), policy(opts, ledger) {}
+
+        // 策略中有按 cache line 对齐的成员, C++11 的 new 不保证对齐
+        static void* operator new(size_t size) {
+            void* p = nullptr;
+            if (posix_memalign(&p, CACHE_LINE_SIZE, size) != 0) throw std::bad_alloc();
+            return p;
+        }
+        static void operator delete(void* p) { free(p); }
+
+        int device;
+        OccupancyLedger ledger;                  // 域内所有 worker 共享的占用账本, 每个 worker 一个分片
+        Policy policy;
+        KernelCostModel costs;                   // 本设备上各 kernel 的实测耗时
+        std::mutex mutex;                        // 新会话分配与再平衡
+        std::vector<SchedulerWorker*> workers;
+    };
+
+    // 客户端设备对应的域的下标; 未配置的设备归入第一个域
+    size_t domainFor(int device);
+
+    void workerLoop(SchedulerWorker* worker);
+
+    // 一轮轮询中待发出的响应 (栈上)
+    struct ReplyBatch {
+        MsgView replies[SPSC_MAX_BATCH];
+        char responses[SPSC_MAX_BATCH][SPSC_MSG_SIZE];
+        uint64_t seenNs[SPSC_MAX_BATCH];
+        TimelineEvent events[SPSC_MAX_BATCH];
+        size_t count = 0;
+    };
+
+    // 处理一个会话当前就绪的请求; 返回处理条数, -1 表示连接已断开
+    int serviceSession(SchedulerWorker* worker, ClientSession& session);
+    // 记录一条已裁决 (放行或拒绝) 的请求并把响应加入 batch; batch 满时先发出
+    void answer(ClientSession& session, const KernelRequest& req, const Decision& decision, uint64_t seenNs,
+                ReplyBatch& batch);
+    void flushReplies(ClientSession& session, ReplyBatch& batch);
+    // 无法解析的消息: 计数后丢弃; 二进制请求的 req_id 可读时以 KS_REASON_PROTOCOL 拒绝, 客户端不必等到超时
+    void rejectMalformed(ClientSession& session, const MsgView& msg, uint64_t now, ReplyBatch& batch);
+    // 挂起一条被推迟的请求, 已从请求队列取走
+    void park(SchedulerWorker* worker, ClientSession& session, const KernelRequest& req, const Decision& decision,
+              uint64_t now);
+    // 重新裁决会话的全部挂起请求, 放行/拒绝的加入 batch
+    void retryParked(SchedulerWorker* worker, ClientSession& session, uint64_t now, ReplyBatch& batch);
+    // 交接时放行会话的全部挂起请求: 新进程看不到已从请求环取走的请求
+    void grantParked(SchedulerWorker* worker, ClientSession& session);
+    KernelRequest unpark(const ClientSession& session, const ParkedRequest& p) const;
+    // 按最早的重新裁决时间在时间轮中登记
+    void armTimer(SchedulerWorker* worker, ClientSession& session, uint64_t now);
+    // 会话离开本 worker (结束或迁出): 删除时间轮中引用它的条目, 挂起计数与租约计数随会话转移
+    void detachParked(SchedulerWorker* worker, ClientSession& session);
+    // 租约: 放行后按策略重新发放; 把客户端在租约内的发射交给策略; 按策略收缩 (leaseEpoch 变化或 tick)
+    void renewLease(ClientSession& session, uint64_t now);
+    void settleLease(ClientSession& session, uint64_t now);
+    void reviseLease(ClientSession& session, uint64_t now);
+    uint32_t leaseFor(ClientSession& session, uint64_t now);
+    void dropLease(ClientSession& session);
+    void endSession(ClientSession& session);
+    // 处理一条完成消息: 更新代价模型并通知策略
+    void recordCompletions(ClientSession& session, const KsCompletion& msg);
+    // 退出时按设备输出累计 GPU 时间最多的 kernel
+    void reportCosts();
+    // 请求的估计 GPU 时间: 本客户端的样本足够时用其 EWMA, 否则用域内的 EWMA
+    uint64_t estimateCost(const ClientSession& session, uint32_t kid) const;
+    // 占用账本: 放行一个 kernel; 完成记录 reqId 结清该 kernel 及更早放行的 kernel; 会话结束时结清全部
+    void chargeLedger(ClientSession& session, const KernelRequest& req);
+    void settleLedger(ClientSession& session, uint64_t reqId);
+    void clearLedger(ClientSession& session);
+
+    // 把会话交给指定 worker
+    void assign(SchedulerWorker* worker, std::unique_ptr<ClientSession> session);
+    void ring(SchedulerWorker* worker);
+    // 客户端离开后, 域内同一节点的 worker 之间负载差超过 1 时从最忙的迁移一个会话到最闲的
+    void rebalance(Domain& domain);
+    // 所有通道空闲时的等待
+    void idleWait(SchedulerWorker* worker, std::vector<std::unique_ptr<ClientSession>>& sessions,
+                  Backoff& backoff, uint32_t doorbellSeq);
+
     // 业务逻辑
-    std::pair<bool, std::string> makeDecision(const std::string& kernelType);
+    Decision makeDecision(const KernelRequest& req, ClientSession& session, uint64_t now);
+
+    ServerOptions options;
+    std::vector<std::unique_ptr<Domain>> domains;   // 按 options.devices 的顺序, 构造后不再改变
+    std::unique_ptr<TraceRecorder> recorder;   // --record
+    std::unique_ptr<StatsPage> stats;          // 为空表示 --no-stats 或统计页创建失败
+    std::unique_ptr<TimelineWriter> timeline;  // --timeline
 
     // 线程管理
     std::atomic<bool> running{true};
-    std::mutex threadsMutex;
-    std::vector<std::thread> workers;
-};
\ No newline at end of file
+    std::atomic<bool> handingOver{false};
+    std::mutex poolMutex;                            // 只用于 stop
+    std::vector<std::unique_ptr<SchedulerWorker>> pool;   // 所有域的 worker, 构造后不再改变
+    std::atomic<size_t> activeSessions{0};
+};
+
+// 按 options.policy.name 创建调度器
+std::unique_ptr<IScheduler> createScheduler(const ServerOptions& opts);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+// ============================================================
+//  共享内存段的后备存储: POSIX shm (/dev/shm) 或 hugetlbfs
+// ============================================================
+//
+// 同名的段在 hugetlbfs 上是 <ks_hugetlbfs_dir()><name> 文件 (name 以 '/' 开头),
+// 映射后由大页支撑 (hugetlbfs 上的文件不需要 MAP_HUGETLB), 轮询路径上的 TLB miss 更少.
+// 大页不足或未挂载 hugetlbfs 时调用者退回 /dev/shm
+
+// hugetlbfs 挂载点, 可用环境变量 KS_HUGETLBFS 覆盖 (服务端与客户端须一致)
+inline std::string ks_hugetlbfs_dir() {
+    const char* d = std::getenv("KS_HUGETLBFS");
+    return (d && *d) ? d : "/dev/hugepages";
+}
+
+inline std::string ks_segment_path(const std::string& name) {
+    return ks_hugetlbfs_dir() + name;
+}
+
+inline int ks_segment_open(const std::string& name, bool hugetlb, int flags, mode_t mode) {
+    if (hugetlb) return ::open(ks_segment_path(name).c_str(), flags | O_CLOEXEC, mode);
+    return shm_open(name.c_str(), flags, mode);
+}
+
+inline int ks_segment_unlink(const std::string& name, bool hugetlb) {
+    if (hugetlb) return ::unlink(ks_segment_path(name).c_str());
+    return shm_unlink(name.c_str());
+}
+
+// 段的页大小: hugetlbfs 上为大页大小, 映射长度与 ftruncate 的长度都须是它的整数倍
+inline size_t ks_segment_page_size(int fd) {
+    struct statfs fs;
+    if (fstatfs(fd, &fs) == 0 && fs.f_bsize > 0) return static_cast<size_t>(fs.f_bsize);
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+inline size_t ks_round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
@@ -1,91 +1,162 @@
 #include "ipc.h"
 #include "logger.h"
 #include "shm_core.h"
+#include "segment.h"
 
 #include <iostream>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cerrno>
 #include <csignal>
 #include <sstream>
+#include <chrono>
 
 // ======================= ShmChannel =======================
 
-ShmChannel::ShmChannel(ClientChannelStruct* ptr, std::string name, std::string type, std::string id, pid_t pid)
-    : channelPtr(ptr), shmName(name), clientType(type), uniqueId(id), clientPid(pid) {}
+ShmChannel::ShmChannel(std::shared_ptr<ClientChannelStruct> mapping, uint32_t requestRingBytes,
+                       uint32_t responseRingBytes, std::string name, bool hugetlb, std::string type, std::string id,
+                       pid_t pid, int numaNode, int device, uint32_t qosClass, uint32_t weight,
+                       const WaitStrategy& wait, std::shared_ptr<LivenessState> liveness)
+    : channelPtr(mapping.get()), mapping(std::move(mapping)), liveness(std::move(liveness)),
+      requestRing(ks_channel_request_ring(channelPtr, requestRingBytes)),
+      responseRing(ks_channel_response_ring(channelPtr, requestRingBytes, responseRingBytes)), shmName(name),
+      hugetlb(hugetlb), clientType(type), uniqueId(id), clientPid(pid), numaNode(numaNode), device(device),
+      qosClass(qosClass), weight(weight), waitStrategy(wait) {}
 
 ShmChannel::~ShmChannel() {
     if (channelPtr) {
         channelPtr->scheduler_ready.store(false, std::memory_order_release);
-        munmap(channelPtr, sizeof(ClientChannelStruct));
     }
+    // 映射由存活监视共同持有, 监视撤销后才真正 munmap
+    if (liveness) liveness->closed.store(true, std::memory_order_release);
 }
 
 void ShmChannel::unlink() {
-    shm_unlink(shmName.c_str());
+    ks_segment_unlink(shmName, hugetlb);
 }
 
 void ShmChannel::setReady() {
-    if (channelPtr) channelPtr->scheduler_ready.store(true, std::memory_order_release);
+    if (!channelPtr) return;
+    channelPtr->scheduler_ready.store(true, std::memory_order_release);
+    // 客户端在 connect 中于 response_futex 上等待接纳
+    notifyClient();
 }
 
+void ShmChannel::grantLease(uint32_t kernels, uint64_t expiryNs) {
+    // 客户端先读额度再核对到期时间
+    channelPtr->lease_expiry_ns.store(expiryNs, std::memory_order_relaxed);
+    channelPtr->lease_credits.store(kernels, std::memory_order_release);
+}
+
+void ShmChannel::shrinkLease(uint32_t kernels) {
+    uint32_t credits = channelPtr->lease_credits.load(std::memory_order_relaxed);
+    while (credits > kernels &&
+           !channelPtr->lease_credits.compare_exchange_weak(credits, kernels, std::memory_order_acq_rel)) {
+    }
+}
+
+// 热路径上调用, 不做系统调用: 进程存活由 LivenessMonitor 在后台检查
 bool ShmChannel::isConnected() {
     if (!channelPtr)
         return false;
-    if (!channelPtr->client_connected.load(std::memory_order_acquire))
-        return false;
-    if (clientPid > 0 && kill(clientPid, 0) != 0 && errno != EPERM)
+    if (liveness && liveness->dead.load(std::memory_order_acquire))
         return false;
-    return true;
+    return channelPtr->client_connected.load(std::memory_order_acquire);
 }
 
-bool ShmChannel::spsc_try_pop(char* out_data, size_t max_len) {
-    auto& q = channelPtr->request_queue;
-    uint64_t head = q.head.load(std::memory_order_relaxed);
-    if (head == q.tail.load(std::memory_order_acquire)) return false;
+// 取走所有已就绪的消息 (最多 max_msgs 条, 不推进 head), 记下每条记录的结束位置供归还
+size_t ShmChannel::spsc_try_peek_batch(MsgView* out, size_t max_msgs) {
+    auto& q = requestRing;
+    uint64_t pos = q.q->head.load(std::memory_order_relaxed);
+    if (max_msgs > SPSC_MAX_BATCH) max_msgs = SPSC_MAX_BATCH;
+    size_t n = 0;
+    while (n < max_msgs && (out[n].data = q.peek(pos, out[n].len)) != nullptr) {
+        peekEnds[n++] = pos;
+    }
+    return n;
+}
 
-    size_t copy_len = strlen(q.buffer[head]);
-    if (copy_len >= max_len) copy_len = max_len - 1;
-    memcpy(out_data, q.buffer[head], copy_len);
-    out_data[copy_len] = '\0';
+// 归还最近一次 peek 取到的前 n 条消息, 只发布一次 head
+void ShmChannel::spsc_release(size_t n) {
+    requestRing.release(peekEnds[n - 1]);
+}
 
-    q.head.store((head + 1) % SPSC_QUEUE_SIZE, std::memory_order_release);
-    return true;
+// 尽可能多地写入消息, 只发布一次 tail, 返回写入条数
+size_t ShmChannel::spsc_try_push_batch(const MsgView* msgs, size_t n) {
+    auto& q = responseRing;
+    uint64_t pos = q.q->tail.load(std::memory_order_relaxed);
+    size_t done = 0;
+    for (; done < n; done++) {
+        size_t len = msgs[done].len < SPSC_MSG_SIZE ? msgs[done].len : SPSC_MSG_SIZE;
+        char* slot = q.claim(pos, len);
+        if (!slot) break;
+        memcpy(slot, msgs[done].data, len);
+    }
+    if (done) q.publish(pos);
+    return done;
 }
 
-bool ShmChannel::spsc_try_push(const char* data, size_t len) {
-    auto& q = channelPtr->response_queue;
-    uint64_t tail = q.tail.load(std::memory_order_relaxed);
-    uint64_t next_tail = (tail + 1) % SPSC_QUEUE_SIZE;
-    if (next_tail == q.head.load(std::memory_order_acquire)) return false;
+bool ShmChannel::requestReady() {
+    return requestRing.readable();
+}
 
-    size_t copy_len = (len < SPSC_MSG_SIZE - 1) ? len : (SPSC_MSG_SIZE - 1);
-    memcpy(q.buffer[tail], data, copy_len);
-    q.buffer[tail][copy_len] = '\0';
+void ShmChannel::notifyClient() {
+    ks_notify_peer(channelPtr->response_futex, channelPtr->client_parked);
+}
 
-    q.tail.store(next_tail, std::memory_order_release);
-    return true;
+size_t ShmChannel::tryRecvBatch(MsgView* out, size_t maxMsgs) {
+    return spsc_try_peek_batch(out, maxMsgs);
 }
 
-bool ShmChannel::recvBlocking(std::string& outMsg) {
-    char buffer[SPSC_MSG_SIZE];
-    // 忙等待实现，保留原有的性能特性
-    while (!spsc_try_pop(buffer, SPSC_MSG_SIZE)) {
-        if (!isConnected()) return false;
-        __asm__ __volatile__("pause" ::: "memory");
+WaitPrep ShmChannel::prepareWait(WaitHandle& handle) {
+    if (!(channelPtr->client_caps.load(std::memory_order_relaxed) & KS_CAP_FUTEX_WAKE)) {
+        return WaitPrep::Unsupported;
     }
-    outMsg = std::string(buffer);
-    return true;
+    handle.futexWord = &channelPtr->request_futex;
+    handle.expected = channelPtr->request_futex.load(std::memory_order_acquire);
+    channelPtr->server_parked.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (requestReady()) {
+        channelPtr->server_parked.store(0, std::memory_order_relaxed);
+        return WaitPrep::Ready;
+    }
+    return WaitPrep::Parked;
+}
+
+void ShmChannel::finishWait() {
+    channelPtr->server_parked.store(0, std::memory_order_relaxed);
 }
 
-bool ShmChannel::sendBlocking(const std::string& msg) {
-    // 简单的超时机制 (例如 5秒)
-    int attempts = 0;
-    while (!spsc_try_push(msg.c_str(), msg.length())) {
-        if (attempts++ > 5000000) return false;
-        __asm__ __volatile__("pause" ::: "memory");
+void ShmChannel::releaseBatch(size_t n) {
+    if (n > 0) spsc_release(n);
+}
+
+// 响应队列满 (客户端未及时消费) 时的超时
+static const auto SEND_TIMEOUT = std::chrono::seconds(5);
+
+bool ShmChannel::sendBatch(const MsgView* msgs, size_t n) {
+    Backoff backoff(waitStrategy);
+    auto start = std::chrono::steady_clock::now();
+    bool pushed = false;
+    while (n > 0) {
+        size_t sent = spsc_try_push_batch(msgs, n);
+        msgs += sent;
+        n -= sent;
+        if (sent > 0) {
+            pushed = true;
+            continue;
+        }
+        if (pushed) {
+            // 已写入的部分先唤醒客户端, 否则它不会腾出空间
+            notifyClient();
+            pushed = false;
+        }
+        if (std::chrono::steady_clock::now() - start > SEND_TIMEOUT) return false;
+        backoff.pauseNoFutex();
     }
+    if (pushed) notifyClient();
     return true;
 }
 
@@ -96,123 +167,382 @@ std::string get_user_suffix() {
     return (u && *u) ? std::string("_") + u : "_nouser";
 }
 
-ShmServer::ShmServer() : running(false), registry(nullptr) {}
+ShmServer::ShmServer(const WaitStrategy& wait, bool hugePages, bool takeover)
+    : running(false), registry(nullptr), registryBytes(0), hugePages(hugePages), registryHugetlb(false),
+      waitStrategy(wait), takeover(takeover), slotGeneration() {}
 
 std::string ShmServer::getRegistryName() {
     return std::string(SHM_NAME_SCHEDULER) + get_user_suffix();
 }
 
-bool ShmServer::init() {
+// 创建并映射 registry 段, 失败时返回 nullptr
+static void* createRegistry(const std::string& name, bool hugetlb, size_t& mapped) {
+    int fd = ks_segment_open(name, hugetlb, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        if (!hugetlb) perror("shm_open registry");
+        return nullptr;
+    }
+    mapped = ks_round_up(sizeof(ClientRegistry), ks_segment_page_size(fd));
+    if (ftruncate(fd, mapped) == -1) {
+        if (!hugetlb) perror("ftruncate registry");
+        close(fd);
+        return nullptr;
+    }
+    void* ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+static bool processAlive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+// 旧进程须在此时间内停止所有 worker 并交出
+static const auto HANDOVER_TIMEOUT = std::chrono::seconds(10);
+static const uint32_t HANDOVER_POLL_US = 100000;
+
+bool ShmServer::attachRegistry() {
+    // 与客户端相同: 先找 /dev/shm, 再找 hugetlbfs
     std::string name = getRegistryName();
-    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0666);
+    bool hugetlb = false;
+    int fd = ks_segment_open(name, false, O_RDWR, 0666);
     if (fd == -1) {
-        perror("shm_open registry");
+        hugetlb = true;
+        fd = ks_segment_open(name, true, O_RDWR, 0666);
+    }
+    // 正常退出的服务端会删除 registry, 没有即无可接管
+    if (fd == -1) return true;
+
+    struct stat st;
+    size_t mapped = ks_round_up(sizeof(ClientRegistry), ks_segment_page_size(fd));
+    void* ptr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ClientRegistry)) {
+        ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr != MAP_FAILED && !static_cast<ClientRegistry*>(ptr)->layoutValid()) {
+        munmap(ptr, mapped);
+        ptr = MAP_FAILED;
+    }
+    if (ptr == MAP_FAILED) {
+        std::cerr << "[ShmServer] Registry " << name << " has an unsupported layout (running scheduler built against a "
+                  << "different config.h?), stop it and start without --takeover" << std::endl;
         return false;
     }
-    if (ftruncate(fd, sizeof(ClientRegistry)) == -1) {
-        perror("ftruncate registry");
-        close(fd);
+
+    registry = static_cast<ClientRegistry*>(ptr);
+    registryBytes = mapped;
+    registryHugetlb = hugetlb;
+    if (!awaitHandover(static_cast<pid_t>(registry->server_pid.load(std::memory_order_acquire)))) {
+        munmap(registry, registryBytes);
+        registry = nullptr;
         return false;
     }
-    void* ptr = mmap(nullptr, sizeof(ClientRegistry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    close(fd);
-    if (ptr == MAP_FAILED) return false;
+    registry->server_pid.store(getpid(), std::memory_order_relaxed);
+    registry->takeover_pid.store(0, std::memory_order_relaxed);
+    registry->handover.store(KS_HANDOVER_NONE, std::memory_order_relaxed);
+    registry->scheduler_ready.store(true, std::memory_order_release);
+    adopted = true;
+    return true;
+}
+
+// 交接流程的新进程一侧 (见 config.h 中的 ClientRegistry)
+bool ShmServer::awaitHandover(pid_t owner) {
+    if (owner == getpid() || !processAlive(owner)) {
+        std::cout << "[ShmServer] Previous scheduler (pid " << owner << ") is gone, taking over its registry" << std::endl;
+        return true;
+    }
+    // 上一个请求接管的进程已退出时可以覆盖它的请求
+    int64_t other = registry->takeover_pid.load(std::memory_order_acquire);
+    if ((other != 0 && processAlive(static_cast<pid_t>(other))) ||
+        !registry->takeover_pid.compare_exchange_strong(other, getpid(), std::memory_order_acq_rel)) {
+        std::cerr << "[ShmServer] Another takeover is in progress (pid " << other << ")" << std::endl;
+        return false;
+    }
+
+    std::cout << "[ShmServer] Requesting handover from scheduler pid " << owner << std::endl;
+    registry->handover.store(KS_HANDOVER_REQUESTED, std::memory_order_release);
+    registry->version.fetch_add(1, std::memory_order_release);
+    ks_futex_wake(&registry->version);
+
+    auto deadline = std::chrono::steady_clock::now() + HANDOVER_TIMEOUT;
+    while (registry->handover.load(std::memory_order_acquire) != KS_HANDOVER_RELEASED) {
+        // 旧进程在交接中途退出: 请求环中未取走的请求仍在, 直接接管
+        if (!processAlive(owner)) break;
+        if (std::chrono::steady_clock::now() > deadline) {
+            std::cerr << "[ShmServer] Scheduler pid " << owner << " did not hand over within "
+                      << std::chrono::duration_cast<std::chrono::seconds>(HANDOVER_TIMEOUT).count() << "s" << std::endl;
+            uint32_t requested = KS_HANDOVER_REQUESTED;
+            registry->handover.compare_exchange_strong(requested, KS_HANDOVER_NONE, std::memory_order_acq_rel);
+            registry->takeover_pid.store(0, std::memory_order_release);
+            return false;
+        }
+        ks_futex_wait(&registry->handover, KS_HANDOVER_REQUESTED, HANDOVER_POLL_US);
+    }
+    std::cout << "[ShmServer] Scheduler pid " << owner << " handed over" << std::endl;
+    return true;
+}
+
+void ShmServer::handOver() {
+    stop();
+    if (!registry) return;
+    handedOver = true;
+    std::cout << "[ShmServer] Handing over to scheduler pid " << registry->takeover_pid.load(std::memory_order_relaxed)
+              << std::endl;
+    registry->handover.store(KS_HANDOVER_RELEASED, std::memory_order_release);
+    ks_futex_wake(&registry->handover);
+}
+
+bool ShmServer::init() {
+    std::string name = getRegistryName();
+    if (takeover) {
+        if (!attachRegistry()) return false;
+        if (registry) {
+            std::cout << "[ShmServer] Registry taken over: "
+                      << (registryHugetlb ? ks_segment_path(name) + " (hugetlbfs)" : name) << std::endl;
+            return true;
+        }
+        std::cout << "[ShmServer] No scheduler to take over, starting a new registry" << std::endl;
+    }
+    void* ptr = nullptr;
+    if (hugePages) {
+        // 客户端先找 /dev/shm, 删掉上次留下的同名段, 以免客户端连到旧的 registry
+        shm_unlink(name.c_str());
+        ptr = createRegistry(name, true, registryBytes);
+        if (ptr) {
+            registryHugetlb = true;
+        } else {
+            ks_segment_unlink(name, true);
+            std::cerr << "[ShmServer] Cannot create registry on hugetlbfs " << ks_hugetlbfs_dir()
+                      << " (mounted? free huge pages?), falling back to /dev/shm" << std::endl;
+        }
+    }
+    if (!ptr) ptr = createRegistry(name, false, registryBytes);
+    if (!ptr) return false;
 
     registry = static_cast<ClientRegistry*>(ptr);
     registry->init();
+    registry->server_pid.store(getpid(), std::memory_order_relaxed);
     registry->scheduler_ready.store(true, std::memory_order_release);
     
-    std::cout << "[ShmServer] Registry initialized: " << name << std::endl;
+    std::cout << "[ShmServer] Registry initialized: "
+              << (registryHugetlb ? ks_segment_path(name) + " (hugetlbfs)" : name) << std::endl;
     return true;
 }
 
 ShmServer::~ShmServer() {
     stop();
-    if (registry) {
+    // 已交给新进程: registry 与其中的登记继续由新进程使用
+    if (registry && handedOver) {
+        munmap(registry, registryBytes);
+    } else if (registry) {
         registry->scheduler_ready.store(false, std::memory_order_release);
-        munmap(registry, sizeof(ClientRegistry));
-        shm_unlink(getRegistryName().c_str());
+        munmap(registry, registryBytes);
+        ks_segment_unlink(getRegistryName(), registryHugetlb);
     }
 }
 
 void ShmServer::start(std::function<void(std::unique_ptr<IChannel>)> onNewClient) {
     callback = onNewClient;
+    if (!liveness.start()) {
+        std::cerr << "[ShmServer] Liveness monitor unavailable, crashed clients will not be detected" << std::endl;
+    }
     running.store(true);
+    if (adopted) {
+        // 接管的登记没有待处理的通知, 按新登记重新发现所有 active 的槽位
+        uint64_t active = 0;
+        for (size_t i = 0; i < MAX_REGISTERED_CLIENTS; i++) {
+            if (registry->entries[i].active.load(std::memory_order_acquire)) active |= 1ull << i;
+        }
+        registry->dirty_slots.fetch_or(active, std::memory_order_release);
+    }
     scannerThread = std::thread(&ShmServer::scannerLoop, this);
 }
 
 void ShmServer::stop() {
     running.store(false);
+    if (registry) {
+        // 改变 version 后再唤醒, 扫描线程即使尚未进入 futex 休眠也不会错过
+        registry->version.fetch_add(1, std::memory_order_release);
+        ks_futex_wake(&registry->version);
+    }
     if (scannerThread.joinable()) scannerThread.join();
+    // 监视线程的回调会访问 registry, 须在 registry 解除映射之前停止
+    liveness.stop();
 }
 
+// 兜底超时, 正常情况下扫描线程由客户端在 version 上唤醒
+static const uint32_t SCANNER_TIMEOUT_US = 1000000;
+
 void ShmServer::scannerLoop() {
-    uint32_t lastVersion = 0;
     while (running.load()) {
         if (!registry) { usleep(100000); continue; }
 
-        uint32_t currentVersion = registry->version.load(std::memory_order_acquire);
-        if (currentVersion != lastVersion) {
-            for (size_t i = 0; i < MAX_REGISTERED_CLIENTS; i++) {
-                if (registry->entries[i].active.load(std::memory_order_acquire)) {
-                    discoverClient(i);
-                }
-            }
-            lastVersion = currentVersion;
+        // 先读 version 再取走 dirty_slots: 之后的登记一定会改变 version, futex 等待会立即返回
+        uint32_t seen = registry->version.load(std::memory_order_acquire);
+        // 新进程请求接管 (在 version 上唤醒): 交给上层停止服务, 之后由 handOver 完成交接
+        if (!handoverSeen.load(std::memory_order_relaxed) &&
+            registry->handover.load(std::memory_order_acquire) == KS_HANDOVER_REQUESTED) {
+            handoverSeen.store(true, std::memory_order_release);
+            std::cout << "[ShmServer] Scheduler pid " << registry->takeover_pid.load(std::memory_order_relaxed)
+                      << " requested a handover" << std::endl;
+            if (handoverHandler) handoverHandler();
+        }
+        uint64_t dirty = registry->dirty_slots.exchange(0, std::memory_order_acq_rel);
+        while (dirty) {
+            int slot = __builtin_ctzll(dirty);
+            dirty &= dirty - 1;
+            updateSlot(slot);
         }
-        cleanupDisconnected();
-        usleep(100000);
+        ks_futex_wait(&registry->version, seen, SCANNER_TIMEOUT_US);
     }
 }
 
-void ShmServer::discoverClient(int slot) {
-    std::lock_guard<std::mutex> lock(internalMutex);
-    
-    // 检查是否已经在服务 (简单检查，实际生产可能需要更复杂的映射)
-    for (int s : activeSlots) {
-        if (s == slot)
-            return;
+void ShmServer::updateSlot(int slot) {
+    auto& entry = registry->entries[slot];
+    if (!entry.active.load(std::memory_order_acquire)) {
+        // 注销; 对应的会话由 Scheduler 在通道断开时结束
+        slotGeneration[slot] = 0;
+        return;
     }
+    // generation 为 0 或奇数表示客户端还在填写条目 (或正在注销), 写完后会再次置位
+    uint32_t gen = entry.generation.load(std::memory_order_acquire);
+    if (gen == 0 || (gen & 1) || gen == slotGeneration[slot])
+        return;
+    // 新的登记 (包括槽位在两次唤醒之间被注销后又被复用)
+    slotGeneration[slot] = gen;
+    discoverClient(slot);
+}
 
+// 与客户端登记/注销相同的通知流程 (见 config.h 中的 ClientRegistry)
+void ShmServer::markSlotDirty(int slot) {
+    registry->dirty_slots.fetch_or(1ull << slot, std::memory_order_release);
+    registry->version.fetch_add(1, std::memory_order_release);
+    ks_futex_wake(&registry->version);
+}
+
+// 在存活监视线程中调用
+void ShmServer::onClientDeath(int slot, uint32_t generation, pid_t pid, const std::string& shmName, bool hugetlb,
+                              ClientChannelStruct* channel) {
+    // 正常退出的客户端会先清 client_connected 再注销并删除自己的段, 此后槽位可能已被他人复用
+    if (!channel->client_connected.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    std::cout << "[ShmServer] Client pid " << pid << " (" << shmName << ") exited without closing, releasing slot "
+              << slot << std::endl;
+    // 唤醒可能正在 futex 上等待该通道的 worker, 让它立即结束会话
+    channel->request_futex.fetch_add(1, std::memory_order_release);
+    ks_futex_wake(&channel->request_futex);
+    ks_segment_unlink(shmName, hugetlb);
+
+    // 崩溃的客户端从未清 active, 槽位不可能被复用, generation 相同即仍是它的登记;
+    // 与客户端注销相同, 先把 generation 置为奇数再清 active
+    auto& entry = registry->entries[slot];
+    uint32_t expected = generation;
+    if (entry.generation.compare_exchange_strong(expected, generation | 1, std::memory_order_acq_rel)) {
+        entry.active.store(false, std::memory_order_release);
+        markSlotDirty(slot);
+    }
+}
+
+void ShmServer::discoverClient(int slot) {
     auto& entry = registry->entries[slot];
     std::string shmName(entry.shm_name);
+    bool hugetlb = entry.channel_flags.load(std::memory_order_relaxed) & KS_SEGMENT_HUGETLB;
+    std::string clientType(entry.client_type);
+    std::string uniqueId(entry.unique_id);
+    pid_t pid = static_cast<pid_t>(entry.client_pid.load(std::memory_order_relaxed));
+    int numaNode = entry.numa_node.load(std::memory_order_relaxed);
+    int device = entry.device.load(std::memory_order_relaxed);
+    uint32_t qosClass = entry.qos_class.load(std::memory_order_relaxed);
+    uint32_t weight = entry.weight.load(std::memory_order_relaxed);
+    // 顺序锁的读端: 读取期间客户端注销或槽位被复用则放弃, 新的登记写完后会再次置位
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.generation.load(std::memory_order_relaxed) != slotGeneration[slot])
+        return;
     
     // 打开客户端通道
-    int fd = shm_open(shmName.c_str(), O_RDWR, 0666);
+    int fd = ks_segment_open(shmName, hugetlb, O_RDWR, 0666);
     if (fd == -1) 
         return;
 
-    void* ptr = mmap(nullptr, sizeof(ClientChannelStruct), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // 先只映射结构部分, 校验布局标识与几何之后再映射整个段
+    struct stat st;
+    size_t pageSize = ks_segment_page_size(fd);
+    size_t headerMap = ks_round_up(KS_CHANNEL_HEADER_BYTES, pageSize);
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < headerMap) {
+        std::cerr << "[ShmServer] Channel " << shmName << " too small (client built against an old config.h?)" << std::endl;
+        close(fd);
+        return;
+    }
+    void* ptr = mmap(nullptr, headerMap, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    const ClientChannelStruct* header = static_cast<const ClientChannelStruct*>(ptr);
+    uint32_t magic = header->layout_magic;
+    uint32_t layout = header->layout_version;
+    uint32_t requestRingBytes = header->request_ring_bytes;
+    uint32_t responseRingBytes = header->response_ring_bytes;
+    munmap(ptr, headerMap);
+
+    // 旧布局的段同样能通过大小检查, 需要核对布局标识
+    if (magic != KS_CHANNEL_MAGIC || layout != KS_CHANNEL_LAYOUT) {
+        std::cerr << "[ShmServer] Channel " << shmName << " has an unsupported layout (client built against an old config.h?)" << std::endl;
+        close(fd);
+        return;
+    }
+    if (!spsc_ring_bytes_valid(requestRingBytes) || !spsc_ring_bytes_valid(responseRingBytes)) {
+        std::cerr << "[ShmServer] Channel " << shmName << " has invalid ring sizes " << requestRingBytes << "/"
+                  << responseRingBytes << " (must be powers of two in [" << SPSC_RING_MIN_BYTES << ", "
+                  << SPSC_RING_MAX_BYTES << "])" << std::endl;
+        close(fd);
+        return;
+    }
+    // 段必须覆盖两个环, 否则访问尾部会 SIGBUS
+    size_t mapBytes = ks_round_up(ks_channel_bytes(requestRingBytes, responseRingBytes), pageSize);
+    if (static_cast<size_t>(st.st_size) < mapBytes) {
+        std::cerr << "[ShmServer] Channel " << shmName << " is " << st.st_size << " bytes, rings need "
+                  << mapBytes << std::endl;
+        close(fd);
+        return;
+    }
+
+    ptr = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     close(fd);
-    
-    if (ptr != MAP_FAILED) {
-        activeSlots.push_back(slot);
-        
-        auto channel = std::unique_ptr<IChannel>(new ShmChannel(
-            static_cast<ClientChannelStruct*>(ptr),
-            shmName,
-            entry.client_type,
-            entry.unique_id,
-            static_cast<pid_t>(entry.client_pid)
-        ));
-        
-        // 通知上层
-        if (callback) callback(std::move(channel));
-    }
-}
-
-// 这里的逻辑简化：只负责清理 registry 中的 active 标志
-// 实际的 Channel 对象生命周期由 Scheduler 管理，当 Scheduler 发现 Channel 断开时会释放对象
-void ShmServer::cleanupDisconnected() {
-    std::lock_guard<std::mutex> lock(internalMutex);
-    auto it = activeSlots.begin();
-    while (it != activeSlots.end()) {
-        int slot = *it;
-        bool stillActive = registry->entries[slot].active.load(std::memory_order_acquire);
-        if (!stillActive) {
-            it = activeSlots.erase(it);
-        } else {
-            ++it;
-        }
+    if (ptr == MAP_FAILED)
+        return;
+
+    std::shared_ptr<ClientChannelStruct> mapping(static_cast<ClientChannelStruct*>(ptr),
+                                                 [mapBytes](ClientChannelStruct* p) { munmap(p, mapBytes); });
+    std::shared_ptr<LivenessState> state;
+    if (pid > 0) {
+        state = std::make_shared<LivenessState>();
+        uint32_t gen = slotGeneration[slot];
+        // 回调持有映射, 通道对象先于监视销毁时映射仍然有效
+        liveness.watch(pid, state, [this, slot, gen, pid, shmName, hugetlb, mapping]() {
+            onClientDeath(slot, gen, pid, shmName, hugetlb, mapping.get());
+        });
     }
-}
\ No newline at end of file
+
+    auto channel = std::unique_ptr<IChannel>(new ShmChannel(
+        mapping,
+        requestRingBytes,
+        responseRingBytes,
+        shmName,
+        hugetlb,
+        clientType,
+        uniqueId,
+        pid,
+        numaNode,
+        device,
+        qosClass,
+        weight,
+        waitStrategy,
+        state
+    ));
+    
+    // 通知上层
+    if (callback) callback(std::move(channel));
+}
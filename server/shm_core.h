@@ -2,62 +2,127 @@
 
 #include "ipc.h"
 #include "config.h"
+#include "liveness.h"
+#include "wait_strategy.h"
 
 #include <atomic>
+#include <memory>
 #include <thread>
 #include <vector>
 #include <mutex>
 
 class ShmChannel : public IChannel {
 public:
-    ShmChannel(ClientChannelStruct* ptr, std::string name, std::string type, std::string id, pid_t pid);
+    // liveness 为空表示不监视进程 (client_pid 未知), 只依据 client_connected 判断断开
+    // requestRingBytes / responseRingBytes 为接管时校验过的几何, 之后不再读取段内的几何字段
+    ShmChannel(std::shared_ptr<ClientChannelStruct> mapping, uint32_t requestRingBytes, uint32_t responseRingBytes,
+               std::string name, bool hugetlb, std::string type, std::string id, pid_t pid, int numaNode,
+               int device, uint32_t qosClass, uint32_t weight, const WaitStrategy& wait,
+               std::shared_ptr<LivenessState> liveness);
     ~ShmChannel();
 
-    bool recvBlocking(std::string& outMsg) override;
-    bool sendBlocking(const std::string& msg) override;
+    size_t tryRecvBatch(MsgView* out, size_t maxMsgs) override;
+    void releaseBatch(size_t n) override;
+    bool sendBatch(const MsgView* msgs, size_t n) override;
+    WaitPrep prepareWait(WaitHandle& handle) override;
+    void finishWait() override;
     bool isConnected() override;
     void setReady() override;
     
     std::string getId() const override { return uniqueId; }
     std::string getType() const override { return clientType; }
     std::string getName() const override { return shmName; }
+    uint32_t getQosClass() const override { return qosClass; }
+    uint32_t getWeight() const override { return weight; }
+    pid_t getPid() const override { return clientPid; }
+    int getNumaNode() const override { return numaNode; }
+    int getDevice() const override { return device; }
+    bool outOfOrder() const override {
+        return channelPtr->client_caps.load(std::memory_order_relaxed) & KS_CAP_OUT_OF_ORDER;
+    }
+    bool acceptsLease() const override {
+        return channelPtr->client_caps.load(std::memory_order_relaxed) & KS_CAP_LEASE;
+    }
+    void grantLease(uint32_t kernels, uint64_t expiryNs) override;
+    void shrinkLease(uint32_t kernels) override;
+    uint64_t leaseUsed() const override { return channelPtr->lease_used.load(std::memory_order_acquire); }
 
     // 清理
     void unlink();
 
 private:
     ClientChannelStruct* channelPtr;
+    std::shared_ptr<ClientChannelStruct> mapping;
+    std::shared_ptr<LivenessState> liveness;
+    SPSCRing requestRing;
+    SPSCRing responseRing;
     std::string shmName;
+    bool hugetlb;
     std::string clientType;
     std::string uniqueId;
     pid_t clientPid;
+    int numaNode;
+    int device;
+    uint32_t qosClass;
+    uint32_t weight;
+    WaitStrategy waitStrategy;
+    // 最近一次 peek 取到的各条记录的结束位置, release(n) 时发布为新的 head
+    uint64_t peekEnds[SPSC_MAX_BATCH];
 
     // 辅助 SPSC 逻辑
-    bool spsc_try_pop(char* out_data, size_t max_len);
-    bool spsc_try_push(const char* data, size_t len);
+    void spsc_release(size_t n);
+    size_t spsc_try_peek_batch(MsgView* out, size_t max_msgs);
+    size_t spsc_try_push_batch(const MsgView* msgs, size_t n);
+
+    // 等待策略
+    bool requestReady();
+    void notifyClient();
 };
 
 class ShmServer : public IIPCServer {
 public:
-    ShmServer();
+    // hugePages: registry 放在 hugetlbfs 上 (失败时退回 /dev/shm)
+    // takeover: 热重启, 附着到已有的 registry 并请求正在运行的服务端交出 (交接流程见 config.h)
+    explicit ShmServer(const WaitStrategy& wait = WaitStrategy(), bool hugePages = false, bool takeover = false);
     ~ShmServer();
 
     bool init() override;
     void start(std::function<void(std::unique_ptr<IChannel>)> onNewClient) override;
     void stop() override;
 
+    // 另一个进程请求接管时在扫描线程中调用 (只调用一次); 调用者应停止服务后调用 handOver
+    void setHandoverHandler(std::function<void()> handler) { handoverHandler = std::move(handler); }
+    bool handoverRequested() const { return handoverSeen.load(std::memory_order_acquire); }
+    // 交接的最后一步: 调度器已停止服务全部通道, 通知新进程接管; 之后退出时保留 registry
+    void handOver();
+
 private:
+    bool attachRegistry();       // takeover: 附着并完成交接; registry 不存在时返回 true 且 registry 为空
+    bool awaitHandover(pid_t owner);
     void scannerLoop();
+    void updateSlot(int slot);
     void discoverClient(int slot);
-    void cleanupDisconnected();
+    void markSlotDirty(int slot);
+    void onClientDeath(int slot, uint32_t generation, pid_t pid, const std::string& shmName, bool hugetlb,
+                       ClientChannelStruct* channel);
     std::string getRegistryName();
 
     std::atomic<bool> running;
     ClientRegistry* registry;
+    size_t registryBytes;        // 映射长度 (按页大小取整)
+    bool hugePages;              // 请求把 registry 放在 hugetlbfs 上
+    bool registryHugetlb;        // registry 实际位于 hugetlbfs
     std::thread scannerThread;
     std::function<void(std::unique_ptr<IChannel>)> callback;
+    WaitStrategy waitStrategy;
+    LivenessMonitor liveness;
+
+    bool takeover;               // 以 --takeover 启动
+    bool adopted = false;        // registry 接管自旧进程, start 时重新发现所有 active 的槽位
+    bool handedOver = false;     // 已交给新进程, 退出时不删除 registry
+    std::atomic<bool> handoverSeen{false};
+    std::function<void()> handoverHandler;
 
-    // 记录正在服务的 slot，防止重复创建
-    std::mutex internalMutex;
-    std::vector<int> activeSlots; 
+    // 各槽位已接管的登记 (ClientRegistryEntry::generation), 0 表示空闲; 仅由扫描线程访问
+    uint32_t slotGeneration[MAX_REGISTERED_CLIENTS];
 };
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "stats.h"
+#include "policy.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+StatsPage::~StatsPage() {
+    close();
+}
+
+bool StatsPage::open(const std::string& policy, uint32_t workers, const std::vector<int>& devices) {
+    name_ = ks_stats_name();
+    // 其他用户只读; O_TRUNC 清掉上次异常退出留下的内容
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("[Stats] shm_open");
+        return false;
+    }
+    if (ftruncate(fd, KS_STATS_SIZE) != 0) {
+        perror("[Stats] ftruncate");
+        ::close(fd);
+        shm_unlink(name_.c_str());
+        return false;
+    }
+    void* p = mmap(nullptr, KS_STATS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        perror("[Stats] mmap");
+        shm_unlink(name_.c_str());
+        return false;
+    }
+
+    // 新段全部为零, 只需写入头部
+    base_ = p;
+    header_ = new (p) KsStatsHeader();
+    memcpy(header_->magic, KS_STATS_MAGIC, sizeof(header_->magic));
+    header_->version = KS_STATS_VERSION;
+    header_->client_capacity = KS_STATS_MAX_CLIENTS;
+    header_->kernel_capacity = KS_STATS_MAX_KERNELS;
+    header_->workers = workers;
+    header_->server_pid = getpid();
+    header_->start_ns = nowNs();
+    snprintf(header_->policy, sizeof(header_->policy), "%s", policy.c_str());
+    clients_ = ks_stats_clients(p);
+    kernels_ = ks_stats_kernels(p);
+    devices_ = ks_stats_devices(p);
+    header_->device_count = std::min<uint32_t>(devices.size(), KS_STATS_MAX_DEVICES);
+    for (uint32_t i = 0; i < header_->device_count; i++) devices_[i].device = devices[i];
+    std::cout << "[Stats] Live statistics at " << name_ << " (flexmps-top)" << std::endl;
+    return true;
+}
+
+void StatsPage::close() {
+    if (!base_) return;
+    munmap(base_, KS_STATS_SIZE);
+    shm_unlink(name_.c_str());
+    base_ = nullptr;
+    header_ = nullptr;
+    clients_ = nullptr;
+    kernels_ = nullptr;
+    devices_ = nullptr;
+}
+
+KsStatsClient* StatsPage::attach(uint64_t session, const std::string& type, const std::string& uniqueId,
+                                 int64_t pid, int32_t device, int32_t numaNode, uint32_t qosClass,
+                                 uint32_t weight) {
+    if (!base_) return nullptr;
+    header_->sessions_total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t used = used_.load();
+    int slot = -1;
+    while (~used) {
+        int i = __builtin_ctzll(~used);
+        if (i >= static_cast<int>(KS_STATS_MAX_CLIENTS)) break;
+        if (used_.compare_exchange_weak(used, used | (1ULL << i))) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) return nullptr;
+
+    KsStatsClient& c = clients_[slot];
+    c.qos_class = qosClass;
+    c.weight = weight;
+    c.pid = pid;
+    c.device = device;
+    c.numa_node = numaNode;
+    c.worker.store(-1, std::memory_order_relaxed);
+    c.worker_node.store(-1, std::memory_order_relaxed);
+    snprintf(c.client_type, sizeof(c.client_type), "%s", type.c_str());
+    snprintf(c.unique_id, sizeof(c.unique_id), "%s", uniqueId.c_str());
+    c.requests.store(0, std::memory_order_relaxed);
+    c.grants.store(0, std::memory_order_relaxed);
+    c.denies.store(0, std::memory_order_relaxed);
+    c.defers.store(0, std::memory_order_relaxed);
+    c.batches.store(0, std::memory_order_relaxed);
+    c.queue_depth.store(0, std::memory_order_relaxed);
+    c.queue_depth_max.store(0, std::memory_order_relaxed);
+    c.latency_sum_ns.store(0, std::memory_order_relaxed);
+    c.latency_max_ns.store(0, std::memory_order_relaxed);
+    for (auto& b : c.latency_hist) b.store(0, std::memory_order_relaxed);
+    c.parked.store(0, std::memory_order_relaxed);
+    c.completions.store(0, std::memory_order_relaxed);
+    c.gpu_ns.store(0, std::memory_order_relaxed);
+    c.leased.store(0, std::memory_order_relaxed);
+    c.malformed.store(0, std::memory_order_relaxed);
+    c.session.store(session, std::memory_order_release);
+    return &c;
+}
+
+void StatsPage::detach(KsStatsClient* client) {
+    if (!client || !base_) return;
+    client->session.store(0, std::memory_order_release);
+    used_.fetch_and(~(1ULL << (client - clients_)));
+}
+
+void StatsPage::publishKernel(uint32_t kid, uint64_t hash, const char* name) {
+    // 多个 worker 可能同时首次遇到同一 kernel, 只有抢到 hash 的一方写名称
+    KsStatsKernel& k = kernels_[kid];
+    uint64_t expected = 0;
+    if (!k.hash.compare_exchange_strong(expected, hash ? hash : 1, std::memory_order_relaxed)) return;
+    snprintf(k.name, sizeof(k.name), "%s", name);
+
+    uint32_t count = header_->kernel_count.load(std::memory_order_relaxed);
+    while (count < kid + 1 &&
+           !header_->kernel_count.compare_exchange_weak(count, kid + 1, std::memory_order_release)) {
+    }
+}
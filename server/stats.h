@@ -0,0 +1,196 @@
+#pragma once
+
+#include "config.h"
+#include "occupancy.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// ============================================================
+//  实时统计页 (共享内存, 服务端写, flexmps-top 只读映射)
+// ============================================================
+//
+// 段名 /kernel_scheduler_stats_<USER>, 布局:
+//   KsStatsHeader
+//   KsStatsClient[client_capacity]     按会话占用, session 为 0 表示空闲
+//   KsStatsKernel[kernel_capacity]     下标即 KernelTable 的 kernel id
+//   KsStatsDevice[device_count]        按调度域, 占用账本每个速率窗口发布一次
+// 所有计数器只做 relaxed 读写: 每个客户端条目只由其所属 worker 写入 (load + store, 无锁前缀),
+// kernel 条目可能被多个 worker 同时更新, 使用 relaxed fetch_add. 读者看到的是近似一致的快照
+
+constexpr char KS_STATS_MAGIC[8] = {'K', 'S', 'S', 'T', 'A', 'T', 'S', '\0'};
+constexpr uint32_t KS_STATS_VERSION = 8;
+constexpr uint32_t KS_STATS_MAX_CLIENTS = MAX_REGISTERED_CLIENTS;
+constexpr uint32_t KS_STATS_MAX_KERNELS = 4096;     // 超出的 kernel 不单独计数
+constexpr uint32_t KS_STATS_MAX_DEVICES = 16;      // 超出的调度域不发布占用
+constexpr uint32_t KS_STATS_LAT_BUCKETS = 32;       // 裁决延迟直方图, 第 i 桶为 [2^(i-1), 2^i) ns
+constexpr size_t KS_STATS_NAME_LEN = 96;
+
+struct KsStatsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t client_capacity;
+    uint32_t kernel_capacity;
+    uint32_t workers;
+    int64_t server_pid;
+    uint64_t start_ns;                    // 服务端启动时间 (steady_clock)
+    char policy[32];
+    std::atomic<uint64_t> sessions_total; // 累计接入的会话数
+    std::atomic<uint32_t> kernel_count;   // 已出现的 kernel 数 (最大 id + 1)
+    uint32_t device_count;                // 发布占用的调度域数
+};
+
+struct KsStatsClient {
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> session;   // 0 表示空闲; 身份字段写完后最后发布
+    uint32_t qos_class;
+    uint32_t weight;
+    int64_t pid;
+    char client_type[16];
+    char unique_id[64];
+    int32_t numa_node;                    // 客户端声明的 NUMA 节点, -1 表示未知
+    int32_t device;                       // 所属调度域的 GPU 序号
+    std::atomic<int32_t> worker;          // 服务该会话的 worker, 迁移时更新; 领取前为 -1
+    std::atomic<int32_t> worker_node;     // 该 worker 所在的节点, 未绑定节点时为 -1
+
+    // 以下计数器只由所属 worker 写入
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> requests;   // 已裁决 (放行或拒绝) 的请求数
+    std::atomic<uint64_t> grants;
+    std::atomic<uint64_t> denies;
+    std::atomic<uint64_t> defers;         // 被推迟的轮询次数 (同一请求可能被推迟多次); 挂起的请求只在挂起时计一次
+    std::atomic<uint64_t> batches;        // 取到请求的轮询次数
+    std::atomic<uint64_t> queue_depth;    // 最近一次轮询取到的请求数
+    std::atomic<uint64_t> queue_depth_max;
+    std::atomic<uint64_t> parked;         // 当前挂起 (已取走、尚未答复) 的请求数
+    std::atomic<uint64_t> latency_sum_ns; // 首次取到请求到发出裁决
+    std::atomic<uint64_t> latency_max_ns;
+    std::atomic<uint64_t> latency_hist[KS_STATS_LAT_BUCKETS];
+    std::atomic<uint64_t> completions;    // 客户端上报的完成记录数 (KS_MSG_COMPLETION)
+    std::atomic<uint64_t> gpu_ns;         // 上报的 GPU 执行时间之和, 增量除以时间间隔即 GPU 占用率
+    std::atomic<uint64_t> leased;         // 在租约内发射、没有经过请求的 kernel 数
+    std::atomic<uint64_t> malformed;      // 无法解析而被丢弃的消息数 (其中可答复的请求以 KS_REASON_PROTOCOL 拒绝)
+};
+
+struct KsStatsKernel {
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> hash;           // 0 表示名称尚未写入
+    std::atomic<uint64_t> completions;
+    std::atomic<uint64_t> gpu_ns;
+    char name[KS_STATS_NAME_LEN];
+};
+
+// 一个调度域的 GPU 占用 (OccupancyLedger 的快照), 按 QoS 类别
+struct KsStatsDevice {
+    int32_t device;                       // GPU 序号
+    uint32_t reserved;
+    std::atomic<uint64_t> updated_ns;     // 最近一次发布的时间, 0 表示尚未发布
+    std::atomic<int64_t> inflight[LEDGER_CLASSES];
+    std::atomic<int64_t> outstanding_ns[LEDGER_CLASSES];
+    std::atomic<uint64_t> grant_rate[LEDGER_CLASSES];   // kernel/s
+};
+
+// 各部分在段内的偏移
+constexpr size_t KS_STATS_CLIENTS_OFFSET =
+    (sizeof(KsStatsHeader) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+constexpr size_t KS_STATS_KERNELS_OFFSET = KS_STATS_CLIENTS_OFFSET + sizeof(KsStatsClient) * KS_STATS_MAX_CLIENTS;
+constexpr size_t KS_STATS_DEVICES_OFFSET = KS_STATS_KERNELS_OFFSET + sizeof(KsStatsKernel) * KS_STATS_MAX_KERNELS;
+constexpr size_t KS_STATS_SIZE = KS_STATS_DEVICES_OFFSET + sizeof(KsStatsDevice) * KS_STATS_MAX_DEVICES;
+
+inline KsStatsClient* ks_stats_clients(void* base) {
+    return reinterpret_cast<KsStatsClient*>(static_cast<char*>(base) + KS_STATS_CLIENTS_OFFSET);
+}
+
+inline KsStatsKernel* ks_stats_kernels(void* base) {
+    return reinterpret_cast<KsStatsKernel*>(static_cast<char*>(base) + KS_STATS_KERNELS_OFFSET);
+}
+
+inline KsStatsDevice* ks_stats_devices(void* base) {
+    return reinterpret_cast<KsStatsDevice*>(static_cast<char*>(base) + KS_STATS_DEVICES_OFFSET);
+}
+
+inline uint32_t ks_stats_lat_bucket(uint64_t ns) {
+    uint32_t b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return b < KS_STATS_LAT_BUCKETS ? b : KS_STATS_LAT_BUCKETS - 1;
+}
+
+// 当前用户的统计页共享内存名, 与 registry 同样按用户区分
+inline std::string ks_stats_name() {
+    const char* u = std::getenv("USER");
+    return std::string(SHM_NAME_STATS) + ((u && *u) ? std::string("_") + u : "_nouser");
+}
+
+// 单写者计数器的递增: 不需要原子读-改-写
+inline void ks_stats_add(std::atomic<uint64_t>& c, uint64_t v) {
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 服务端持有的统计页
+ * 会话接入时 attach 分配一个客户端条目, 之后由所属 worker 通过返回的指针直接更新计数器
+ */
+class StatsPage {
+public:
+    StatsPage() = default;
+    ~StatsPage();
+    StatsPage(const StatsPage&) = delete;
+    StatsPage& operator=(const StatsPage&) = delete;
+
+    // devices 为各调度域的 GPU 序号, 按域的下标
+    bool open(const std::string& policy, uint32_t workers, const std::vector<int>& devices);
+    void close();
+
+    // 分配客户端条目并写入身份, 条目用尽时返回 nullptr
+    KsStatsClient* attach(uint64_t session, const std::string& type, const std::string& uniqueId,
+                          int64_t pid, int32_t device, int32_t numaNode, uint32_t qosClass, uint32_t weight);
+    void detach(KsStatsClient* client);
+
+    // 记录一次 kernel 请求, kid 为 KernelTable id
+    void countKernel(uint32_t kid, uint64_t hash, const char* name) {
+        if (kid >= KS_STATS_MAX_KERNELS) return;
+        KsStatsKernel& k = kernels_[kid];
+        if (k.hash.load(std::memory_order_relaxed) == 0) publishKernel(kid, hash, name);
+        k.requests.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 记录一条完成记录
+    void countCompletion(uint32_t kid, uint64_t hash, const char* name, uint64_t ns) {
+        if (kid >= KS_STATS_MAX_KERNELS) return;
+        KsStatsKernel& k = kernels_[kid];
+        if (k.hash.load(std::memory_order_relaxed) == 0) publishKernel(kid, hash, name);
+        k.completions.fetch_add(1, std::memory_order_relaxed);
+        k.gpu_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // KernelTable 把占位名称 (先于请求到达的完成记录登记) 替换为真实名称后调用
+    void renameKernel(uint32_t kid, const char* name) {
+        if (kid >= KS_STATS_MAX_KERNELS) return;
+        KsStatsKernel& k = kernels_[kid];
+        if (k.hash.load(std::memory_order_relaxed) != 0) snprintf(k.name, sizeof(k.name), "%s", name);
+    }
+
+    // 发布调度域 domain 的占用; 每个域同一时刻只有一个发布者 (OccupancyLedger::tick 的胜者)
+    void publishDevice(size_t domain, const LedgerSnapshot& s, uint64_t now) {
+        if (domain >= KS_STATS_MAX_DEVICES) return;
+        KsStatsDevice& d = devices_[domain];
+        for (uint32_t c = 0; c < LEDGER_CLASSES; c++) {
+            d.inflight[c].store(s.inflight[c], std::memory_order_relaxed);
+            d.outstanding_ns[c].store(s.outstandingNs[c], std::memory_order_relaxed);
+            d.grant_rate[c].store(s.grantRate[c], std::memory_order_relaxed);
+        }
+        d.updated_ns.store(now, std::memory_order_release);
+    }
+
+private:
+    void publishKernel(uint32_t kid, uint64_t hash, const char* name);
+
+    void* base_ = nullptr;
+    KsStatsHeader* header_ = nullptr;
+    KsStatsClient* clients_ = nullptr;
+    KsStatsKernel* kernels_ = nullptr;
+    KsStatsDevice* devices_ = nullptr;
+    std::string name_;
+    std::atomic<uint64_t> used_{0};   // 客户端条目占用位图
+};
@@ -0,0 +1,221 @@
+#include "timeline.h"
+#include "kernel_table.h"
+#include "policy.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+TimelineWriter::~TimelineWriter() {
+    close();
+}
+
+// 设备 d 的调度域在时间线中是 pid d + 1 的进程
+static int devicePid(int device) {
+    return device + 1;
+}
+
+bool TimelineWriter::open(const std::string& path, unsigned workers, const std::string& policy,
+                          const std::vector<int>& devices) {
+    path_ = path;
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "[Timeline] Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    for (unsigned i = 0; i < workers; i++) {
+        rings_.push_back(std::unique_ptr<TimelineRing>(new TimelineRing()));
+    }
+    startNs_ = nowNs();
+    chunk_.reserve(TIMELINE_CHUNK_BYTES + 4096);
+
+    append("[", 1);
+    for (size_t i = 0; i < devices.size(); i++) {
+        char line[256];
+        int n = snprintf(line, sizeof(line),
+                         "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"flexmps scheduler "
+                         "(%s) GPU %d\"}},\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,"
+                         "\"args\":{\"sort_index\":%zu}}",
+                         i ? "," : "", devicePid(devices[i]), policy.c_str(), devices[i], devicePid(devices[i]), i);
+        append(line, n);
+    }
+
+    running_ = true;
+    writer_ = std::thread(&TimelineWriter::writerLoop, this);
+    std::cout << "[Timeline] Writing scheduling timeline to " << path << std::endl;
+    return true;
+}
+
+void TimelineWriter::addClient(uint32_t session, int device, const std::string& type, const std::string& uniqueId,
+                               uint32_t qosClass) {
+    const char* qos = qosClass == KS_QOS_DECODE ? "decode" : qosClass == KS_QOS_PREFILL ? "prefill" : "default";
+    Track t{session, device, qosClass, type + ":" + uniqueId + " (" + qos + ")"};
+    std::lock_guard<std::mutex> lock(tracksMutex_);
+    pendingTracks_.push_back(std::move(t));
+}
+
+void TimelineWriter::close() {
+    if (fd_ < 0) return;
+    if (running_.exchange(false) && writer_.joinable()) {
+        writer_.join();
+    }
+    // 后台线程退出前已排空队列
+    static const char tail[] = "\n]\n";
+    append(tail, sizeof(tail) - 1);
+    flush();
+    ::close(fd_);
+    fd_ = -1;
+    std::cout << "[Timeline] " << written_ << " events written to " << path_;
+    uint64_t dropped = dropped_.load();
+    if (dropped) std::cout << ", " << dropped << " dropped (queue full)";
+    std::cout << std::endl;
+}
+
+// 轨道名中可能出现引号等字符, kernel 名称中常见 <>, 一并按 JSON 规则转义
+static void appendEscaped(std::string& out, const char* s) {
+    for (; *s; s++) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+void TimelineWriter::append(const char* text, size_t len) {
+    chunk_.append(text, len);
+    if (chunk_.size() >= TIMELINE_CHUNK_BYTES) flush();
+}
+
+void TimelineWriter::flush() {
+    size_t off = 0;
+    while (off < chunk_.size() && !failed_) {
+        ssize_t n = ::write(fd_, chunk_.data() + off, chunk_.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // 磁盘写满等: 停止写入, 不影响调度
+            std::cerr << "[Timeline] Write to " << path_ << " failed: " << strerror(errno) << std::endl;
+            failed_ = true;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    chunk_.clear();
+}
+
+void TimelineWriter::emitTracks() {
+    std::vector<Track> tracks;
+    {
+        std::lock_guard<std::mutex> lock(tracksMutex_);
+        tracks.swap(pendingTracks_);
+    }
+    for (const Track& t : tracks) {
+        std::string pid = std::to_string(devicePid(t.device));
+        sessionPid_[t.session] = devicePid(t.device);
+        std::string line = ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":";
+        line += std::to_string(t.session);
+        line += ",\"args\":{\"name\":\"";
+        appendEscaped(line, t.label.c_str());
+        // decode 轨道排在最上面
+        line += "\"}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":";
+        line += std::to_string(t.session);
+        line += ",\"args\":{\"sort_index\":";
+        line += std::to_string(t.qosClass == KS_QOS_DECODE ? 0 : t.qosClass == KS_QOS_PREFILL ? 2 : 1);
+        line += "}}";
+        append(line.data(), line.size());
+    }
+}
+
+// 时间戳单位为微秒, 保留纳秒精度
+static int formatUs(char* out, size_t cap, uint64_t ns) {
+    return snprintf(out, cap, "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+}
+
+void TimelineWriter::appendEvent(const TimelineEvent& ev) {
+    std::string line;
+    char ts[32];
+    char dur[32];
+    formatUs(ts, sizeof(ts), ev.beginNs > startNs_ ? ev.beginNs - startNs_ : 0);
+    const char* kernel = KernelTable::instance().name(ev.kernel);
+    auto it = sessionPid_.find(ev.session);
+    std::string pid = std::to_string(it != sessionPid_.end() ? it->second : 1);
+
+    if (ev.kind == TimelineKind::Defer) {
+        line = ",\n{\"name\":\"defer\",\"cat\":\"defer\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" + pid + ",\"tid\":";
+        line += std::to_string(ev.session);
+        line += ",\"ts\":";
+        line += ts;
+        line += ",\"args\":{\"kernel\":\"";
+        appendEscaped(line, kernel);
+        line += "\",\"reason\":";
+        line += std::to_string(ev.reason);
+        line += "}}";
+        append(line.data(), line.size());
+        return;
+    }
+
+    formatUs(dur, sizeof(dur), ev.endNs > ev.beginNs ? ev.endNs - ev.beginNs : 0);
+    line = ",\n{\"name\":\"";
+    appendEscaped(line, kernel);
+    line += ev.grant ? "\",\"cat\":\"grant\"" : "\",\"cat\":\"deny\"";
+    line += ",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":";
+    line += std::to_string(ev.session);
+    line += ",\"ts\":";
+    line += ts;
+    line += ",\"dur\":";
+    line += dur;
+    line += ",\"args\":{\"req\":";
+    line += std::to_string(ev.reqId);
+    line += "}}";
+    if (!ev.grant) {
+        // 拒绝在裁决时刻加一个标记, 缩放到很小时仍然可见
+        char end[32];
+        formatUs(end, sizeof(end), ev.endNs > startNs_ ? ev.endNs - startNs_ : 0);
+        line += ",\n{\"name\":\"deny\",\"cat\":\"deny\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" + pid + ",\"tid\":";
+        line += std::to_string(ev.session);
+        line += ",\"ts\":";
+        line += end;
+        line += ",\"args\":{\"reason\":";
+        line += std::to_string(ev.reason);
+        line += "}}";
+    }
+    append(line.data(), line.size());
+}
+
+bool TimelineWriter::drain() {
+    // 先输出新轨道的名称, 保证轨道元数据出现在其第一个事件之前
+    emitTracks();
+    bool wrote = false;
+    for (auto& ring : rings_) {
+        TimelineEvent* ev;
+        while ((ev = ring->front()) != nullptr) {
+            appendEvent(*ev);
+            ring->pop();
+            written_++;
+            wrote = true;
+        }
+    }
+    return wrote;
+}
+
+void TimelineWriter::writerLoop() {
+    for (;;) {
+        bool stopping = !running_.load();
+        bool wrote = drain();
+        if (stopping) break;
+        if (!wrote) {
+            // 空闲时把不满一块的数据也写出去, 运行中的文件可以随时打开查看
+            if (!chunk_.empty()) flush();
+            usleep(1000);
+        }
+    }
+}
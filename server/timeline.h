@@ -0,0 +1,107 @@
+#pragma once
+
+#include "ring.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================
+//  调度时间线导出 (--timeline), Chrome trace JSON
+// ============================================================
+//
+// 输出 Chrome trace 的 JSON 数组格式, chrome://tracing 与 ui.perfetto.dev 均可直接打开:
+//   每个 GPU 调度域一个进程 (pid = 设备号 + 1), 其下每个会话一条轨道 (tid = 会话号, 轨道名为 type:unique_id 与 QoS)
+//   每个已裁决的请求一个 slice: 从第一次取到请求到发出裁决, 名称为 kernel 名, cat 为 grant / deny
+//   拒绝与推迟各加一个瞬时标记 (deny / defer)
+// worker 只把定长事件写入自己的无锁环形队列, 由后台线程格式化并按块写入文件;
+// 队列满时丢弃并计数. 进程异常退出时文件缺少结尾的 ']', 两种查看器都能正常加载
+
+constexpr size_t TIMELINE_RING_CAPACITY = 16384;       // 每个 worker 640 KB
+constexpr size_t TIMELINE_CHUNK_BYTES = 1 << 20;       // 后台线程每次 write 的上限
+
+enum class TimelineKind : uint8_t {
+    Decision,   // beginNs ~ endNs 为一次裁决
+    Defer,      // 队头请求第一次被推迟, 只用 beginNs
+};
+
+struct TimelineEvent {
+    uint64_t beginNs;
+    uint64_t endNs;
+    uint64_t reqId;
+    uint32_t session;
+    uint32_t kernel;      // KernelTable id
+    TimelineKind kind;
+    uint8_t grant;
+    uint16_t reason;
+    uint32_t reserved;
+};
+
+using TimelineRing = SpscRing<TimelineEvent, TIMELINE_RING_CAPACITY>;
+
+/**
+ * @brief 时间线写入器
+ * 每个 worker 一个环形队列 (按 worker 下标), push 只能由对应的 worker 调用
+ */
+class TimelineWriter {
+public:
+    TimelineWriter() = default;
+    ~TimelineWriter();
+    TimelineWriter(const TimelineWriter&) = delete;
+    TimelineWriter& operator=(const TimelineWriter&) = delete;
+
+    bool open(const std::string& path, unsigned workers, const std::string& policy, const std::vector<int>& devices);
+    // 会话开始时登记轨道名
+    void addClient(uint32_t session, int device, const std::string& type, const std::string& uniqueId,
+                   uint32_t qosClass);
+    // 排空队列并补全文件结尾; 必须在所有 worker 停止之后调用
+    void close();
+
+    void push(unsigned worker, const TimelineEvent& ev) {
+        TimelineEvent* slot = rings_[worker]->claim();
+        if (!slot) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        *slot = ev;
+        rings_[worker]->publish();
+    }
+
+private:
+    struct Track {
+        uint32_t session;
+        int device;
+        uint32_t qosClass;
+        std::string label;
+    };
+
+    void writerLoop();
+    bool drain();
+    void emitTracks();
+    void append(const char* text, size_t len);
+    void appendEvent(const TimelineEvent& ev);
+    void flush();
+
+    std::string path_;
+    int fd_ = -1;
+    uint64_t startNs_ = 0;
+    std::vector<std::unique_ptr<TimelineRing>> rings_;
+    std::atomic<uint64_t> dropped_{0};
+
+    std::thread writer_;
+    std::atomic<bool> running_{false};
+
+    std::mutex tracksMutex_;
+    std::vector<Track> pendingTracks_;
+
+    // 以下只由后台线程访问 (close 时在其退出之后)
+    std::unordered_map<uint32_t, int> sessionPid_;   // 会话号 -> 所属设备的 pid
+    std::string chunk_;
+    uint64_t written_ = 0;
+    bool failed_ = false;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// ============================================================
+//  分层时间轮 (挂起请求的重新裁决时间)
+// ============================================================
+//
+// 4 层, 每层 64 个槽, 第 0 层每槽一个 tick (TIMER_WHEEL_TICK_NS), 第 k 层每槽 64^k 个 tick,
+// 覆盖 64^4 个 tick (约 4.6 分钟), 更远的到期时间按覆盖范围的上限处理 (提前到期由调用者重新登记).
+// 登记与到期都是 O(1), 高层槽位在指针走到时整体下放一层. 到期时间向上取整到 tick, 不会提前触发.
+// 不加锁, 只由一个 worker 线程使用
+
+constexpr unsigned TIMER_WHEEL_TICK_SHIFT = 14;   // 一个 tick 约 16us
+constexpr uint64_t TIMER_WHEEL_TICK_NS = 1ULL << TIMER_WHEEL_TICK_SHIFT;
+
+template <typename T>
+class TimerWheel {
+public:
+    static constexpr unsigned LEVELS = 4;
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr uint64_t SLOTS = 1ULL << SLOT_BITS;
+
+    explicit TimerWheel(uint64_t nowNs = 0) : current_(nowNs >> TIMER_WHEEL_TICK_SHIFT) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // 登记一个在 deadlineNs 到期的条目; 已过期的在下一个 tick 到期
+    void schedule(uint64_t deadlineNs, const T& item) {
+        uint64_t tick = (deadlineNs + TIMER_WHEEL_TICK_NS - 1) >> TIMER_WHEEL_TICK_SHIFT;
+        // 当前 tick 的槽已经处理过
+        insert(tick > current_ ? tick : current_ + 1, item);
+        size_++;
+    }
+
+    // 把时间推进到 nowNs, 对每个到期的条目调用 fire(item); fire 中可以登记新的条目
+    template <typename F>
+    void advance(uint64_t nowNs, F&& fire) {
+        uint64_t target = nowNs >> TIMER_WHEEL_TICK_SHIFT;
+        while (current_ < target) {
+            if (size_ == 0) {
+                current_ = target;
+                break;
+            }
+            uint64_t next = current_ + 1;
+            if (count_[0] == 0) {
+                // 第 0 层为空: 直接跳到下一次下放 (或目标时间)
+                uint64_t boundary = (current_ | (SLOTS - 1)) + 1;
+                if (boundary > target) {
+                    current_ = target;
+                    break;
+                }
+                next = boundary;
+            }
+            current_ = next;
+            if ((current_ & (SLOTS - 1)) == 0) cascade();
+            std::vector<Entry>& slot = slots_[0][current_ & (SLOTS - 1)];
+            if (slot.empty()) continue;
+            std::vector<Entry> due;
+            due.swap(slot);
+            count_[0] -= due.size();
+            size_ -= due.size();
+            for (const Entry& e : due) fire(e.item);
+        }
+    }
+
+    // 下一个条目最早的到期时间 (ns); 条目在高层时返回下一次下放的时间; 没有条目时返回 0
+    uint64_t nextDeadlineNs() const {
+        if (size_ == 0) return 0;
+        if (count_[0] > 0) {
+            for (uint64_t t = current_ + 1; t <= current_ + SLOTS; t++) {
+                if (!slots_[0][t & (SLOTS - 1)].empty()) return t << TIMER_WHEEL_TICK_SHIFT;
+            }
+        }
+        return ((current_ | (SLOTS - 1)) + 1) << TIMER_WHEEL_TICK_SHIFT;
+    }
+
+    // 删除所有满足 pred(item) 的条目
+    template <typename Pred>
+    void removeIf(Pred&& pred) {
+        for (unsigned level = 0; level < LEVELS; level++) {
+            if (count_[level] == 0) continue;
+            for (std::vector<Entry>& slot : slots_[level]) {
+                size_t kept = 0;
+                for (size_t i = 0; i < slot.size(); i++) {
+                    if (!pred(slot[i].item)) slot[kept++] = slot[i];
+                }
+                count_[level] -= slot.size() - kept;
+                size_ -= slot.size() - kept;
+                slot.resize(kept);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        uint64_t tick;
+        T item;
+    };
+
+    // 放在 tick 与当前指针第一个相同的高位组所在的层; tick 不小于 current_
+    void insert(uint64_t tick, const T& item) {
+        const uint64_t span = 1ULL << (SLOT_BITS * LEVELS);
+        if (tick - current_ >= span) tick = current_ + span - 1;
+        unsigned level = 0;
+        while (level + 1 < LEVELS && (tick >> (SLOT_BITS * (level + 1))) != (current_ >> (SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+        slots_[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(Entry{tick, item});
+        count_[level]++;
+    }
+
+    // 指针进入高层的一个新槽: 把该槽的条目重新放到较低的层, 从最高层开始
+    void cascade() {
+        unsigned top = 1;
+        while (top + 1 < LEVELS && ((current_ >> (SLOT_BITS * top)) & (SLOTS - 1)) == 0) top++;
+        for (unsigned level = top; level >= 1; level--) {
+            std::vector<Entry>& slot = slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+            if (slot.empty()) continue;
+            std::vector<Entry> moved;
+            moved.swap(slot);
+            count_[level] -= moved.size();
+            for (const Entry& e : moved) insert(e.tick, e.item);
+        }
+    }
+
+    uint64_t current_;   // 已处理到的 tick
+    size_t size_ = 0;
+    size_t count_[LEVELS] = {};
+    std::vector<Entry> slots_[LEVELS][SLOTS];
+};
@@ -0,0 +1,184 @@
+#include "trace.h"
+#include "kernel_table.h"
+#include "policy.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+TraceRecorder::~TraceRecorder() {
+    close();
+}
+
+bool TraceRecorder::open(const std::string& path, uint64_t maxRecords) {
+    path_ = path;
+    maxRecords_ = maxRecords;
+    mapSize_ = sizeof(KsTraceHeader) + maxRecords * sizeof(KsTraceRecord);
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "[Trace] Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd_, mapSize_) != 0) {
+        std::cerr << "[Trace] Cannot size " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    map_ = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED) {
+        std::cerr << "[Trace] Cannot map " << path << ": " << strerror(errno) << std::endl;
+        map_ = nullptr;
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    header_ = new (map_) KsTraceHeader();   // 值初始化, 所有字段清零
+    memcpy(header_->magic, KS_TRACE_MAGIC, sizeof(header_->magic));
+    header_->version = KS_TRACE_VERSION;
+    header_->record_size = sizeof(KsTraceRecord);
+    header_->record_count.store(0, std::memory_order_relaxed);
+    header_->start_ns = nowNs();
+    records_ = reinterpret_cast<KsTraceRecord*>(static_cast<char*>(map_) + sizeof(KsTraceHeader));
+    std::cout << "[Trace] Recording to " << path << " (max " << maxRecords << " records)" << std::endl;
+    return true;
+}
+
+void TraceRecorder::addClient(uint32_t session, const std::string& type, const std::string& uniqueId,
+                              uint32_t qosClass, uint32_t weight) {
+    KsTraceClient c;
+    memset(&c, 0, sizeof(c));
+    c.session = session;
+    c.qos_class = qosClass;
+    c.weight = weight;
+    strncpy(c.client_type, type.c_str(), sizeof(c.client_type) - 1);
+    strncpy(c.unique_id, uniqueId.c_str(), sizeof(c.unique_id) - 1);
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    clients_.push_back(c);
+}
+
+void TraceRecorder::close() {
+    if (!map_) return;
+
+    uint64_t count = std::min<uint64_t>(header_->record_count.load(), maxRecords_);
+    KsTraceHeader header{};
+    memcpy(header.magic, KS_TRACE_MAGIC, sizeof(header.magic));
+    header.version = KS_TRACE_VERSION;
+    header.record_size = sizeof(KsTraceRecord);
+    header.record_count.store(count, std::memory_order_relaxed);
+    header.dropped = dropped_.load();
+    header.start_ns = header_->start_ns;
+    munmap(map_, mapSize_);
+    map_ = nullptr;
+
+    // 截断未使用的预留空间, 依次追加客户端表与名称表
+    off_t offset = sizeof(KsTraceHeader) + count * sizeof(KsTraceRecord);
+    bool ok = ftruncate(fd_, offset) == 0;
+
+    header.clients_offset = offset;
+    header.client_count = static_cast<uint32_t>(clients_.size());
+    size_t bytes = clients_.size() * sizeof(KsTraceClient);
+    ok = ok && pwrite(fd_, clients_.data(), bytes, offset) == static_cast<ssize_t>(bytes);
+    offset += bytes;
+
+    std::string names;
+    KernelTable& table = KernelTable::instance();
+    uint32_t kernels = table.size();
+    for (uint32_t id = 0; id < kernels; id++) {
+        const char* name = table.name(id);
+        KsTraceName n;
+        n.hash = table.hash(id);
+        n.len = static_cast<uint16_t>(std::min<size_t>(strlen(name), KS_MAX_KERNEL_NAME));
+        names.append(reinterpret_cast<const char*>(&n), sizeof(n));
+        names.append(name, n.len);
+    }
+    header.names_offset = offset;
+    header.name_count = kernels;
+    ok = ok && pwrite(fd_, names.data(), names.size(), offset) == static_cast<ssize_t>(names.size());
+    ok = ok && pwrite(fd_, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    ::close(fd_);
+    fd_ = -1;
+
+    if (ok) {
+        std::cout << "[Trace] Wrote " << count << " records, " << header.client_count << " clients, "
+                  << kernels << " kernels to " << path_;
+        if (header.dropped) std::cout << " (" << header.dropped << " dropped)";
+        std::cout << std::endl;
+    } else {
+        std::cerr << "[Trace] Failed to finalize " << path_ << ": " << strerror(errno) << std::endl;
+    }
+}
+
+TraceReader::~TraceReader() {
+    if (map_) munmap(map_, mapSize_);
+}
+
+bool TraceReader::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[Trace] Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(KsTraceHeader)) {
+        std::cerr << "[Trace] " << path << " is not a trace file" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    mapSize_ = st.st_size;
+    map_ = mmap(nullptr, mapSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        std::cerr << "[Trace] Cannot map " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    header_ = static_cast<const KsTraceHeader*>(map_);
+    if (memcmp(header_->magic, KS_TRACE_MAGIC, sizeof(header_->magic)) != 0 ||
+        header_->version != KS_TRACE_VERSION || header_->record_size != sizeof(KsTraceRecord)) {
+        std::cerr << "[Trace] " << path << ": unsupported format or version" << std::endl;
+        return false;
+    }
+
+    // 未正常关闭的文件没有客户端表与名称表, 记录条数以文件长度为准
+    const char* base = static_cast<const char*>(map_);
+    uint64_t end = header_->clients_offset ? header_->clients_offset : mapSize_;
+    if (end > mapSize_) end = mapSize_;
+    recordCount_ = std::min<uint64_t>(header_->record_count.load(),
+                                      (end - sizeof(KsTraceHeader)) / sizeof(KsTraceRecord));
+    records_ = reinterpret_cast<const KsTraceRecord*>(base + sizeof(KsTraceHeader));
+
+    if (header_->clients_offset &&
+        header_->clients_offset + header_->client_count * sizeof(KsTraceClient) <= mapSize_) {
+        const KsTraceClient* c = reinterpret_cast<const KsTraceClient*>(base + header_->clients_offset);
+        clients_.assign(c, c + header_->client_count);
+    }
+
+    if (header_->names_offset) {
+        uint64_t off = header_->names_offset;
+        for (uint32_t i = 0; i < header_->name_count && off + sizeof(KsTraceName) <= mapSize_; i++) {
+            KsTraceName n;
+            memcpy(&n, base + off, sizeof(n));
+            off += sizeof(n);
+            if (off + n.len > mapSize_) break;
+            names_.emplace_back(static_cast<uint64_t>(n.hash), std::string(base + off, n.len));
+            off += n.len;
+        }
+        std::sort(names_.begin(), names_.end());
+    }
+    return true;
+}
+
+std::string TraceReader::kernelName(uint64_t hash) const {
+    auto it = std::lower_bound(names_.begin(), names_.end(), std::make_pair(hash, std::string()));
+    if (it != names_.end() && it->first == hash) return it->second;
+    return std::string();
+}
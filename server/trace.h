@@ -0,0 +1,134 @@
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ============================================================
+//  kernel 请求流的二进制 trace (--record)
+// ============================================================
+//
+// 文件布局:
+//   KsTraceHeader
+//   KsTraceRecord[record_count]        worker 通过 mmap 直接写入, 各 worker 之间只有一次 fetch_add
+//   KsTraceClient[client_count]        关闭时追加
+//   { KsTraceName, name[len] } ...     关闭时追加, 记录中出现过的 kernel hash -> 名称
+// 全部字段为小端, 与服务端和回放工具的内存布局一致
+
+constexpr char KS_TRACE_MAGIC[8] = {'K', 'S', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t KS_TRACE_VERSION = 1;
+
+struct KsTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    std::atomic<uint64_t> record_count;   // 录制期间作为写入位置的分配计数, 关闭时修正为实际条数
+    uint64_t dropped;                     // 超出 --record-max 而未写入的请求数
+    uint64_t start_ns;                    // 录制开始时间 (steady_clock)
+    uint64_t clients_offset;
+    uint32_t client_count;
+    uint32_t name_count;
+    uint64_t names_offset;
+    uint64_t reserved;
+};
+static_assert(sizeof(KsTraceHeader) == 72, "KsTraceHeader layout changed");
+
+// 一条请求: 服务端第一次从队列中取到它的时间 (被推迟的请求取第一次裁决的时间)
+struct KsTraceRecord {
+    uint64_t recv_ns;       // 相对 start_ns
+    uint64_t req_id;        // 文本协议中非数字的 reqId 记为 0
+    uint64_t kernel_hash;
+    uint32_t session;       // 会话号, 对应 KsTraceClient::session
+    uint32_t flags;         // KS_TRACE_BINARY
+};
+static_assert(sizeof(KsTraceRecord) == 32, "KsTraceRecord layout changed");
+
+constexpr uint32_t KS_TRACE_BINARY = 1u << 0;   // 原请求使用二进制协议
+
+struct KsTraceClient {
+    uint32_t session;
+    uint32_t qos_class;
+    uint32_t weight;
+    uint32_t reserved;
+    char client_type[16];
+    char unique_id[64];
+};
+
+struct __attribute__((packed)) KsTraceName {
+    uint64_t hash;
+    uint16_t len;
+};
+
+/**
+ * @brief 录制器: 多个 worker 并发追加记录
+ * 文件按 maxRecords 预先映射 (稀疏文件, 只有写过的页占用磁盘), 超出后丢弃并计数
+ */
+class TraceRecorder {
+public:
+    TraceRecorder() = default;
+    ~TraceRecorder();
+
+    bool open(const std::string& path, uint64_t maxRecords);
+    // 会话开始时登记, 回放工具据此还原客户端
+    void addClient(uint32_t session, const std::string& type, const std::string& uniqueId,
+                   uint32_t qosClass, uint32_t weight);
+    // 截断到实际长度并追加客户端表与 kernel 名称表; 必须在所有 worker 停止之后调用
+    void close();
+
+    void record(uint64_t recvNs, uint64_t reqId, uint64_t kernelHash, uint32_t session, uint32_t flags) {
+        uint64_t i = header_->record_count.fetch_add(1, std::memory_order_relaxed);
+        if (i >= maxRecords_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        KsTraceRecord& r = records_[i];
+        r.recv_ns = recvNs - header_->start_ns;
+        r.req_id = reqId;
+        r.kernel_hash = kernelHash;
+        r.session = session;
+        r.flags = flags;
+    }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    void* map_ = nullptr;
+    size_t mapSize_ = 0;
+    uint64_t maxRecords_ = 0;
+    KsTraceHeader* header_ = nullptr;
+    KsTraceRecord* records_ = nullptr;
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex clientsMutex_;
+    std::vector<KsTraceClient> clients_;
+};
+
+/**
+ * @brief 只读打开一个 trace 文件
+ */
+class TraceReader {
+public:
+    ~TraceReader();
+
+    bool open(const std::string& path);
+
+    const KsTraceHeader& header() const { return *header_; }
+    uint64_t recordCount() const { return recordCount_; }
+    const KsTraceRecord* records() const { return records_; }
+    const std::vector<KsTraceClient>& clients() const { return clients_; }
+    // kernel 名称, 未知时返回空串
+    std::string kernelName(uint64_t hash) const;
+
+private:
+    void* map_ = nullptr;
+    size_t mapSize_ = 0;
+    const KsTraceHeader* header_ = nullptr;
+    const KsTraceRecord* records_ = nullptr;
+    uint64_t recordCount_ = 0;
+    std::vector<KsTraceClient> clients_;
+    std::vector<std::pair<uint64_t, std::string>> names_;   // 按 hash 排序
+};
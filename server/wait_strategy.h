@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <climits>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+
+// ============================================================
+//  等待策略: 自旋 -> 让出 CPU -> futex 休眠
+// ============================================================
+//
+// 休眠协议 (Dekker 式, 双方各一次 seq_cst fence):
+//   消费者: seq = futex.load(); parked = 1; fence; 队列仍为空 ? futex_wait(futex, seq) : 不睡; parked = 0
+//   生产者: 发布 tail; fence; parked ? (futex++, futex_wake) : 什么也不做
+// 生产者只有在对端声明已休眠时才付出一次系统调用
+
+enum class WaitMode {
+    Spin,       // 原有行为: 一直 pause 忙等
+    Adaptive,   // 自旋预算 -> sched_yield -> futex 休眠
+};
+
+// 单核机器上自旋期间对端无法运行, 自旋只会推迟对端, 默认直接进入 yield 阶段
+inline uint32_t ks_default_spin_iters() {
+    static const uint32_t iters = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 4000 : 0;
+    return iters;
+}
+
+struct WaitStrategy {
+    WaitMode mode = WaitMode::Adaptive;
+    uint32_t spinIters = ks_default_spin_iters();   // 约 100us 的 pause 自旋 (pause 约 20~40ns)
+    uint32_t yieldIters = 50;        // 之后 sched_yield 的次数
+    uint32_t futexTimeoutUs = 2000;  // 单次 futex 休眠上限, 到期后重新检查连接状态; 0 表示不设上限
+};
+
+inline void cpu_relax() {
+    __asm__ __volatile__("pause" ::: "memory");
+}
+
+// 共享内存中的 futex, 不能使用 FUTEX_PRIVATE_FLAG
+inline int ks_futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, uint32_t timeoutUs) {
+    struct timespec ts;
+    ts.tv_sec = timeoutUs / 1000000;
+    ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected,
+                   timeoutUs ? &ts : nullptr, nullptr, 0);
+}
+
+inline int ks_futex_wake(std::atomic<uint32_t>* addr, int count = INT_MAX) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+// 多个 futex 上的等待 (futex_waitv, Linux 5.16+), 用于一个线程同时轮询多个通道
+struct WaitHandle {
+    std::atomic<uint32_t>* futexWord;
+    uint32_t expected;
+};
+
+constexpr size_t KS_FUTEX_WAITV_MAX = 128;
+
+// 与内核 struct futex_waitv 布局一致, 避免依赖较新的内核头文件
+struct KsFutexWaitv {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// 等待 handles 中任意一个共享 futex 或进程内的 localWord 发生变化, timeoutUs 为 0 时不设上限 (与 ks_futex_wait 一致)
+// 内核不支持 futex_waitv 时: 没有通道则只等 localWord, 否则退化为短暂休眠
+inline void ks_futex_waitv(const WaitHandle* handles, size_t n,
+                           std::atomic<uint32_t>* localWord, uint32_t localExpected, uint32_t timeoutUs) {
+    static std::atomic<bool> unsupported(false);
+    if (n == 0) {
+        struct timespec ts;
+        ts.tv_sec = timeoutUs / 1000000;
+        ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(localWord), FUTEX_WAIT_PRIVATE, localExpected,
+                timeoutUs ? &ts : nullptr, nullptr, 0);
+        return;
+    }
+    if (n < KS_FUTEX_WAITV_MAX && !unsupported.load(std::memory_order_relaxed)) {
+        KsFutexWaitv waiters[KS_FUTEX_WAITV_MAX];
+        for (size_t i = 0; i < n; i++) {
+            waiters[i].val = handles[i].expected;
+            waiters[i].uaddr = reinterpret_cast<uintptr_t>(handles[i].futexWord);
+            waiters[i].flags = 2;   // FUTEX_32, 共享
+            waiters[i].reserved = 0;
+        }
+        waiters[n].val = localExpected;
+        waiters[n].uaddr = reinterpret_cast<uintptr_t>(localWord);
+        waiters[n].flags = 2 | FUTEX_PRIVATE_FLAG;
+        waiters[n].reserved = 0;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutUs / 1000000;
+        deadline.tv_nsec += (timeoutUs % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        long rc = syscall(__NR_futex_waitv, waiters, n + 1, 0, timeoutUs ? &deadline : nullptr, CLOCK_MONOTONIC);
+        if (rc >= 0 || errno != ENOSYS) return;
+        unsupported.store(true, std::memory_order_relaxed);
+    }
+    if (n == 1) {
+        // 退化路径看不到 localWord, 无论 timeoutUs 为何值都只短暂休眠
+        ks_futex_wait(handles[0].futexWord, handles[0].expected, timeoutUs && timeoutUs < 50 ? timeoutUs : 50);
+    } else {
+        usleep(50);
+    }
+}
+
+// 生产者: 发布数据之后调用, 对端已休眠时才唤醒
+inline void ks_notify_peer(std::atomic<uint32_t>& futexWord, std::atomic<uint32_t>& peerParked) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (peerParked.load(std::memory_order_relaxed)) {
+        futexWord.fetch_add(1, std::memory_order_release);
+        ks_futex_wake(&futexWord);
+    }
+}
+
+// 消费者侧的退避状态, 每次等待循环开始时 reset()
+class Backoff {
+public:
+    explicit Backoff(const WaitStrategy& s) : strategy_(s) {}
+
+    void reset() { iter_ = 0; }
+
+    // 自旋/让出阶段执行一步; 返回 false 表示预算已用完, 调用者应当休眠
+    bool step() {
+        if (strategy_.mode == WaitMode::Spin || iter_ < strategy_.spinIters) {
+            iter_++;
+            cpu_relax();
+            return true;
+        }
+        if (iter_ < strategy_.spinIters + strategy_.yieldIters) {
+            iter_++;
+            sched_yield();
+            return true;
+        }
+        return false;
+    }
+
+    // 执行一步等待; 进入 futex 阶段前调用 isReady() 做最后一次检查以避免丢失唤醒
+    template <typename Ready>
+    void pause(std::atomic<uint32_t>& futexWord, std::atomic<uint32_t>& parked, Ready isReady) {
+        if (step()) return;
+        uint32_t seq = futexWord.load(std::memory_order_acquire);
+        parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!isReady()) {
+            ks_futex_wait(&futexWord, seq, strategy_.futexTimeoutUs);
+        }
+        parked.store(0, std::memory_order_relaxed);
+    }
+
+    // 无 futex 可用时 (例如等待队列空间) 的退避: 自旋 -> 让出 -> 短暂休眠
+    void pauseNoFutex() {
+        if (!step()) usleep(50);
+    }
+
+private:
+    const WaitStrategy& strategy_;
+    uint32_t iter_ = 0;
+};